@@ -0,0 +1,408 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <SDL3/SDL.h>
+
+#include "camera.h"
+#include "constants.h"
+#include "draw.h"
+#include "instancing.h"
+#include "model.h"
+#include "render_modes.h"
+#include "render_target.h"
+#include "sdl_gfx.h"
+
+// Renders a scripted camera/model path for every asset, render mode and projection without a window
+// and reports frame time percentiles plus triangle and pixel throughput as CSV or JSON.
+
+typedef struct {
+    const char* name;
+    const char* mesh_path;
+    const char* texture_path;
+    float scale;
+} bench_asset_t;
+
+typedef struct {
+    const char* asset;
+    int render_mode;
+    projection_type proj_type;
+    int frames;
+    double mean_ms;
+    double p50_ms;
+    double p99_ms;
+    double triangles_per_sec;
+    double pixels_per_sec;
+} bench_result_t;
+
+typedef struct {
+    int frames;
+    int warmup;
+    int threads;
+    int width;
+    int height;
+    bool deferred;
+    bool depth_prepass;
+    bool sort_clusters;
+    bool lod; // levels of detail picked by size on screen
+    int lights; // point lights in place of the two scene lights, 0 keeps those
+    bool shadows; // shadow maps for the two scene lights
+    int instances; // a field of that many copies of the asset drawn after it
+    texture_filter filter;
+    texture_address address;
+    const char* isa;
+    const char* format;
+    const char* output;
+    const char* dump; // every frame rendered, warmup included, written to this .ppm/.png pattern and timed with it
+} bench_options_t;
+
+static const bench_asset_t assets[] = {
+    { "cube",   "./assets/cube.obj",         "./assets/box.png",        1.0f },
+    { "monkey", "./assets/monkey.obj",       "./assets/uv_checker.png", 1.0f },
+    { "bunny",  "./assets/bunny_no_uvs.obj", "./assets/uv_checker.png", 0.6f },
+};
+
+static int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of an ascending array
+static double percentile(const double* sorted, const int count, const double p) {
+    int rank = (int)ceil(p * count) - 1;
+    if (rank < 0) rank = 0;
+    if (rank >= count) rank = count - 1;
+    return sorted[rank];
+}
+
+static int count_shaded_pixels(const render_target_t* target, const uint32_t clear_color) {
+    int count = 0;
+    for (int y = 0; y < target->height; ++y) {
+        const uint32_t* row = &target->color[y * target->stride];
+        for (int x = 0; x < target->width; ++x) {
+            count += row[x] != clear_color;
+        }
+    }
+    return count;
+}
+
+// The path is a function of t in [0, 1) only, so every run and every commit sees the same frames
+static void place_scene(model_t* model, camera_t* camera, const float t) {
+    const float angle = 360.0f * t * DEG_TO_RAD;
+
+    camera->position = (vec3_t){ 0.5f * sinf(angle), 0.25f * cosf(angle), -3.0f };
+
+    model->translation = (vec3_t){ 0.0f, 0.0f, 0.5f + 0.75f * sinf(2.0f * angle) };
+    model->rotation = (vec3_t){ 30.0f + 360.0f * t, 360.0f * t, 15.0f * sinf(angle) };
+}
+
+// The two lights of the interactive scene with their shadow maps if any, or --lights point lights spread around
+// the model
+static void place_lights(light_t* lights, shadow_map_t* const* shadow_maps, const bench_options_t* options, const mat4x4_t view_mat) {
+    if (options->lights > 0) {
+        scatter_lights(lights, options->lights, POINT_LIGHT_RANGE, POINT_LIGHT_INTENSITY, view_mat);
+        return;
+    }
+    lights[0] = make_light((vec3_t){-2.0f, 2.0f, 1.0f}, (vec3_t){ 1.0f, 1.0f, 0.0f}, (vec4_t){1.0f, 0.0f, 0.0f, 1.0f}, 0.0f, view_mat);
+    lights[1] = make_light((vec3_t){2.0f, -2.0f, 1.0f}, (vec3_t){-1.0f, -1.0f, 0.0f}, (vec4_t){0.0f, 1.0f, 0.0f, 1.0f}, 0.0f, view_mat);
+    lights[0].shadow = shadow_maps[0];
+    lights[1].shadow = shadow_maps[1];
+}
+
+static bench_result_t run_case(sdl_gfx* gfx, const render_target_t* target, model_t* model, const char* asset_name,
+                               const int render_mode, const projection_type proj_type, const bench_options_t* options,
+                               light_t* lights, light_grid_t* light_grid, shadow_map_t* const* shadow_maps,
+                               instance_batch_t* instance_batch, const instance_t* instances, double* frame_ms) {
+    const mat4x4_t proj_mat = proj_type == PERSPECTIVE
+        ? make_perspective_matrix(FOV, target->width, target->height, NEAR_PLANE, FAR_PLANE)
+        : make_orthographic_matrix(target->width, target->height, NEAR_PLANE, FAR_PLANE);
+
+    const vec3_t ambient = { 0.2f, 0.2f, 0.2f };
+    const vec3_t ambient2 = { 0.1f, 0.1f, 0.2f };
+
+    camera_t camera = make_camera((vec3_t){0.0f, 0.0f, -3.0f});
+
+    double total_ms = 0.0;
+    double total_pixels = 0.0;
+    double total_triangles = 0.0;
+
+    for (int i = -options->warmup; i < options->frames; ++i) {
+        const int frame = (i % options->frames + options->frames) % options->frames;
+        place_scene(model, &camera, (float)frame / (float)options->frames);
+
+        const Uint64 start = SDL_GetPerformanceCounter();
+
+        update_camera(&camera);
+        const mat4x4_t view_mat = camera.view_mat;
+        place_lights(lights, shadow_maps, options, view_mat);
+
+        apply_transformations(model, &camera);
+        if (options->lod) {
+            select_model_lod(model, &camera, &proj_mat, proj_type, target->height);
+        }
+        // The camera moves every frame and the light with it, so the maps are redrawn every frame as well
+        const vec3_t shadow_target = mat4_mul_vec3(&view_mat, (vec3_t){0.0f, 0.0f, 0.5f});
+        for (int l = 0; l < 2; ++l) {
+            if (shadow_maps[l] != NULL) {
+                update_shadow_map(shadow_maps[l], &lights[l], shadow_target, &model, 1);
+            }
+        }
+        clear_z_buffer(target->z_buffer);
+        clear_render_target_color(target, COLOR_BLACK);
+        bin_lights(light_grid, lights, options->lights > 0 ? options->lights : 2, target, &proj_mat);
+
+        if (options->depth_prepass) {
+            draw_model_depth(target, model, render_mode, &proj_mat, proj_type);
+        }
+        draw_model(target, model, render_mode, light_grid, &proj_mat, proj_type, ambient, ambient2);
+        if (options->instances > 0) {
+            draw_instances(target, instance_batch, instances, options->instances, render_mode, light_grid,
+                &view_mat, &proj_mat, proj_type, ambient, ambient2, options->lod ? target->height : 0);
+        }
+
+        sdl_gfx_render(gfx);
+
+        const Uint64 end = SDL_GetPerformanceCounter();
+
+        if (i < 0)
+            continue;
+
+        frame_ms[i] = (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        total_ms += frame_ms[i];
+        total_pixels += count_shaded_pixels(target, COLOR_BLACK);
+        total_triangles += model_mesh(model)->triangle_count + (double)model->lods[0].triangle_count * options->instances;
+    }
+
+    qsort(frame_ms, options->frames, sizeof(double), compare_doubles);
+
+    const double total_sec = total_ms > 0.0 ? total_ms / 1000.0 : 1e-9;
+
+    bench_result_t result;
+    result.asset = asset_name;
+    result.render_mode = render_mode;
+    result.proj_type = proj_type;
+    result.frames = options->frames;
+    result.mean_ms = total_ms / options->frames;
+    result.p50_ms = percentile(frame_ms, options->frames, 0.50);
+    result.p99_ms = percentile(frame_ms, options->frames, 0.99);
+    result.triangles_per_sec = total_triangles / total_sec;
+    result.pixels_per_sec = total_pixels / total_sec;
+    return result;
+}
+
+static const char* projection_name(const projection_type proj_type) {
+    return proj_type == PERSPECTIVE ? "perspective" : "orthographic";
+}
+
+static void write_csv(FILE* out, const bench_result_t* results, const int count, const char* isa, const int threads, const char* pipeline) {
+    fprintf(out, "asset,render_mode,mode_name,projection,isa,threads,pipeline,frames,mean_ms,p50_ms,p99_ms,triangles_per_sec,shaded_pixels_per_sec\n");
+    for (int i = 0; i < count; ++i) {
+        const bench_result_t* r = &results[i];
+        fprintf(out, "%s,%d,%s,%s,%s,%d,%s,%d,%.4f,%.4f,%.4f,%.0f,%.0f\n",
+            r->asset, r->render_mode, render_mode_name(r->render_mode), projection_name(r->proj_type),
+            isa, threads, pipeline, r->frames, r->mean_ms, r->p50_ms, r->p99_ms, r->triangles_per_sec, r->pixels_per_sec);
+    }
+}
+
+static void write_json(FILE* out, const bench_result_t* results, const int count, const render_target_t* target,
+                       const char* isa, const int threads, const char* pipeline) {
+    fprintf(out, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"isa\": \"%s\",\n  \"threads\": %d,\n  \"pipeline\": \"%s\",\n  \"results\": [\n",
+        target->width, target->height, isa, threads, pipeline);
+    for (int i = 0; i < count; ++i) {
+        const bench_result_t* r = &results[i];
+        fprintf(out, "    {\"asset\": \"%s\", \"render_mode\": %d, \"mode_name\": \"%s\", \"projection\": \"%s\", "
+                     "\"frames\": %d, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, "
+                     "\"triangles_per_sec\": %.0f, \"shaded_pixels_per_sec\": %.0f}%s\n",
+            r->asset, r->render_mode, render_mode_name(r->render_mode), projection_name(r->proj_type),
+            r->frames, r->mean_ms, r->p50_ms, r->p99_ms, r->triangles_per_sec, r->pixels_per_sec,
+            i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [--frames count] [--warmup count] [--threads count] [--isa scalar|sse2|avx2]\n"
+        "          [--size WxH, at most %dx%d] [--deferred] [--depth-prepass] [--sort-clusters] [--lod]\n"
+        "          [--filter nearest|bilinear|trilinear] [--address wrap|clamp] [--lights count] [--shadows]\n"
+        "          [--instances count] [--format csv|json] [--output path] [--dump path%%d.ppm|png]\n", program, RENDER_TARGET_MAX_SIZE, RENDER_TARGET_MAX_SIZE);
+}
+
+static bool parse_options(const int argc, char* argv[], bench_options_t* options) {
+    for (int i = 1; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            options->frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0 && has_value) {
+            options->warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            options->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &options->width, &options->height) != 2)
+                return false;
+        } else if (strcmp(argv[i], "--deferred") == 0) {
+            options->deferred = true;
+        } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            options->depth_prepass = true;
+        } else if (strcmp(argv[i], "--sort-clusters") == 0) {
+            options->sort_clusters = true;
+        } else if (strcmp(argv[i], "--lod") == 0) {
+            options->lod = true;
+        } else if (strcmp(argv[i], "--lights") == 0 && has_value) {
+            options->lights = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shadows") == 0) {
+            options->shadows = true;
+        } else if (strcmp(argv[i], "--instances") == 0 && has_value) {
+            options->instances = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            if (!texture_filter_from_name(argv[++i], &options->filter))
+                return false;
+        } else if (strcmp(argv[i], "--address") == 0 && has_value) {
+            if (!texture_address_from_name(argv[++i], &options->address))
+                return false;
+        } else if (strcmp(argv[i], "--isa") == 0 && has_value) {
+            isa_level level;
+            if (!isa_from_name(argv[++i], &level))
+                return false;
+            options->isa = argv[i];
+        } else if (strcmp(argv[i], "--format") == 0 && has_value) {
+            options->format = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            options->output = argv[++i];
+        } else if (strcmp(argv[i], "--dump") == 0 && has_value) {
+            options->dump = argv[++i];
+        } else {
+            return false;
+        }
+    }
+
+    if (options->frames < 1 || options->warmup < 0 || options->lights < 0 || options->instances < 0)
+        return false;
+
+    return strcmp(options->format, "csv") == 0 || strcmp(options->format, "json") == 0;
+}
+
+int main(const int argc, char* argv[]) {
+    bench_options_t options = { 120, 10, 0, SCREEN_WIDTH, SCREEN_HEIGHT, false, false, false, false, 0, false, 0, TEXTURE_NEAREST, TEXTURE_WRAP, NULL, "csv", NULL, NULL };
+
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    sdl_gfx* gfx = sdl_gfx_init_headless(options.width, options.height);
+    if (gfx == NULL) {
+        return 1;
+    }
+    sdl_gfx_set_dump_path(gfx, options.dump);
+
+    render_target_t* target = make_render_target_for_buffer(gfx->buffer, gfx->width, gfx->height, gfx->width);
+    if (target == NULL) {
+        sdl_gfx_dispose(gfx);
+        return 1;
+    }
+
+    draw_init(options.threads);
+
+    // Validated by parse_options, a level the CPU lacks still falls back and the report names the one used
+    isa_level level;
+    if (options.isa != NULL && isa_from_name(options.isa, &level)) {
+        draw_set_isa(level);
+    }
+
+    if (options.deferred) {
+        draw_set_deferred(true);
+    }
+    draw_set_texture_filter(options.filter);
+
+    const int asset_count = sizeof(assets) / sizeof(assets[0]);
+    const int case_count = asset_count * RENDER_MODES_COUNT * 2;
+
+    bench_result_t* results = malloc(case_count * sizeof(bench_result_t));
+    double* frame_ms = malloc(options.frames * sizeof(double));
+    light_t* lights = malloc((options.lights > 0 ? options.lights : 2) * sizeof(light_t));
+    light_grid_t light_grid = {0};
+    shadow_map_t* shadow_maps[] = { NULL, NULL };
+    instance_t* instances = options.instances > 0 ? malloc(options.instances * sizeof(instance_t)) : NULL;
+    for (int i = 0; options.shadows && options.lights == 0 && i < 2; ++i) {
+        shadow_maps[i] = make_shadow_map(SHADOW_MAP_SIZE, SHADOW_FOV, 1);
+    }
+    if (results == NULL || frame_ms == NULL || lights == NULL || (options.instances > 0 && instances == NULL)) {
+        fprintf(stderr, "Failed to allocate benchmark results.\n");
+        return 1;
+    }
+
+    int result_count = 0;
+    for (int a = 0; a < asset_count; ++a) {
+        model_t model = load_model(assets[a].mesh_path, assets[a].texture_path, COLOR_WHITE, COLOR_GREEN);
+        model.scale = assets[a].scale;
+        texture_set_address(&model.texture, options.address);
+        model.sort_clusters = options.sort_clusters;
+
+        instance_batch_t* instance_batch = NULL;
+        if (options.instances > 0) {
+            instance_batch = make_instance_batch(&model);
+            if (instance_batch == NULL)
+                return 1;
+            arrange_instance_grid(instances, options.instances, INSTANCE_FIELD_CENTER, INSTANCE_FIELD_SPACING, INSTANCE_FIELD_SCALE * assets[a].scale);
+        }
+
+        for (int proj = 0; proj < 2; ++proj) {
+            for (int mode = 0; mode < RENDER_MODES_COUNT; ++mode) {
+                results[result_count++] = run_case(gfx, target, &model, assets[a].name, mode, (projection_type)proj, &options, lights, &light_grid, shadow_maps,
+                                                     instance_batch, instances, frame_ms);
+            }
+        }
+        free_instance_batch(instance_batch);
+        free_model(&model);
+    }
+
+    FILE* out = stdout;
+    if (options.output != NULL) {
+        out = fopen(options.output, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Failed to open %s for writing.\n", options.output);
+            return 1;
+        }
+    }
+
+    const char* isa = isa_name(draw_get_isa());
+    const int threads = draw_thread_count();
+    char pipeline[96];
+    char lights_name[32] = "";
+    char instances_name[32] = "";
+    if (options.lights > 0) {
+        SDL_snprintf(lights_name, sizeof(lights_name), "+%dlights", options.lights);
+    } else if (options.shadows) {
+        SDL_snprintf(lights_name, sizeof(lights_name), "+shadows");
+    }
+    if (options.instances > 0) {
+        SDL_snprintf(instances_name, sizeof(instances_name), "+%dinstances", options.instances);
+    }
+    SDL_snprintf(pipeline, sizeof(pipeline), "%s%s%s%s%s%s%s%s%s", draw_get_deferred() ? "deferred" : "forward",
+        options.depth_prepass ? "+prepass" : "", options.sort_clusters ? "+sorted" : "", options.lod ? "+lod" : "",
+        options.filter != TEXTURE_NEAREST ? "+" : "", options.filter != TEXTURE_NEAREST ? texture_filter_name(options.filter) : "",
+        options.address == TEXTURE_CLAMP ? "+clamp" : "", lights_name, instances_name);
+    if (strcmp(options.format, "json") == 0) {
+        write_json(out, results, result_count, target, isa, threads, pipeline);
+    } else {
+        write_csv(out, results, result_count, isa, threads, pipeline);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    free_light_grid(&light_grid);
+    free_shadow_map(shadow_maps[0]);
+    free_shadow_map(shadow_maps[1]);
+    free(instances);
+    free(lights);
+    free(frame_ms);
+    free(results);
+    draw_dispose();
+    free_render_target(target);
+    sdl_gfx_dispose(gfx);
+    return 0;
+}
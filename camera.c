@@ -1,8 +1,25 @@
 ﻿#include "camera.h"
 
+static void rebuild_view(camera_t* camera) {
+    camera->view_mat = make_view_matrix(camera->position, camera->target);
+    camera->view_position = camera->position;
+    camera->view_target = camera->target;
+    camera->view_version++;
+}
+
 camera_t make_camera(const vec3_t position) {
     camera_t camera;
     camera.position = position;
     camera.target = (vec3_t){0.0f, 0.0f, -1.0f};
+    camera.view_version = 0;
+    rebuild_view(&camera);
     return camera;
+}
+
+bool update_camera(camera_t* camera) {
+    if (vec3_equal(camera->position, camera->view_position) && vec3_equal(camera->target, camera->view_target))
+        return false;
+
+    rebuild_view(camera);
+    return true;
 }
\ No newline at end of file
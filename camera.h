@@ -1,13 +1,24 @@
 ﻿#ifndef SOFTWARE_RENDERER_C_CAMERA_H
 #define SOFTWARE_RENDERER_C_CAMERA_H
 
+#include <stdbool.h>
+#include "matrix.h"
 #include "vectors.h"
 
 typedef struct {
     vec3_t position;
     vec3_t target;
+
+    // Shared by every model, rebuilt by update_camera when position or target changed
+    mat4x4_t view_mat;
+    vec3_t view_position;
+    vec3_t view_target;
+    unsigned int view_version; // bumped on every rebuild, lets models tell whether their cached matrices are stale
 } camera_t;
 
 camera_t make_camera(vec3_t position);
 
+// Call after moving the camera, returns true when the view matrix had to be rebuilt
+bool update_camera(camera_t* camera);
+
 #endif //SOFTWARE_RENDERER_C_CAMERA_H
\ No newline at end of file
@@ -0,0 +1,44 @@
+﻿# Renders every bench case once into OUTPUT with the bench options in OPTIONS and, when REFERENCE is given, fails
+# unless each frame is byte for byte the one rendered there:
+#   cmake -DBENCH=renderer_bench -DOUTPUT=dir [-DREFERENCE=dir] [-DOPTIONS="--isa sse2"] -P compare_renders.cmake
+# Run from the bench's directory, it loads ./assets.
+
+separate_arguments(options UNIX_COMMAND "${OPTIONS}")
+
+file(REMOVE_RECURSE "${OUTPUT}")
+file(MAKE_DIRECTORY "${OUTPUT}")
+execute_process(
+    COMMAND "${BENCH}" --frames 1 --warmup 0 ${options} --dump "${OUTPUT}/frame%03d.ppm" --output "${OUTPUT}/bench.csv"
+    RESULT_VARIABLE result
+)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "renderer_bench ${OPTIONS} failed: ${result}")
+endif()
+
+file(GLOB frames RELATIVE "${OUTPUT}" "${OUTPUT}/*.ppm")
+if(NOT frames)
+    message(FATAL_ERROR "renderer_bench ${OPTIONS} dumped no frames")
+endif()
+if(NOT DEFINED REFERENCE)
+    return()
+endif()
+
+file(GLOB reference_frames RELATIVE "${REFERENCE}" "${REFERENCE}/*.ppm")
+if(NOT frames STREQUAL reference_frames)
+    message(FATAL_ERROR "renderer_bench ${OPTIONS} dumped other frames than the reference: ${frames}")
+endif()
+
+set(mismatched "")
+foreach(frame IN LISTS frames)
+    execute_process(
+        COMMAND "${CMAKE_COMMAND}" -E compare_files "${OUTPUT}/${frame}" "${REFERENCE}/${frame}"
+        RESULT_VARIABLE different
+    )
+    if(NOT different EQUAL 0)
+        list(APPEND mismatched "${frame}")
+    endif()
+endforeach()
+if(mismatched)
+    list(JOIN mismatched ", " mismatched)
+    message(FATAL_ERROR "renderer_bench ${OPTIONS} differs from the reference in ${mismatched}")
+endif()
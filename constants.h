@@ -1,10 +1,24 @@
 ﻿#ifndef SOFTWARE_RENDERER_C_CONSTANTS_H
 #define SOFTWARE_RENDERER_C_CONSTANTS_H
 
+// Window size, everything below the window draws into render targets of their own size
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
 #define FOV 70
 #define NEAR_PLANE 1.0
 #define FAR_PLANE 100.0
 
+// The point lights --lights scatters around the scene
+#define POINT_LIGHT_RANGE 0.75f
+#define POINT_LIGHT_INTENSITY 0.5f
+
+// The shadow maps of --shadows, aimed at the middle of the scene
+#define SHADOW_MAP_SIZE 1024
+#define SHADOW_FOV 90.0f
+
+// The cube field of --instances, on the floor beyond the models
+#define INSTANCE_FIELD_CENTER ((vec3_t){ 0.0f, -1.5f, 10.5f })
+#define INSTANCE_FIELD_SPACING 0.2f
+#define INSTANCE_FIELD_SCALE 0.05f
+
 #endif //SOFTWARE_RENDERER_C_CONSTANTS_H
\ No newline at end of file
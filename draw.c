@@ -1,17 +1,61 @@
-﻿#include <math.h>
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
 #include "draw.h"
 #include "constants.h"
-#include "sort.h"
+#include "raster.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+// Triangles reaching past this many pixels beyond any target edge are clipped in x and y as well. Inside the band
+// subpixel deltas stay below 2^15, which keeps every edge function value on the target within 32 bits, so the
+// band narrows as targets get larger.
+#define GUARD_BAND 512
+// Clipping against the band rounds in floats, clipped vertices may land this far outside it
+#define GUARD_BAND_SLACK 16
+#define GUARD_BAND_EXTENT(subpixel_bits) ((32768 >> (subpixel_bits)) - 1)
+
+#if RENDER_TARGET_MAX_SIZE + 2 * (1 + GUARD_BAND_SLACK) > GUARD_BAND_EXTENT(RASTER_MIN_SUBPIXEL_BITS)
+#error "RENDER_TARGET_MAX_SIZE leaves no room for a guard band"
+#endif
+
+// The target of the current draw call, set by begin_batch
+typedef struct {
+    int width;
+    int height;
+    int subpixel_bits;      // vertices snap to 1 / 2^subpixel_bits of a pixel
+    int guard_band;         // pixels
+    float guard_x, guard_y; // the band in clip space, as multiples of w
+} viewport_t;
+
+static viewport_t viewport;
+
+// Picks the finest subpixel precision that still leaves the target a guard band, see RENDER_TARGET_MAX_SIZE
+static void set_viewport(const int width, const int height) {
+    const int largest = width > height ? width : height;
+    int bits = RASTER_SUBPIXEL_BITS;
+    while (bits > RASTER_MIN_SUBPIXEL_BITS && largest + 2 * (1 + GUARD_BAND_SLACK) > GUARD_BAND_EXTENT(bits)) {
+        bits--;
+    }
+    const int room = (GUARD_BAND_EXTENT(bits) - largest) / 2 - GUARD_BAND_SLACK;
+    viewport.width = width;
+    viewport.height = height;
+    viewport.subpixel_bits = bits;
+    viewport.guard_band = room < GUARD_BAND ? room : GUARD_BAND;
+    viewport.guard_x = 1.0f + 2.0f * (float)viewport.guard_band / (float)width;
+    viewport.guard_y = 1.0f + 2.0f * (float)viewport.guard_band / (float)height;
+}
 
-static vec3_t project_to_screen(const projection_type proj_type, const mat4x4_t* mat, const vec3_t v) {
-    const vec4_t clip = mat4x4_mul_vec4(mat, (vec4_t){v.x, v.y, v.z, 1.0f});
+static vec3_t clip_to_screen(const projection_type proj_type, const vec4_t clip) {
     const float inv_w = 1.0f / clip.w;
 
     const float ndc_x = clip.x * inv_w;
     const float ndc_y = clip.y * inv_w;
 
-    const float screen_x = (ndc_x * 0.5f + 0.5f) * SCREEN_WIDTH;
-    const float screen_y = (-ndc_y * 0.5f + 0.5f) * SCREEN_HEIGHT;
+    const float screen_x = (ndc_x * 0.5f + 0.5f) * (float)viewport.width;
+    const float screen_y = (-ndc_y * 0.5f + 0.5f) * (float)viewport.height;
 
     if (proj_type == PERSPECTIVE) {
         return (vec3_t){screen_x, screen_y, inv_w};
@@ -20,823 +64,1435 @@ static vec3_t project_to_screen(const projection_type proj_type, const mat4x4_t*
     return (vec3_t){screen_x, screen_y, -clip.z};
 }
 
-static vec3_t barycentric_weights(const vec2_t a, const vec2_t b, const vec2_t c, const vec2_t p) {
-    const vec2_t ac = vec2_diff(c, a);
-    const vec2_t ab = vec2_diff(b, a);
-    const vec2_t ap = vec2_diff(p, a);
-    const vec2_t pc = vec2_diff(c, p);
-    const vec2_t pb = vec2_diff(b, p);
+static bool is_in_guard_band(const float v, const int size) {
+    const int margin = viewport.guard_band + GUARD_BAND_SLACK;
+    return v >= (float)-margin && v <= (float)(size + margin);
+}
 
-    const float area = ac.x * ab.y - ac.y * ab.x;
+// To subpixels, false for positions clipping should have kept out (or NaN) whose edge functions could overflow
+static bool snap(const vec3_t p, int* x, int* y) {
+    if (!is_in_guard_band(p.x, viewport.width) || !is_in_guard_band(p.y, viewport.height))
+        return false;
+    const float scale = (float)(1 << viewport.subpixel_bits);
+    *x = (int)lrintf(p.x * scale);
+    *y = (int)lrintf(p.y * scale);
+    return true;
+}
 
-    const float alpha = (pc.x * pb.y - pc.y * pb.x) / area;
-    const float beta  = (ac.x * ap.y - ac.y * ap.x) / area;
-    const float gamma = 1.0f - alpha - beta;
+static int min3(const int a, const int b, const int c) {
+    const int m = a < b ? a : b;
+    return m < c ? m : c;
+}
 
-    return (vec3_t){alpha, beta, gamma};
+static int max3(const int a, const int b, const int c) {
+    const int m = a > b ? a : b;
+    return m > c ? m : c;
 }
 
-static bool is_back_face(const projection_type proj_type, const vec3_t v1, const vec3_t v2, const vec3_t v3) {
-    const vec3_t edge1 = {v2.x - v1.x, v2.y - v1.y, v2.z - v1.z};
-    const vec3_t edge2 = {v3.x - v1.x, v3.y - v1.y, v3.z - v1.z};
+// E(p) = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x) in subpixels, sampled at pixel centers
+static void edge_coefficients(const int ax, const int ay, const int bx, const int by, const int sign, int* dx, int* dy, int* c, int* min) {
+    const int a = (ay - by) * sign;
+    const int b = (bx - ax) * sign;
+    const int scale = 1 << viewport.subpixel_bits;
+    const int half = scale / 2;
+    *dx = a * scale;
+    *dy = b * scale;
+    *c  = a * (half - ax) + b * (half - ay);
+
+    // Top-left rule: the inside lies to the right of a left edge, and below a horizontal top edge
+    const bool top_left = a > 0 || (a == 0 && b > 0);
+    *min = top_left ? 0 : 1;
+}
 
-    const vec3_t cross = vec3_cross(edge1, edge2);
-    const vec3_t cross_norm = vec3_normalize(cross);
+static bool setup_edges(edge_setup_t* e, const vec3_t p1, const vec3_t p2, const vec3_t p3) {
+    int x1, y1, x2, y2, x3, y3;
+    if (!snap(p1, &x1, &y1) || !snap(p2, &x2, &y2) || !snap(p3, &x3, &y3))
+        return false;
+
+    const int area = (x2 - x1) * (y3 - y1) - (y2 - y1) * (x3 - x1);
+    if (area == 0)
+        return false;
+
+    const int sign = area > 0 ? 1 : -1;
+    edge_coefficients(x2, y2, x3, y3, sign, &e->e1_dx, &e->e1_dy, &e->e1_c, &e->e1_min);
+    edge_coefficients(x3, y3, x1, y1, sign, &e->e2_dx, &e->e2_dy, &e->e2_c, &e->e2_min);
+    edge_coefficients(x1, y1, x2, y2, sign, &e->e3_dx, &e->e3_dy, &e->e3_c, &e->e3_min);
+    e->inv_area = 1.0f / (float)(area * sign);
+
+    // Pixels whose centers can be covered, x * scale + scale / 2 within the snapped bounds
+    const int bits = viewport.subpixel_bits;
+    const int scale = 1 << bits;
+    const int half = scale / 2;
+    const int min_x = (min3(x1, x2, x3) - half + scale - 1) >> bits;
+    const int max_x = (max3(x1, x2, x3) - half) >> bits;
+    const int min_y = (min3(y1, y2, y3) - half + scale - 1) >> bits;
+    const int max_y = (max3(y1, y2, y3) - half) >> bits;
+
+    e->min_x = min_x > 0 ? min_x : 0;
+    e->max_x = max_x < viewport.width - 1 ? max_x : viewport.width - 1;
+    e->min_y = min_y > 0 ? min_y : 0;
+    e->max_y = max_y < viewport.height - 1 ? max_y : viewport.height - 1;
+    return e->min_x <= e->max_x && e->min_y <= e->max_y;
+}
 
-    vec3_t to_camera;
+// Outcodes against the clip space planes. The screen depth 1/w (perspective) or -z (orthographic) must stay within
+// [-1, 1], which leaves w >= 1 in front of the perspective camera and -1 <= z <= 1 for the orthographic one.
+enum {
+    CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_TOP = 4, CLIP_BOTTOM = 8, CLIP_NEAR = 16, CLIP_FAR = 32,
+    CLIP_GUARD = 64 // beyond the guard band, not a single plane so it only asks for clipping
+};
+
+static int clip_flags(const projection_type proj_type, const vec4_t c) {
+    int flags = 0;
+    if (c.x < -c.w) flags |= CLIP_LEFT;
+    if (c.x > c.w) flags |= CLIP_RIGHT;
+    if (c.y > c.w) flags |= CLIP_TOP;
+    if (c.y < -c.w) flags |= CLIP_BOTTOM;
     if (proj_type == PERSPECTIVE) {
-        to_camera = vec3_normalize(v1);
+        if (!(c.w >= 1.0f)) flags |= CLIP_NEAR;
     }
     else {
-        to_camera = (vec3_t){0.0f, 0.0f, -1.0f};
+        if (c.z < -1.0f) flags |= CLIP_NEAR;
+        if (c.z > 1.0f) flags |= CLIP_FAR;
     }
-
-    return vec3_dot(cross_norm, to_camera) >= 0.0f;
+    if (fabsf(c.x) > viewport.guard_x * c.w || fabsf(c.y) > viewport.guard_y * c.w) flags |= CLIP_GUARD;
+    return flags;
 }
 
-static bool is_outside_frustum(const vec3_t p1, const vec3_t p2, const vec3_t p3) {
-    if (p1.z > 1.0f || p2.z > 1.0f || p3.z > 1.0f || p1.z < -1.0f || p2.z < -1.0f || p3.z < -1.0f)
-        return true;
+// Rejects triangles with all vertices beyond the same plane, the ones crossing the depth planes or the guard band
+// are clipped instead
+static bool is_outside_frustum(const int clip1, const int clip2, const int clip3) {
+    return (clip1 & clip2 & clip3 & ~CLIP_GUARD) != 0;
+}
 
-    const float min_x = fminf(p1.x, fminf(p2.x, p3.x));
-    const float max_x = fmaxf(p1.x, fmaxf(p2.x, p3.x));
-    const float min_y = fminf(p1.y, fminf(p2.y, p3.y));
-    const float max_y = fmaxf(p1.y, fmaxf(p2.y, p3.y));
+static bool needs_clipping(const int clip1, const int clip2, const int clip3) {
+    return ((clip1 | clip2 | clip3) & (CLIP_NEAR | CLIP_FAR | CLIP_GUARD)) != 0;
+}
 
-    if (max_x < 0.0f || min_x > SCREEN_WIDTH || max_y < 0.0f || min_y > SCREEN_HEIGHT)
-        return true;
+// Clip space row i as a linear function of view space positions, gradient and offset
+static void clip_row(const mat4x4_t* mat, const int i, vec3_t* gradient, float* offset) {
+    *gradient = (vec3_t){mat->m[i][0], mat->m[i][1], mat->m[i][2]};
+    *offset = mat->m[i][3];
+}
 
-    return false;
+// Range of gradient . v + offset over the sphere, widened by a relative margin for the rounding of the per-triangle path
+static void sphere_range(const vec3_t gradient, const float offset, const cluster_bounds_t* bounds, float* lo, float* hi) {
+    const float value = vec3_dot(gradient, bounds->center) + offset;
+    const float gradient_len = sqrtf(vec3_dot(gradient, gradient));
+    const float extent = gradient_len * bounds->radius;
+    const float margin = 1e-4f * (gradient_len * (sqrtf(vec3_dot(bounds->center, bounds->center)) + bounds->radius) + fabsf(offset));
+    *lo = value - extent - margin;
+    *hi = value + extent + margin;
 }
 
-static bool is_point_outside_viewport(const int x, const int y) {
-    return x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT;
+// Cluster back-facing when every normal of the cone faces away from every point of the sphere
+static bool is_cluster_back_facing(const cluster_bounds_t* bounds, const projection_type proj_type) {
+    const float cone_margin = 1e-3f;
+    if (bounds->cone_cos <= 0.0f)
+        return false;
+
+    const float cone_sin = sqrtf(1.0f - bounds->cone_cos * bounds->cone_cos);
+    if (proj_type == ORTHOGRAPHIC) {
+        return -bounds->cone_axis.z >= cone_sin + cone_margin;
+    }
+
+    // The directions to the sphere's points spread by asin(radius / distance) around the center's
+    const float distance = sqrtf(vec3_dot(bounds->center, bounds->center));
+    if (distance <= bounds->radius)
+        return false;
+    const float sphere_sin = bounds->radius / distance;
+    const float sphere_cos = sqrtf(1.0f - sphere_sin * sphere_sin);
+    if (sphere_cos * bounds->cone_cos - sphere_sin * cone_sin <= cone_margin)
+        return false;
+
+    const float axis_cos = vec3_dot(bounds->cone_axis, bounds->center) / distance;
+    return axis_cos >= sphere_sin * bounds->cone_cos + sphere_cos * cone_sin + cone_margin;
 }
 
-static void draw_pixel(const sdl_gfx* gfx, const float x, const float y, const vec3_t p1, const vec3_t p2, const vec3_t p3, const uint32_t color, z_buffer_t* z_buffer) {
-    if (is_point_outside_viewport((int)x, (int)y))
-        return;
+// Cluster outside when every point of the sphere lies beyond the same clip plane, the outcodes' half-spaces
+static bool is_cluster_outside_frustum(const cluster_bounds_t* bounds, const mat4x4_t* proj_mat, const projection_type proj_type) {
+    vec3_t g0, g1, g2, g3;
+    float h0, h1, h2, h3;
+    clip_row(proj_mat, 0, &g0, &h0);
+    clip_row(proj_mat, 1, &g1, &h1);
+    clip_row(proj_mat, 2, &g2, &h2);
+    clip_row(proj_mat, 3, &g3, &h3);
+
+    // Inside when >= 0: left, right, top, bottom, then near and, for orthographic, far
+    vec3_t planes[6] = {
+        vec3_add(g3, g0),
+        vec3_diff(g3, g0),
+        vec3_diff(g3, g1),
+        vec3_add(g3, g1),
+        g3,
+        vec3_mul(g2, -1.0f)
+    };
+    float offsets[6] = { h3 + h0, h3 - h0, h3 - h1, h3 + h1, h3 - 1.0f, 1.0f - h2 };
+    if (proj_type == ORTHOGRAPHIC) {
+        planes[4] = g2;
+        offsets[4] = h2 + 1.0f;
+    }
+    const int plane_count = proj_type == ORTHOGRAPHIC ? 6 : 5;
 
-    const vec2_t p = (vec2_t){(float)x, (float)y};
-    const vec2_t p1_xy = vec2_from_vec3(p1);
-    const vec2_t p2_xy = vec2_from_vec3(p2);
-    const vec2_t p3_xy = vec2_from_vec3(p3);
+    for (int i = 0; i < plane_count; ++i) {
+        float lo, hi;
+        sphere_range(planes[i], offsets[i], bounds, &lo, &hi);
+        if (hi < 0.0f)
+            return true;
+    }
+    return false;
+}
 
-    const vec3_t weights = barycentric_weights(p1_xy, p2_xy, p3_xy, p);
+bool is_cluster_culled(const cluster_bounds_t* view_bounds, const mat4x4_t* proj_mat, const projection_type proj_type, const bool cull_back_faces) {
+    return (cull_back_faces && is_cluster_back_facing(view_bounds, proj_type)) || is_cluster_outside_frustum(view_bounds, proj_mat, proj_type);
+}
+
+static bool draw_depth(
+    const int x, const int y,
+    const float alpha, const float beta, const float gamma,
+    const vec3_t p1, const vec3_t p2, const vec3_t p3,
+    z_buffer_t* z_buffer)
+{
+    const float depth = 1.0f / (alpha*p1.z + beta*p2.z + gamma*p3.z);
 
-    const float alpha = weights.x;
-    const float beta  = weights.y;
-    const float gamma = weights.z;
+    const int z_index = z_buffer->width * y + x;
+    if (depth <= z_buffer->depth[z_index]) {
+        z_buffer->depth[z_index] = depth;
+        return true;
+    }
+    return false;
+}
 
+static bool draw_pixel(
+    const render_target_t* target,
+    const int x, const int y,
+    const float alpha, const float beta, const float gamma,
+    const vec3_t p1, const vec3_t p2, const vec3_t p3,
+    const uint32_t color,
+    z_buffer_t* z_buffer)
+{
     const float depth = 1.0f / (alpha*p1.z + beta*p2.z + gamma*p3.z);
 
-    const int z_index = SCREEN_WIDTH * y + x;
-    if (depth <= (*z_buffer)[z_index]) {
-        sdl_gfx_draw_pixel(gfx, (int)x, (int)y, color);
-        (*z_buffer)[z_index] = depth;
+    const int z_index = z_buffer->width * y + x;
+    if (depth <= z_buffer->depth[z_index]) {
+        target->color[y * target->stride + x] = color;
+        z_buffer->depth[z_index] = depth;
+        return true;
     }
+    return false;
 }
 
-static void draw_pixel_phong(
-    const sdl_gfx* gfx,
-    float x, float y,
-    vec3_t v1, vec3_t v2, vec3_t v3,
-    vec3_t p1, vec3_t p2, vec3_t p3,
-    vec3_t n1, vec3_t n2, vec3_t n3,
-    uint32_t color,
-    const light_t* lights,
-    const int lights_count,
-    z_buffer_t* z_buffer,
-    vec3_t ambient)
+// View-space position and normal at a pixel, the position is interpolated perspective correct like the depth
+static void interpolate_surface(
+    const float alpha, const float beta, const float gamma,
+    const vec3_t v1, const vec3_t v2, const vec3_t v3,
+    const vec3_t p1, const vec3_t p2, const vec3_t p3,
+    const vec3_t n1, const vec3_t n2, const vec3_t n3,
+    const float depth,
+    vec3_t* pos, vec3_t* normal)
 {
-    if (is_point_outside_viewport((int)x, (int)y))
-        return;
+    const vec3_t va = vec3_mul(vec3_mul(v1, p1.z), alpha);
+    const vec3_t vb = vec3_mul(vec3_mul(v2, p2.z), beta);
+    const vec3_t vc = vec3_mul(vec3_mul(v3, p3.z), gamma);
+    *pos = vec3_mul(vec3_add(vec3_add(va, vb), vc), depth);
+
+    const vec3_t na = vec3_mul(n1, alpha);
+    const vec3_t nb = vec3_mul(n2, beta);
+    const vec3_t nc = vec3_mul(n3, gamma);
+    *normal = vec3_normalize(vec3_add(vec3_add(na, nb), nc));
+}
 
-    const vec2_t p = (vec2_t){x, y};
-    const vec2_t p1_xy = vec2_from_vec3(p1);
-    const vec2_t p2_xy = vec2_from_vec3(p2);
-    const vec2_t p3_xy = vec2_from_vec3(p3);
+static uint32_t shade_phong(
+    const vec3_t pos, const vec3_t normal,
+    const uint32_t albedo,
+    const light_list_t lights,
+    const vec3_t ambient)
+{
+    vec3_t light_accum = { ambient.x, ambient.y, ambient.z };
+    for (int i = 0; i < lights.count; ++i) {
+        const light_t* light = &lights.lights[lights.indices[i]];
+        const vec3_t to_light = vec3_diff(light->position, pos);
+        const float attenuation = light_attenuation(light, vec3_dot(to_light, to_light));
+        vec3_t light_vec = vec3_normalize(to_light);
+        float diffuse = fmaxf(vec3_dot(normal, light_vec), 0.0f) * attenuation;
+        if (light->shadow != NULL) {
+            diffuse *= shadow_visibility(light->shadow, pos);
+        }
+        light_accum.x += diffuse * light->color.x * light->color.w;
+        light_accum.y += diffuse * light->color.y * light->color.w;
+        light_accum.z += diffuse * light->color.z * light->color.w;
+    }
+    light_accum.x = fminf(light_accum.x, 1.0f);
+    light_accum.y = fminf(light_accum.y, 1.0f);
+    light_accum.z = fminf(light_accum.z, 1.0f);
+
+    const uint32_t r = RED(albedo) * light_accum.x;
+    const uint32_t g = GREEN(albedo) * light_accum.y;
+    const uint32_t b = BLUE(albedo) * light_accum.z;
+    return RGB(r,g,b);
+}
 
-    const vec3_t weights = barycentric_weights(p1_xy, p2_xy, p3_xy, p);
+// Into [0, 1] for clamp, or its fractional part for wrap
+RASTER_INLINE float address_coord(const float c, const texture_address address) {
+    const float x = fminf(fmaxf(c, -TEXTURE_COORD_LIMIT), TEXTURE_COORD_LIMIT);
+    if (address == TEXTURE_CLAMP)
+        return fminf(fmaxf(x, 0.0f), 1.0f);
+    return x - floorf(x);
+}
 
-    const float alpha = weights.x;
-    const float beta  = weights.y;
-    const float gamma = weights.z;
+static float lerp(const float a, const float b, const float t) {
+    return a + (b - a) * t;
+}
 
-    const float depth = 1.0f / (alpha*p1.z + beta*p2.z + gamma*p3.z);
+// The texel pair around a coordinate and the weight of the second one, wrapped or clamped at the edges
+RASTER_INLINE void texel_pair(const float c, const int size, const texture_address address, int* c0, int* c1, float* frac) {
+    const float f = c * (float)size - 0.5f;
+    const float f0 = floorf(f);
+    *frac = f - f0;
+    *c0 = (int)f0;
+    *c1 = *c0 + 1;
+    if (*c0 < 0) *c0 = address == TEXTURE_WRAP ? size - 1 : 0;
+    if (*c1 > size - 1) *c1 = address == TEXTURE_WRAP ? 0 : size - 1;
+}
 
-    const int z_index = SCREEN_WIDTH * y + x;
-    if (depth <= (*z_buffer)[z_index]) {
-        const vec3_t va = vec3_mul(vec3_mul(v1, p1.z), alpha);
-        const vec3_t vb = vec3_mul(vec3_mul(v2, p2.z), beta);
-        const vec3_t vc = vec3_mul(vec3_mul(v3, p3.z), gamma);
-        vec3_t interp_pos = vec3_mul(vec3_add(vec3_add(va, vb), vc), depth);
-
-        const vec3_t na = vec3_mul(n1, alpha);
-        const vec3_t nb = vec3_mul(n2, beta);
-        const vec3_t nc = vec3_mul(n3, gamma);
-        vec3_t interp_normal = vec3_normalize(vec3_add(vec3_add(na, nb), nc));
-
-        vec3_t light_accum = { ambient.x, ambient.y, ambient.z };
-        for (int i = 0; i < lights_count; ++i) {
-            const light_t* light = &lights[i];
-            vec3_t light_vec = vec3_normalize(vec3_diff(light->position, interp_pos));
-            float diffuse = fmaxf(vec3_dot(interp_normal, light_vec), 0.0f);
-            light_accum.x += diffuse * light->color.x * light->color.w;
-            light_accum.y += diffuse * light->color.y * light->color.w;
-            light_accum.z += diffuse * light->color.z * light->color.w;
-        }
-        light_accum.x = fminf(light_accum.x, 1.0f);
-        light_accum.y = fminf(light_accum.y, 1.0f);
-        light_accum.z = fminf(light_accum.z, 1.0f);
+// Same operations in the same order as the SIMD sampler, so every kernel filters to the same colors
+RASTER_INLINE void sample_bilinear(const texture_level_t* level, const texture_address address, const float u, const float v, float rgb[3]) {
+    int x0, x1, y0, y1;
+    float ax, ay;
+    texel_pair(u, level->width, address, &x0, &x1, &ax);
+    texel_pair(v, level->height, address, &y0, &y1, &ay);
+
+    const uint32_t c00 = level->texels[texture_texel_index(level, x0, y0)];
+    const uint32_t c10 = level->texels[texture_texel_index(level, x1, y0)];
+    const uint32_t c01 = level->texels[texture_texel_index(level, x0, y1)];
+    const uint32_t c11 = level->texels[texture_texel_index(level, x1, y1)];
+
+    for (int i = 0; i < 3; ++i) {
+        const int shift = 16 - 8 * i;
+        const float top = lerp((float)(c00 >> shift & 0xFF), (float)(c10 >> shift & 0xFF), ax);
+        const float bottom = lerp((float)(c01 >> shift & 0xFF), (float)(c11 >> shift & 0xFF), ax);
+        rgb[i] = lerp(top, bottom, ay);
+    }
+}
 
-        const uint32_t r = RED(color) * light_accum.x;
-        const uint32_t g = GREEN(color) * light_accum.y;
-        const uint32_t b = BLUE(color) * light_accum.z;
+// filter and address are constants of the calling span kernel, see RASTER_SAMPLERS
+RASTER_INLINE uint32_t sample_texel(const raster_batch_t* b, const raster_tri_t* t,
+                                    const float alpha, const float beta, const float gamma, const float depth,
+                                    const texture_filter filter, const texture_address address) {
+    const float interp_u = ((t->uv1.x * t->p1.z) * alpha + (t->uv2.x * t->p2.z) * beta + (t->uv3.x * t->p3.z) * gamma) * depth;
+    const float interp_v = ((t->uv1.y * t->p1.z) * alpha + (t->uv2.y * t->p2.z) * beta + (t->uv3.y * t->p3.z) * gamma) * depth;
+
+    const float u = address_coord(interp_u, address);
+    const float v = address_coord(interp_v, address);
+    const texture_level_t* level = &b->texture->levels[t->mip_level];
+
+    if (filter == TEXTURE_NEAREST) {
+        int tex_x = (int)(u * (float)level->width);
+        int tex_y = (int)(v * (float)level->height);
+        if (tex_x > level->width - 1) tex_x = level->width - 1;
+        if (tex_y > level->height - 1) tex_y = level->height - 1;
+        return level->texels[texture_texel_index(level, tex_x, tex_y)];
+    }
 
-        sdl_gfx_draw_pixel(gfx, (int)x, (int)y, RGB(r,g,b));
-        (*z_buffer)[z_index] = depth;
+    float rgb[3];
+    sample_bilinear(level, address, u, v, rgb);
+    if (filter == TEXTURE_TRILINEAR && t->mip_blend > 0.0f) {
+        float next[3];
+        sample_bilinear(level + 1, address, u, v, next);
+        for (int i = 0; i < 3; ++i) {
+            rgb[i] = lerp(rgb[i], next[i], t->mip_blend);
+        }
     }
+    return (uint32_t)(int)(rgb[0] + 0.5f) << 16 | (uint32_t)(int)(rgb[1] + 0.5f) << 8 | (uint32_t)(int)(rgb[2] + 0.5f);
 }
 
-static void draw_line(const sdl_gfx* gfx, const vec2_t a, const vec2_t b, const uint32_t color) {
-    const float d_x = b.x - a.x;
-    const float d_y = b.y - a.y;
+static bool draw_pixel_phong(
+    const render_target_t* target,
+    const int x, const int y,
+    const float alpha, const float beta, const float gamma,
+    const vec3_t v1, const vec3_t v2, const vec3_t v3,
+    const vec3_t p1, const vec3_t p2, const vec3_t p3,
+    const vec3_t n1, const vec3_t n2, const vec3_t n3,
+    const uint32_t color,
+    const light_list_t lights,
+    z_buffer_t* z_buffer,
+    const vec3_t ambient)
+{
+    const float depth = 1.0f / (alpha*p1.z + beta*p2.z + gamma*p3.z);
 
-    const float longer_delta = fabsf(d_x) >= fabsf(d_y) ? fabsf(d_x) : fabsf(d_y);
+    const int z_index = z_buffer->width * y + x;
+    if (depth <= z_buffer->depth[z_index]) {
+        vec3_t interp_pos, interp_normal;
+        interpolate_surface(alpha, beta, gamma, v1, v2, v3, p1, p2, p3, n1, n2, n3, depth, &interp_pos, &interp_normal);
 
-    const float inc_x = d_x / longer_delta;
-    const float inc_y = d_y / longer_delta;
+        target->color[y * target->stride + x] = shade_phong(interp_pos, interp_normal, color, lights, ambient);
+        z_buffer->depth[z_index] = depth;
+        return true;
+    }
+    return false;
+}
 
-    float x = a.x;
-    float y = a.y;
+// Whether step i of a line lands before the bound, below it when the coordinate grows and at or above it otherwise
+static bool is_step_before(const float start, const float inc, const int bound, const int i) {
+    const int c = (int)(start + (float)i * inc);
+    return inc > 0.0f ? c < bound : c >= bound;
+}
 
-    for (int i = 0; i <= (int)longer_delta; ++i) {
-        sdl_gfx_draw_pixel(gfx, (int)x, (int)y, color);
-        x += inc_x;
-        y += inc_y;
+// The number of leading steps in [0, steps] before the bound. The coordinate is monotonic in the step, so a
+// solved guess only needs nudging past the rounding.
+static int steps_before(const float start, const float inc, const int bound, const int steps) {
+    const float guess = ceilf(((float)bound - start) / inc);
+    int count = guess < 0.0f ? 0 : guess > (float)(steps + 1) ? steps + 1 : (int)guess;
+    while (count > 0 && !is_step_before(start, inc, bound, count - 1)) {
+        count--;
+    }
+    while (count <= steps && is_step_before(start, inc, bound, count)) {
+        count++;
     }
+    return count;
 }
 
-static void draw_filled_triangle(const sdl_gfx* gfx, vec3_t p1, vec3_t p2, vec3_t p3, const uint32_t color, z_buffer_t* z_buffer) {
-    sort_points(&p1, &p2, &p3);
-    vec3_floor_xy(&p1);
-    vec3_floor_xy(&p2);
-    vec3_floor_xy(&p3);
+// Narrows [first, last] to the steps whose coordinate falls in [lo, hi)
+static void clamp_steps(const float start, const float inc, const int lo, const int hi, const int steps, int* first, int* last) {
+    int begin, end;
+    if (inc > 0.0f) {
+        begin = steps_before(start, inc, lo, steps);
+        end = steps_before(start, inc, hi, steps) - 1;
+    }
+    else if (inc < 0.0f) {
+        begin = steps_before(start, inc, hi, steps);
+        end = steps_before(start, inc, lo, steps) - 1;
+    }
+    else {
+        const int c = (int)start;
+        begin = 0;
+        end = c >= lo && c < hi ? steps : -1;
+    }
+    if (begin > *first) *first = begin;
+    if (end < *last) *last = end;
+}
+
+// The steps inside rect are found once per line, so the pixel loop needs no bounds checks
+static void draw_line(const render_target_t* target, const rect_t* rect, const vec2_t a, const vec2_t b, const uint32_t color) {
+    const float d_x = b.x - a.x;
+    const float d_y = b.y - a.y;
+
+    const float longer_delta = fabsf(d_x) >= fabsf(d_y) ? fabsf(d_x) : fabsf(d_y);
+    const int steps = (int)longer_delta;
+
+    const float inc_x = longer_delta > 0.0f ? d_x / longer_delta : 0.0f;
+    const float inc_y = longer_delta > 0.0f ? d_y / longer_delta : 0.0f;
+
+    int first = 0;
+    int last = steps;
+    clamp_steps(a.x, inc_x, rect->x0, rect->x1, steps, &first, &last);
+    clamp_steps(a.y, inc_y, rect->y0, rect->y1, steps, &first, &last);
+
+    PROFILE_SPAN_BEGIN();
+    for (int i = first; i <= last; ++i) {
+        const int x = (int)(a.x + (float)i * inc_x);
+        const int y = (int)(a.y + (float)i * inc_y);
+        target->color[y * target->stride + x] = color;
+        PROFILE_SPAN_WRITE();
+    }
+    PROFILE_SPAN_END();
+}
 
-    // Draw flat-bottom triangle
-    if (p2.y != p1.y) {
-        const float inv_slope1 = (p2.x - p1.x) / (p2.y - p1.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
+RASTER_INLINE bool draw_texel_flat_shaded(const raster_batch_t* b, const raster_tri_t* t, const int x, const int y,
+                                          const float alpha, const float beta, const float gamma,
+                                          const texture_filter filter, const texture_address address) {
+    const float depth = 1.0f / (alpha*t->p1.z + beta*t->p2.z + gamma*t->p3.z);
 
-        float y = p1.y;
-        while (y <= p2.y) {
-            float x_start = p1.x + (y - p1.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
+    const int z_index = b->z_buffer->width * y + x;
+    if (depth <= b->z_buffer->depth[z_index]) {
+        const uint32_t tex = sample_texel(b, t, alpha, beta, gamma, depth, filter, address);
 
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
-            }
+        const uint32_t r = RED(tex) * t->light_accum.x;
+        const uint32_t g = GREEN(tex) * t->light_accum.y;
+        const uint32_t bl = BLUE(tex) * t->light_accum.z;
 
-            float x = x_start;
-            while (x <= x_end) {
-                draw_pixel(gfx, x, y, p1, p2, p3, color, z_buffer);
-                x += 1.0f;
-            }
-            y += 1.0f;
-        }
+        b->target->color[y * b->target->stride + x] = RGB(r,g,bl);
+        b->z_buffer->depth[z_index] = depth;
+        return true;
     }
+    return false;
+}
 
-    // Draw flat-top triangle
-    if (p3.y != p2.y) {
-        const float inv_slope1 = (p3.x - p2.x) / (p3.y - p2.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
+RASTER_INLINE bool draw_texel_phong(const raster_batch_t* b, const raster_tri_t* t, const int x, const int y,
+                                    const float alpha, const float beta, const float gamma,
+                                    const texture_filter filter, const texture_address address) {
+    const float depth = 1.0f / (alpha*t->p1.z + beta*t->p2.z + gamma*t->p3.z);
 
-        float y = p2.y;
-        while (y <= p3.y) {
-            float x_start = p2.x + (y - p2.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
+    const int z_index = b->z_buffer->width * y + x;
+    if (depth <= b->z_buffer->depth[z_index]) {
+        const uint32_t tex = sample_texel(b, t, alpha, beta, gamma, depth, filter, address);
 
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
-            }
+        vec3_t interp_pos, interp_normal;
+        interpolate_surface(alpha, beta, gamma, t->v1, t->v2, t->v3, t->p1, t->p2, t->p3, t->n1, t->n2, t->n3, depth, &interp_pos, &interp_normal);
 
-            float x = x_start;
-            while (x <= x_end) {
-                draw_pixel(gfx, x, y, p1, p2, p3, color, z_buffer);
-                x += 1.0f;
-            }
-            y += 1.0f;
-        }
+        b->target->color[y * b->target->stride + x] = shade_phong(interp_pos, interp_normal, tex, tile_lights(b, x, y), b->ambient);
+        b->z_buffer->depth[z_index] = depth;
+        return true;
     }
+    return false;
 }
 
-static void draw_texel_flat_shaded(
-    const sdl_gfx* gfx,
-    const float x, const float y,
-    const vec3_t p1, const vec3_t p2, const vec3_t p3,
-    const vec2_t uv1, const vec2_t uv2, const  vec2_t uv3,
-    const texture_t* texture,
-    const vec3_t light_accum,
-    z_buffer_t* z_buffer)
-{
-    if (is_point_outside_viewport((int)x, (int)y))
-        return;
+// Geometry pass of deferred shading: the depth test as usual, but the surface goes to the G-buffer unlit
+RASTER_INLINE bool draw_surface(const raster_batch_t* b, const raster_tri_t* t, const int x, const int y,
+                                const float alpha, const float beta, const float gamma, const bool textured,
+                                const texture_filter filter, const texture_address address) {
+    const float depth = 1.0f / (alpha*t->p1.z + beta*t->p2.z + gamma*t->p3.z);
+
+    const int index = b->z_buffer->width * y + x;
+    if (depth <= b->z_buffer->depth[index]) {
+        vec3_t pos, normal;
+        interpolate_surface(alpha, beta, gamma, t->v1, t->v2, t->v3, t->p1, t->p2, t->p3, t->n1, t->n2, t->n3, depth, &pos, &normal);
+
+        g_buffer_t* g = b->g_buffer;
+        g->pos_x[index] = pos.x;
+        g->pos_y[index] = pos.y;
+        g->pos_z[index] = pos.z;
+        g->normal_x[index] = normal.x;
+        g->normal_y[index] = normal.y;
+        g->normal_z[index] = normal.z;
+        g->albedo[index] = textured
+            ? sample_texel(b, t, alpha, beta, gamma, depth, filter, address)
+            : t->color;
+        g->stamps[index] = g->stamp;
+        b->z_buffer->depth[index] = depth;
+        return true;
+    }
+    return false;
+}
 
-    const vec2_t p = (vec2_t){(float)x, (float)y};
-    const vec2_t p1_xy = vec2_from_vec3(p1);
-    const vec2_t p2_xy = vec2_from_vec3(p2);
-    const vec2_t p3_xy = vec2_from_vec3(p3);
+// Scalar span kernels, also used by the SIMD kernels for the pixels left over after the last full vector
+#define SCALAR_SPAN(name, ...)                                                                              \
+    static void name(const raster_batch_t* b, const raster_tri_t* t, const int y, const int x0, const int x1,  \
+                     int e1, int e2, int e3) {                                                              \
+        const edge_setup_t* e = &t->edges;                                                                  \
+        PROFILE_SPAN_BEGIN();                                                                               \
+        for (int x = x0; x <= x1; ++x) {                                                                    \
+            if (e1 >= e->e1_min && e2 >= e->e2_min && e3 >= e->e3_min) {                                    \
+                const float alpha = (float)e1 * e->inv_area;                                                \
+                const float beta  = (float)e2 * e->inv_area;                                                \
+                const float gamma = (float)e3 * e->inv_area;                                                \
+                PROFILE_SPAN_PIXEL(__VA_ARGS__);                                                            \
+            }                                                                                               \
+            e1 += e->e1_dx;                                                                                 \
+            e2 += e->e2_dx;                                                                                 \
+            e3 += e->e3_dx;                                                                                 \
+        }                                                                                                   \
+        PROFILE_SPAN_END();                                                                                 \
+    }
 
-    const vec3_t weights = barycentric_weights(p1_xy, p2_xy, p3_xy, p);
+SCALAR_SPAN(span_depth,
+    draw_depth(x, y, alpha, beta, gamma, t->p1, t->p2, t->p3, b->z_buffer))
 
-    const float alpha = weights.x;
-    const float beta  = weights.y;
-    const float gamma = weights.z;
+SCALAR_SPAN(span_flat,
+    draw_pixel(b->target, x, y, alpha, beta, gamma, t->p1, t->p2, t->p3, t->color, b->z_buffer))
 
-    const float depth = 1.0f / (alpha*p1.z + beta*p2.z + gamma*p3.z);
+SCALAR_SPAN(span_phong,
+    draw_pixel_phong(b->target, x, y, alpha, beta, gamma, t->v1, t->v2, t->v3, t->p1, t->p2, t->p3, t->n1, t->n2, t->n3,
+        t->color, tile_lights(b, x, y), b->z_buffer, b->ambient))
 
-    const int z_index = SCREEN_WIDTH * y + x;
-    if (depth <= (*z_buffer)[z_index]) {
-        const float interp_u = ((uv1.x * p1.z) * alpha + (uv2.x * p2.z) * beta + (uv3.x * p3.z) * gamma) * depth;
-        const float interp_v = ((uv1.y * p1.z) * alpha + (uv2.y * p2.z) * beta + (uv3.y * p3.z) * gamma) * depth;
-        const int tex_x = (int)(interp_u * (float)texture->width) & texture->width - 1;
-        const int tex_y = (int)(interp_v * (float)texture->height) & texture->height - 1;
-        const uint32_t tex = texture->pixels[tex_y * texture->width + tex_x];
+SCALAR_SPAN(span_gbuffer,
+    draw_surface(b, t, x, y, alpha, beta, gamma, false, TEXTURE_NEAREST, TEXTURE_WRAP))
 
-        const uint32_t r = RED(tex) * light_accum.x;
-        const uint32_t g = GREEN(tex) * light_accum.y;
-        const uint32_t b = BLUE(tex) * light_accum.z;
+#define SCALAR_TEXTURED_SPANS(filter, address, suffix)                                                      \
+    SCALAR_SPAN(span_textured_##suffix,                                                                     \
+        draw_texel_flat_shaded(b, t, x, y, alpha, beta, gamma, filter, address))                            \
+    SCALAR_SPAN(span_textured_phong_##suffix,                                                               \
+        draw_texel_phong(b, t, x, y, alpha, beta, gamma, filter, address))                                  \
+    SCALAR_SPAN(span_gbuffer_textured_##suffix,                                                             \
+        draw_surface(b, t, x, y, alpha, beta, gamma, true, filter, address))
 
-        sdl_gfx_draw_pixel(gfx, (int)x, (int)y, RGB(r,g,b));
-        (*z_buffer)[z_index] = depth;
+RASTER_SAMPLERS(SCALAR_TEXTURED_SPANS)
+
+static void resolve_span(const raster_batch_t* b, const int y, const int x0, const int x1) {
+    const g_buffer_t* g = b->g_buffer;
+    const light_list_t lights = tile_lights(b, x0, y);
+    uint32_t* color_row = &b->target->color[y * b->target->stride];
+
+    for (int x = x0; x <= x1; ++x) {
+        const int index = b->z_buffer->width * y + x;
+        if (g->stamps[index] != g->stamp)
+            continue;
+
+        const vec3_t pos = { g->pos_x[index], g->pos_y[index], g->pos_z[index] };
+        const vec3_t normal = { g->normal_x[index], g->normal_y[index], g->normal_z[index] };
+        color_row[x] = shade_phong(pos, normal, g->albedo[index], lights, b->ambient);
     }
 }
 
-static void draw_textured_triangle_flat_shaded(
-    const sdl_gfx* gfx,
-    vec3_t p1, vec3_t p2, vec3_t p3,
-    vec2_t uv1, vec2_t uv2, vec2_t uv3,
-    const texture_t* texture,
-    const vec3_t light_accum,
-    z_buffer_t* z_buffer)
-{
-    sort_points_and_uvs(&p1, &p2, &p3, &uv1, &uv2, &uv3);
-    vec3_floor_xy(&p1);
-    vec3_floor_xy(&p2);
-    vec3_floor_xy(&p3);
-
-    // Draw flat-bottom triangle
-    if (p2.y != p1.y) {
-        const float inv_slope1 = (p2.x - p1.x) / (p2.y - p1.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
-
-        float y = p1.y;
-        while (y <= p2.y) {
-            float x_start = p1.x + (y - p1.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
-
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
-            }
-
-            float x = x_start;
-            while (x <= x_end) {
-                draw_texel_flat_shaded(gfx, x, y, p1, p2, p3, uv1, uv2, uv3, texture, light_accum, z_buffer);
-                x += 1.0f;
-            }
-            y += 1.0f;
+#define SCALAR_TEXTURED_ENTRIES(filter, address, suffix)                                                    \
+    .textured[filter][address] = span_textured_##suffix,                                                    \
+    .textured_phong[filter][address] = span_textured_phong_##suffix,                                        \
+    .gbuffer_textured[filter][address] = span_gbuffer_textured_##suffix,
+
+const span_kernels_t span_kernels_scalar = {
+    .depth = span_depth,
+    .flat = span_flat,
+    .phong = span_phong,
+    .gbuffer = span_gbuffer,
+    .resolve = resolve_span,
+    RASTER_SAMPLERS(SCALAR_TEXTURED_ENTRIES)
+};
+
+static raster_batch_t batch;
+static thread_pool_t* pool;
+static const span_kernels_t* kernels = &span_kernels_scalar;
+static span_fn batch_span; // the kernel of the batch being flushed, see pick_span
+static isa_level active_isa = ISA_SCALAR;
+static g_buffer_t g_buffer;
+static size_t g_buffer_capacity; // pixels
+static bool deferred_shading;
+static texture_filter texture_filtering = TEXTURE_NEAREST;
+
+// A vertex after the post-transform stage, triangles gather these by index instead of projecting their corners
+typedef struct {
+    vec3_t p;         // screen position, z is 1/w (perspective) or -clip z (orthographic)
+    vec4_t clip_pos;  // before the divide, where triangles crossing the depth planes or the guard band are clipped
+    vec3_t to_camera; // what back-face culling compares face normals against, perspective only
+    int clip;         // CLIP_* outcode of clip_pos
+} screen_vertex_t;
+
+#define PROJECT_JOB_SIZE 4096
+
+typedef struct {
+    const vec3_t* vertices;
+    int count;
+    const mat4x4_t* proj_mat;
+} project_job_t;
+
+static screen_vertex_t* screen_vertices;
+static int screen_vertices_capacity;
+static projection_type screen_proj_type;
+
+// Instantiated once per projection below, where proj_type is a constant the projection tests fold away on
+static inline void project_range(const project_job_t* j, const int job, const projection_type proj_type) {
+    const int end = (job + 1) * PROJECT_JOB_SIZE < j->count ? (job + 1) * PROJECT_JOB_SIZE : j->count;
+
+    for (int i = job * PROJECT_JOB_SIZE; i < end; ++i) {
+        screen_vertex_t* sv = &screen_vertices[i];
+        const vec3_t v = j->vertices[i];
+        sv->clip_pos = mat4x4_mul_vec4(j->proj_mat, (vec4_t){v.x, v.y, v.z, 1.0f});
+        sv->p = clip_to_screen(proj_type, sv->clip_pos);
+        sv->clip = clip_flags(proj_type, sv->clip_pos);
+        if (proj_type == PERSPECTIVE) {
+            sv->to_camera = vec3_normalize(v); // the orthographic setup kernels use the view direction instead
         }
     }
+}
 
-    // Draw flat-top triangle
-    if (p3.y != p2.y) {
-        const float inv_slope1 = (p3.x - p2.x) / (p3.y - p2.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
-
-        float y = p2.y;
-        while (y <= p3.y) {
-            float x_start = p2.x + (y - p2.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
+static void project_range_perspective(void* ctx, const int job) {
+    project_range(ctx, job, PERSPECTIVE);
+}
 
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
-            }
+static void project_range_orthographic(void* ctx, const int job) {
+    project_range(ctx, job, ORTHOGRAPHIC);
+}
 
-            float x = x_start;
-            while (x <= x_end) {
-                draw_texel_flat_shaded(gfx, x, y, p1, p2, p3, uv1, uv2, uv3, texture, light_accum, z_buffer);
-                x += 1.0f;
-            }
-            y += 1.0f;
+// Projects every vertex of the mesh once per draw call, large meshes are split across the pool
+static const screen_vertex_t* project_vertices(const vec3_t* vertices, const int count, const mat4x4_t* proj_mat, const projection_type proj_type) {
+    if (count > screen_vertices_capacity) {
+        screen_vertices_capacity = screen_vertices_capacity ? screen_vertices_capacity : 1024;
+        while (screen_vertices_capacity < count) {
+            screen_vertices_capacity *= 2;
         }
+        screen_vertices = realloc(screen_vertices, screen_vertices_capacity * sizeof(screen_vertex_t));
     }
+
+    screen_proj_type = proj_type;
+    project_job_t job = { vertices, count, proj_mat };
+    thread_pool_run(pool, proj_type == PERSPECTIVE ? project_range_perspective : project_range_orthographic, &job, (count + PROJECT_JOB_SIZE - 1) / PROJECT_JOB_SIZE);
+    return screen_vertices;
 }
 
-static void draw_filled_triangle_phong(
-    const sdl_gfx* gfx,
-    vec3_t v1, vec3_t v2, vec3_t v3,
-    vec3_t p1, vec3_t p2, vec3_t p3,
-    const vec3_t n1, const vec3_t n2, const vec3_t n3,
-    const uint32_t color,
-    const light_t* lights,
-    const int lights_count,
-    z_buffer_t* z_buffer,
-    const vec3_t ambient)
-{
-    sort_points_and_vertices(&p1, &p2, &p3, &v1, &v2, &v3);
-    vec3_floor_xy(&p1);
-    vec3_floor_xy(&p2);
-    vec3_floor_xy(&p3);
-
-    // Draw flat-bottom triangle
-    if (p2.y != p1.y) {
-        const float inv_slope1 = (p2.x - p1.x) / (p2.y - p1.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
-
-        float y = p1.y;
-        while (y <= p2.y) {
-            float x_start = p1.x + (y - p1.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
-
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
-            }
+static void begin_batch(const raster_kind kind, const render_target_t* target) {
+    // The grid follows the target, switching between targets of different sizes rebuilds it
+    if (batch.grid.bins == NULL || batch.grid.width != target->width || batch.grid.height != target->height) {
+        free_tile_grid(&batch.grid);
+        batch.grid = make_tile_grid(target->width, target->height);
+    }
+    clear_tile_grid(&batch.grid);
+    set_viewport(target->width, target->height);
+
+    batch.kind = kind;
+    batch.target = target;
+    batch.z_buffer = target->z_buffer;
+    batch.g_buffer = NULL;
+    batch.texture = NULL;
+    batch.filter = texture_filtering;
+    batch.lights = NULL;
+    batch.unbinned_lights = false;
+    batch.ambient = (vec3_t){0.0f, 0.0f, 0.0f};
+    batch.tris_count = 0;
+    batch.bounds = (rect_t){ target->width, target->height, -1, -1 };
+}
 
-            float x = x_start;
-            while (x <= x_end) {
-                draw_pixel_phong(gfx, x, y, v1, v2, v3, p1, p2, p3, n1, n2, n3, color, lights, lights_count, z_buffer, ambient);
-                x += 1.0f;
-            }
-            y += 1.0f;
-        }
+static raster_tri_t* push_tri(void) {
+    if (batch.tris_count == batch.tris_capacity) {
+        batch.tris_capacity = batch.tris_capacity ? batch.tris_capacity * 2 : 1024;
+        batch.tris = realloc(batch.tris, batch.tris_capacity * sizeof(raster_tri_t));
     }
+    return &batch.tris[batch.tris_count++];
+}
 
-    // Draw flat-top triangle
-    if (p3.y != p2.y) {
-        const float inv_slope1 = (p3.x - p2.x) / (p3.y - p2.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
+static void bin_tri(const raster_tri_t* tri) {
+    const float min_x = fminf(tri->p1.x, fminf(tri->p2.x, tri->p3.x));
+    const float max_x = fmaxf(tri->p1.x, fmaxf(tri->p2.x, tri->p3.x));
+    const float min_y = fminf(tri->p1.y, fminf(tri->p2.y, tri->p3.y));
+    const float max_y = fmaxf(tri->p1.y, fmaxf(tri->p2.y, tri->p3.y));
 
-        float y = p2.y;
-        while (y <= p3.y) {
-            float x_start = p2.x + (y - p2.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
+    tile_grid_bin(&batch.grid, (int)(tri - batch.tris), min_x, min_y, max_x, max_y);
+}
 
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
-            }
+// One level for the whole triangle, from the texels its uvs cover per pixel of its screen area
+static void select_mip(raster_tri_t* tri) {
+    const texture_t* texture = batch.texture;
+    const float du2 = tri->uv2.x - tri->uv1.x, dv2 = tri->uv2.y - tri->uv1.y;
+    const float du3 = tri->uv3.x - tri->uv1.x, dv3 = tri->uv3.y - tri->uv1.y;
+    const float texel_area = fabsf(du2 * dv3 - du3 * dv2) * (float)texture->width * (float)texture->height;
+    const float subpixels = (float)(1 << viewport.subpixel_bits);
+    const float pixel_area = 1.0f / (tri->edges.inv_area * subpixels * subpixels);
+    const float lod = 0.5f * log2f(texel_area / pixel_area);
+
+    tri->mip_level = 0;
+    tri->mip_blend = 0.0f;
+    if (!(lod > 0.0f))
+        return;
 
-            float x = x_start;
-            while (x <= x_end) {
-                draw_pixel_phong(gfx, x, y, v1, v2, v3, p1, p2, p3, n1, n2, n3, color, lights, lights_count, z_buffer, ambient);
-                x += 1.0f;
-            }
-            y += 1.0f;
-        }
+    const float top = (float)(texture->level_count - 1);
+    if (batch.filter == TEXTURE_TRILINEAR) {
+        const float clamped = fminf(lod, top);
+        tri->mip_level = (int)clamped;
+        tri->mip_blend = clamped - (float)tri->mip_level;
+    } else {
+        tri->mip_level = (int)fminf(lod + 0.5f, top);
     }
 }
 
-static void draw_texel_phong(
-    const sdl_gfx* gfx,
-    const float x, const float y,
-    vec3_t v1, vec3_t v2, vec3_t v3,
-    vec3_t p1, vec3_t p2, vec3_t p3,
-    vec3_t n1, vec3_t n2, vec3_t n3,
-    const vec2_t uv1, const vec2_t uv2, const vec2_t uv3,
-    const texture_t* texture,
-    const light_t* lights,
-    const int lights_count,
-    z_buffer_t* z_buffer,
-    const vec3_t ambient)
-{
-    if (is_point_outside_viewport((int)x, (int)y))
+// Sets up the edge equations on the snapped screen points and bins the triangle, ones covering no pixel center
+// are dropped again
+static void setup_tri(raster_tri_t* tri) {
+    if (!setup_edges(&tri->edges, tri->p1, tri->p2, tri->p3)) {
+        batch.tris_count--;
         return;
+    }
 
-    const vec2_t p = (vec2_t){x, y};
-    const vec2_t p1_xy = vec2_from_vec3(p1);
-    const vec2_t p2_xy = vec2_from_vec3(p2);
-    const vec2_t p3_xy = vec2_from_vec3(p3);
+    // Pixel depth is the reciprocal of the z interpolated across the triangle, so with all z on one side of
+    // zero the nearest pixel is at the largest z. The margin covers the rounding of the interpolation.
+    const float z_max = fmaxf(tri->p1.z, fmaxf(tri->p2.z, tri->p3.z));
+    const float z_min = fminf(tri->p1.z, fminf(tri->p2.z, tri->p3.z));
+    if (z_min > 0.0f || z_max < 0.0f) {
+        const float nearest = 1.0f / z_max;
+        tri->min_depth = nearest - fabsf(nearest) * 1e-5f;
+    }
+    else {
+        tri->min_depth = -FLT_MAX;
+    }
 
-    const vec3_t weights = barycentric_weights(p1_xy, p2_xy, p3_xy, p);
+    if (batch.texture != NULL) {
+        select_mip(tri);
+    }
 
-    const float alpha = weights.x;
-    const float beta  = weights.y;
-    const float gamma = weights.z;
+    const edge_setup_t* e = &tri->edges;
+    if (e->min_x < batch.bounds.x0) batch.bounds.x0 = e->min_x;
+    if (e->min_y < batch.bounds.y0) batch.bounds.y0 = e->min_y;
+    if (e->max_x > batch.bounds.x1) batch.bounds.x1 = e->max_x;
+    if (e->max_y > batch.bounds.y1) batch.bounds.y1 = e->max_y;
 
-    const float depth = 1.0f / (alpha*p1.z + beta*p2.z + gamma*p3.z);
+    tile_grid_bin(&batch.grid, (int)(tri - batch.tris), (float)e->min_x, (float)e->min_y, (float)e->max_x, (float)e->max_y);
+}
+
+// A corner of a clipped polygon, weights are barycentric in the original triangle
+typedef struct {
+    vec4_t clip_pos;
+    float weights[3];
+} clip_vertex_t;
+
+// Three corners plus one per plane cut: near, far and the four guard band edges
+#define CLIP_MAX_VERTICES 9
+
+typedef enum { PLANE_NEAR, PLANE_FAR, PLANE_GUARD_LEFT, PLANE_GUARD_RIGHT, PLANE_GUARD_TOP, PLANE_GUARD_BOTTOM } clip_plane;
+
+// Signed distance to the plane, inside when >= 0
+static float plane_distance(const clip_plane plane, const vec4_t c) {
+    switch (plane) {
+        case PLANE_NEAR:          return screen_proj_type == PERSPECTIVE ? c.w - 1.0f : c.z + 1.0f;
+        case PLANE_FAR:           return 1.0f - c.z;
+        case PLANE_GUARD_LEFT:    return viewport.guard_x * c.w + c.x;
+        case PLANE_GUARD_RIGHT:   return viewport.guard_x * c.w - c.x;
+        case PLANE_GUARD_TOP:     return viewport.guard_y * c.w - c.y;
+        case PLANE_GUARD_BOTTOM:  return viewport.guard_y * c.w + c.y;
+    }
+    return 0.0f;
+}
 
-    const int z_index = SCREEN_WIDTH * y + x;
-    if (depth <= (*z_buffer)[z_index]) {
-        const float interp_u = ((uv1.x * p1.z) * alpha + (uv2.x * p2.z) * beta + (uv3.x * p3.z) * gamma) * depth;
-        const float interp_v = ((uv1.y * p1.z) * alpha + (uv2.y * p2.z) * beta + (uv3.y * p3.z) * gamma) * depth;
-        const int tex_x = (int)(interp_u * (float)texture->width) & texture->width - 1;
-        const int tex_y = (int)(interp_v * (float)texture->height) & texture->height - 1;
-        const uint32_t tex = texture->pixels[tex_y * texture->width + tex_x];
-
-        const vec3_t va = vec3_mul(vec3_mul(v1, p1.z), alpha);
-        const vec3_t vb = vec3_mul(vec3_mul(v2, p2.z), beta);
-        const vec3_t vc = vec3_mul(vec3_mul(v3, p3.z), gamma);
-        vec3_t interp_pos = vec3_mul(vec3_add(vec3_add(va, vb), vc), depth);
-
-        const vec3_t na = vec3_mul(n1, alpha);
-        const vec3_t nb = vec3_mul(n2, beta);
-        const vec3_t nc = vec3_mul(n3, gamma);
-        vec3_t interp_normal = vec3_normalize(vec3_add(vec3_add(na, nb), nc));
-
-        vec3_t light_accum = { ambient.x, ambient.y, ambient.z };
-        for (int i = 0; i < lights_count; ++i) {
-            const light_t* light = &lights[i];
-            vec3_t light_vec = vec3_normalize(vec3_diff(light->position, interp_pos));
-            float diffuse = fmaxf(vec3_dot(interp_normal, light_vec), 0.0f);
-            light_accum.x += diffuse * light->color.x * light->color.w;
-            light_accum.y += diffuse * light->color.y * light->color.w;
-            light_accum.z += diffuse * light->color.z * light->color.w;
+static clip_vertex_t lerp_clip_vertex(const clip_vertex_t* a, const clip_vertex_t* b, const float t) {
+    clip_vertex_t out;
+    out.clip_pos = (vec4_t){
+        a->clip_pos.x + (b->clip_pos.x - a->clip_pos.x) * t,
+        a->clip_pos.y + (b->clip_pos.y - a->clip_pos.y) * t,
+        a->clip_pos.z + (b->clip_pos.z - a->clip_pos.z) * t,
+        a->clip_pos.w + (b->clip_pos.w - a->clip_pos.w) * t
+    };
+    for (int i = 0; i < 3; ++i) {
+        out.weights[i] = a->weights[i] + (b->weights[i] - a->weights[i]) * t;
+    }
+    return out;
+}
+
+// Sutherland-Hodgman against one plane. Crossings are always computed from the inside corner, so an edge two
+// triangles share is cut at the same point in both and the mesh stays watertight.
+static int clip_polygon(const clip_plane plane, const clip_vertex_t* in, const int count, clip_vertex_t* out) {
+    int out_count = 0;
+    for (int i = 0; i < count; ++i) {
+        const clip_vertex_t* a = &in[i];
+        const clip_vertex_t* b = &in[(i + 1) % count];
+        const float da = plane_distance(plane, a->clip_pos);
+        const float db = plane_distance(plane, b->clip_pos);
+
+        if (da >= 0.0f) {
+            out[out_count++] = *a;
+        }
+        if (da >= 0.0f && db < 0.0f) {
+            out[out_count++] = lerp_clip_vertex(a, b, da / (da - db));
         }
-        light_accum.x = fminf(light_accum.x, 1.0f);
-        light_accum.y = fminf(light_accum.y, 1.0f);
-        light_accum.z = fminf(light_accum.z, 1.0f);
+        else if (da < 0.0f && db >= 0.0f) {
+            out[out_count++] = lerp_clip_vertex(b, a, db / (db - da));
+        }
+    }
+    return out_count;
+}
 
-        const uint32_t r = RED(tex) * light_accum.x;
-        const uint32_t g = GREEN(tex) * light_accum.y;
-        const uint32_t b = BLUE(tex) * light_accum.z;
+static vec3_t blend3(const vec3_t a, const vec3_t b, const vec3_t c, const float* w) {
+    return (vec3_t){
+        a.x * w[0] + b.x * w[1] + c.x * w[2],
+        a.y * w[0] + b.y * w[1] + c.y * w[2],
+        a.z * w[0] + b.z * w[1] + c.z * w[2]
+    };
+}
 
-        sdl_gfx_draw_pixel(gfx, (int)x, (int)y, RGB(r,g,b));
-        (*z_buffer)[z_index] = depth;
+static vec2_t blend2(const vec2_t a, const vec2_t b, const vec2_t c, const float* w) {
+    return (vec2_t){ a.x * w[0] + b.x * w[1] + c.x * w[2], a.y * w[0] + b.y * w[1] + c.y * w[2] };
+}
+
+static void finish_tri(raster_tri_t* tri) {
+    if (batch.kind == RASTER_LINES) {
+        bin_tri(tri);
+    }
+    else {
+        setup_tri(tri);
     }
 }
 
-static void draw_textured_triangle_phong_shaded(
-    const sdl_gfx* gfx,
-    vec3_t v1, vec3_t v2, vec3_t v3,
-    vec3_t p1, vec3_t p2, vec3_t p3,
-    vec2_t uv1, vec2_t uv2, vec2_t uv3,
-    const vec3_t n1, const vec3_t n2, const vec3_t n3,
-    const texture_t* texture,
-    const light_t* lights,
-    const int lights_count,
-    z_buffer_t* z_buffer,
-    const vec3_t ambient)
-{
-    sort_points_vertices_and_uvs(&p1, &p2, &p3, &v1, &v2, &v3, &uv1, &uv2, &uv3);
-    vec3_floor_xy(&p1);
-    vec3_floor_xy(&p2);
-    vec3_floor_xy(&p3);
-
-    // Draw flat-bottom triangle
-    if (p2.y != p1.y) {
-        const float inv_slope1 = (p2.x - p1.x) / (p2.y - p1.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
-
-        float y = p1.y;
-        while (y <= p2.y) {
-            float x_start = p1.x + (y - p1.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
-
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
-            }
+// Sets up the last pushed triangle, first clipping it against the depth planes and the guard band when any
+// corner is beyond them. The pieces are a fan over the clipped polygon with their attributes re-interpolated.
+static void submit_tri(raster_tri_t* tri, const screen_vertex_t* s1, const screen_vertex_t* s2, const screen_vertex_t* s3) {
+    tri->edge_mask = 7;
+    if (!needs_clipping(s1->clip, s2->clip, s3->clip)) {
+        finish_tri(tri);
+        return;
+    }
+    PROFILE_COUNT(COUNTER_TRIANGLES_CLIPPED, 1);
+
+    const int clip = s1->clip | s2->clip | s3->clip;
+    clip_vertex_t buffers[2][CLIP_MAX_VERTICES] = {{
+        { s1->clip_pos, {1.0f, 0.0f, 0.0f} },
+        { s2->clip_pos, {0.0f, 1.0f, 0.0f} },
+        { s3->clip_pos, {0.0f, 0.0f, 1.0f} }
+    }};
+    int count = 3;
+    int current = 0;
+    for (int plane = PLANE_NEAR; plane <= PLANE_GUARD_BOTTOM && count >= 3; ++plane) {
+        const bool crossed = plane == PLANE_NEAR ? (clip & CLIP_NEAR) != 0
+                           : plane == PLANE_FAR  ? (clip & CLIP_FAR) != 0
+                           : (clip & CLIP_GUARD) != 0;
+        if (!crossed)
+            continue;
+        count = clip_polygon((clip_plane)plane, buffers[current], count, buffers[current ^ 1]);
+        current ^= 1;
+    }
 
-            float x = x_start;
-            while (x <= x_end) {
-                draw_texel_phong(gfx, x, y, v1, v2, v3, p1, p2, p3, n1, n2, n3, uv1, uv2, uv3, texture, lights, lights_count, z_buffer, ambient);
-                x += 1.0f;
+    // push_tri may move the batch, so the original is kept aside and its slot reused by the first piece
+    const raster_tri_t original = *tri;
+    batch.tris_count--;
+
+    const bool has_surface = batch.kind == RASTER_PHONG || batch.kind == RASTER_TEXTURED_PHONG
+        || batch.kind == RASTER_GBUFFER || batch.kind == RASTER_GBUFFER_TEXTURED;
+    const bool has_uvs = batch.kind == RASTER_TEXTURED || batch.kind == RASTER_TEXTURED_PHONG
+        || batch.kind == RASTER_GBUFFER_TEXTURED;
+
+    const clip_vertex_t* polygon = buffers[current];
+    for (int i = 1; i + 1 < count; ++i) {
+        const clip_vertex_t* corners[3] = { &polygon[0], &polygon[i], &polygon[i + 1] };
+        raster_tri_t* piece = push_tri();
+        *piece = original;
+        piece->edge_mask = 0;
+
+        vec3_t* p[3] = { &piece->p1, &piece->p2, &piece->p3 };
+        vec3_t* v[3] = { &piece->v1, &piece->v2, &piece->v3 };
+        vec3_t* n[3] = { &piece->n1, &piece->n2, &piece->n3 };
+        vec2_t* uv[3] = { &piece->uv1, &piece->uv2, &piece->uv3 };
+        for (int k = 0; k < 3; ++k) {
+            const clip_vertex_t* c = corners[k];
+            const clip_vertex_t* next = corners[(k + 1) % 3];
+            *p[k] = clip_to_screen(screen_proj_type, c->clip_pos);
+            if (has_surface) {
+                *v[k] = blend3(original.v1, original.v2, original.v3, c->weights);
+                *n[k] = blend3(original.n1, original.n2, original.n3, c->weights);
+            }
+            if (has_uvs) {
+                *uv[k] = blend2(original.uv1, original.uv2, original.uv3, c->weights);
+            }
+            // Wireframes draw only what is left of the original edges, which keep a zero weight along their length
+            for (int w = 0; w < 3; ++w) {
+                if (c->weights[w] == 0.0f && next->weights[w] == 0.0f) {
+                    piece->edge_mask |= 1 << k;
+                }
             }
-            y += 1.0f;
         }
+        finish_tri(piece);
     }
+}
 
-    // Draw flat-top triangle
-    if (p3.y != p2.y) {
-        const float inv_slope1 = (p3.x - p2.x) / (p3.y - p2.y);
-        const float inv_slope2 = (p3.x - p1.x) / (p3.y - p1.y);
-
-        float y = p2.y;
-        while (y <= p3.y) {
-            float x_start = p2.x + (y - p2.y) * inv_slope1;
-            float x_end   = p1.x + (y - p1.y) * inv_slope2;
+// Hierarchical Z blocks must not straddle raster tiles, each tile refreshes only the blocks it owns
+#if TILE_SIZE % HIZ_TILE_SIZE != 0
+#error "TILE_SIZE must be a multiple of HIZ_TILE_SIZE"
+#endif
+
+// The triangle's bounding box clipped to rect, inclusive, false when they don't overlap
+static bool clip_to_rect(const raster_tri_t* t, const rect_t* rect, rect_t* out) {
+    const edge_setup_t* e = &t->edges;
+    out->x0 = e->min_x > rect->x0 ? e->min_x : rect->x0;
+    out->x1 = e->max_x < rect->x1 - 1 ? e->max_x : rect->x1 - 1;
+    out->y0 = e->min_y > rect->y0 ? e->min_y : rect->y0;
+    out->y1 = e->max_y < rect->y1 - 1 ? e->max_y : rect->y1 - 1;
+    return out->x0 <= out->x1 && out->y0 <= out->y1;
+}
 
-            if (x_start > x_end) {
-                const float temp = x_start;
-                x_start = x_end;
-                x_end = temp;
+static void refresh_hiz_block(z_buffer_t* z_buffer, const int block_x, const int block_y) {
+    const int x0 = block_x * HIZ_TILE_SIZE;
+    const int y0 = block_y * HIZ_TILE_SIZE;
+    const int x1 = x0 + HIZ_TILE_SIZE < z_buffer->width ? x0 + HIZ_TILE_SIZE : z_buffer->width;
+    const int y1 = y0 + HIZ_TILE_SIZE < z_buffer->height ? y0 + HIZ_TILE_SIZE : z_buffer->height;
+
+    float farthest = -FLT_MAX;
+    if (x1 - x0 == HIZ_TILE_SIZE) {
+        // Fixed width lanes so the compiler keeps the running maxima in a vector register
+        float lanes[HIZ_TILE_SIZE];
+        for (int i = 0; i < HIZ_TILE_SIZE; ++i) {
+            lanes[i] = -FLT_MAX;
+        }
+        for (int y = y0; y < y1; ++y) {
+            const float* row = &z_buffer->depth[z_buffer->width * y + x0];
+            for (int i = 0; i < HIZ_TILE_SIZE; ++i) {
+                lanes[i] = row[i] > lanes[i] ? row[i] : lanes[i];
             }
-
-            float x = x_start;
-            while (x <= x_end) {
-                draw_texel_phong(gfx, x, y, v1, v2, v3, p1, p2, p3, n1, n2, n3, uv1, uv2, uv3, texture, lights, lights_count, z_buffer, ambient);
-                x += 1.0f;
+        }
+        for (int i = 0; i < HIZ_TILE_SIZE; ++i) {
+            farthest = lanes[i] > farthest ? lanes[i] : farthest;
+        }
+    }
+    else {
+        for (int y = y0; y < y1; ++y) {
+            const float* row = &z_buffer->depth[z_buffer->width * y];
+            for (int x = x0; x < x1; ++x) {
+                farthest = row[x] > farthest ? row[x] : farthest;
             }
-            y += 1.0f;
         }
     }
+    z_buffer->tile_max[block_y * z_buffer->hiz_cols + block_x] = farthest;
 }
 
+static void refresh_hiz(z_buffer_t* z_buffer, const rect_t* area) {
+    for (int row = area->y0 / HIZ_TILE_SIZE; row <= area->y1 / HIZ_TILE_SIZE; ++row) {
+        for (int col = area->x0 / HIZ_TILE_SIZE; col <= area->x1 / HIZ_TILE_SIZE; ++col) {
+            refresh_hiz_block(z_buffer, col, row);
+        }
+    }
+}
 
-void draw_wireframe(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    const int tris_count,
-    const uint32_t color,
-    const mat4x4_t* proj_mat,
-    const projection_type proj_type,
-    const bool cull_back_face)
-{
-    for (int i = 0; i < tris_count; ++i) {
-        const triangle_t tri = tris[i];
-
-        const vec3_t v1 = vertices[tri.v[0]];
-        const vec3_t v2 = vertices[tri.v[1]];
-        const vec3_t v3 = vertices[tri.v[2]];
+typedef enum { HIZ_VISIBLE, HIZ_PARTIAL, HIZ_OCCLUDED } hiz_result;
+
+// Compares the triangle's nearest depth with the blocks under area. Blocks are refreshed once a raster tile
+// is done and may be stale until then, which is still safe since stored depths only ever get nearer.
+static hiz_result test_hiz(const z_buffer_t* z_buffer, const raster_tri_t* t, const rect_t* area) {
+    const int col0 = area->x0 / HIZ_TILE_SIZE;
+    const int col1 = area->x1 / HIZ_TILE_SIZE;
+    const int row0 = area->y0 / HIZ_TILE_SIZE;
+    const int row1 = area->y1 / HIZ_TILE_SIZE;
+
+    int hidden = 0;
+    for (int row = row0; row <= row1; ++row) {
+        const float* block_row = &z_buffer->tile_max[row * z_buffer->hiz_cols];
+        for (int col = col0; col <= col1; ++col) {
+            hidden += t->min_depth > block_row[col];
+        }
+    }
 
-        if (cull_back_face && is_back_face(proj_type, v1, v2, v3))
-            continue;
+    if (hidden == 0)
+        return HIZ_VISIBLE;
+    return hidden == (row1 - row0 + 1) * (col1 - col0 + 1) ? HIZ_OCCLUDED : HIZ_PARTIAL;
+}
 
-        const vec3_t p1 = project_to_screen(proj_type, proj_mat, v1);
-        const vec3_t p2 = project_to_screen(proj_type, proj_mat, v2);
-        const vec3_t p3 = project_to_screen(proj_type, proj_mat, v3);
+// Walks the rows of area, evaluating the edge functions directly at the start of each run and leaving the
+// stepping along it to the span kernel. With skip_hidden, runs over blocks the triangle can't pass are left out.
+static void rasterize_triangle(const raster_batch_t* b, const raster_tri_t* t, const rect_t* area, const span_fn span, const bool skip_hidden) {
+    const edge_setup_t* e = &t->edges;
+
+    for (int y = area->y0; y <= area->y1; ++y) {
+        const float* block_row = skip_hidden ? &b->z_buffer->tile_max[(y / HIZ_TILE_SIZE) * b->z_buffer->hiz_cols] : NULL;
+
+        int x = area->x0;
+        while (x <= area->x1) {
+            int run_end = area->x1;
+            if (block_row != NULL) {
+                // Extend the run block by block while the blocks stay visible
+                run_end = x - 1;
+                while (run_end < area->x1 && !(t->min_depth > block_row[(run_end + 1) / HIZ_TILE_SIZE])) {
+                    run_end = ((run_end + 1) / HIZ_TILE_SIZE + 1) * HIZ_TILE_SIZE - 1;
+                }
+                if (run_end > area->x1) run_end = area->x1;
+            }
 
-        if (is_outside_frustum(p1, p2, p3))
-            continue;
+            if (run_end >= x) {
+                const int e1 = e->e1_c + e->e1_dx * x + e->e1_dy * y;
+                const int e2 = e->e2_c + e->e2_dx * x + e->e2_dy * y;
+                const int e3 = e->e3_c + e->e3_dx * x + e->e3_dy * y;
+                span(b, t, y, x, run_end, e1, e2, e3);
+            }
 
-        draw_line(gfx, (vec2_t){p1.x, p1.y}, (vec2_t){p2.x, p2.y}, color);
-        draw_line(gfx, (vec2_t){p2.x, p2.y}, (vec2_t){p3.x, p3.y}, color);
-        draw_line(gfx, (vec2_t){p3.x, p3.y}, (vec2_t){p1.x, p1.y}, color);
+            x = run_end + 1;
+            while (x <= area->x1 && block_row != NULL && t->min_depth > block_row[x / HIZ_TILE_SIZE]) {
+                x = (x / HIZ_TILE_SIZE + 1) * HIZ_TILE_SIZE;
+            }
+        }
     }
 }
 
-void draw_unlit(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    const int tris_count,
-    const uint32_t color,
-    const mat4x4_t* proj_mat,
-    const projection_type proj_type,
-    z_buffer_t* z_buffer)
-{
-    for (int i = 0; i < tris_count; ++i) {
-        const triangle_t tri = tris[i];
+static void rasterize_tile(void* ctx, const int tile) {
+    const raster_batch_t* b = ctx;
+    const tile_bin_t* bin = &b->grid.bins[tile];
+    if (bin->count == 0)
+        return;
+
+    const rect_t tile_rect = tile_grid_rect(&b->grid, tile);
+    const rect_t* rect = &tile_rect;
 
-        const vec3_t v1 = vertices[tri.v[0]];
-        const vec3_t v2 = vertices[tri.v[1]];
-        const vec3_t v3 = vertices[tri.v[2]];
+    const span_fn span = batch_span;
 
-        if (is_back_face(proj_type, v1, v2, v3))
+    // Each tile owns its slice of the color and depth buffers, hierarchical Z blocks included, and walks its
+    // triangles in submission order, so the result does not depend on how tiles are spread across threads
+    rect_t written = { rect->x1, rect->y1, rect->x0 - 1, rect->y0 - 1 };
+
+    for (int i = 0; i < bin->count; ++i) {
+        const raster_tri_t* t = &b->tris[bin->indices[i]];
+
+        if (b->kind == RASTER_LINES) {
+            if (t->edge_mask & 1) draw_line(b->target, rect, (vec2_t){t->p1.x, t->p1.y}, (vec2_t){t->p2.x, t->p2.y}, t->color);
+            if (t->edge_mask & 2) draw_line(b->target, rect, (vec2_t){t->p2.x, t->p2.y}, (vec2_t){t->p3.x, t->p3.y}, t->color);
+            if (t->edge_mask & 4) draw_line(b->target, rect, (vec2_t){t->p3.x, t->p3.y}, (vec2_t){t->p1.x, t->p1.y}, t->color);
             continue;
+        }
 
-        const vec3_t p1 = project_to_screen(proj_type, proj_mat, v1);
-        const vec3_t p2 = project_to_screen(proj_type, proj_mat, v2);
-        const vec3_t p3 = project_to_screen(proj_type, proj_mat, v3);
+        rect_t area;
+        if (!clip_to_rect(t, rect, &area))
+            continue;
 
-        if (is_outside_frustum(p1, p2, p3))
+        const hiz_result hiz = test_hiz(b->z_buffer, t, &area);
+        if (hiz == HIZ_OCCLUDED) {
+            PROFILE_COUNT(COUNTER_HIZ_REJECTED, 1);
             continue;
+        }
+
+        rasterize_triangle(b, t, &area, span, hiz == HIZ_PARTIAL);
 
-        draw_filled_triangle(gfx, p1, p2, p3, color, z_buffer);
+        if (area.x0 < written.x0) written.x0 = area.x0;
+        if (area.y0 < written.y0) written.y0 = area.y0;
+        if (area.x1 > written.x1) written.x1 = area.x1;
+        if (area.y1 > written.y1) written.y1 = area.y1;
     }
-}
 
-void draw_flat_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    const int tris_count,
-    const uint32_t color,
-    const light_t* lights,
-    const int lights_count,
-    const mat4x4_t* proj_mat,
-    const projection_type proj_type,
-    z_buffer_t* z_buffer,
-    const vec3_t ambient)
-{
-    for (int i = 0; i < tris_count; ++i) {
-        const triangle_t tri = tris[i];
+    if (written.x0 <= written.x1) {
+        refresh_hiz(b->z_buffer, &written);
+    }
+}
 
-        const vec3_t v1 = vertices[tri.v[0]];
-        const vec3_t v2 = vertices[tri.v[1]];
-        const vec3_t v3 = vertices[tri.v[2]];
+// The span kernel for the batch's kind, and for textured kinds the variant compiled for its filter and address mode
+static span_fn pick_span(const raster_batch_t* b) {
+    const texture_filter f = b->filter;
+    const texture_address a = b->texture != NULL ? b->texture->address : TEXTURE_WRAP;
+    switch (b->kind) {
+        case RASTER_DEPTH:            return kernels->depth;
+        case RASTER_FLAT:             return kernels->flat;
+        case RASTER_PHONG:            return kernels->phong;
+        case RASTER_TEXTURED:         return kernels->textured[f][a];
+        case RASTER_TEXTURED_PHONG:   return kernels->textured_phong[f][a];
+        case RASTER_GBUFFER:          return kernels->gbuffer;
+        case RASTER_GBUFFER_TEXTURED: return kernels->gbuffer_textured[f][a];
+        case RASTER_LINES:            break;
+    }
+    return NULL;
+}
 
-        const vec3_t cross = vec3_cross(vec3_diff(v2, v1), vec3_diff(v3, v1));
-        const vec3_t cross_norm = vec3_normalize(cross);
-        const vec3_t to_camera = proj_type == PERSPECTIVE ? vec3_normalize(v1) : (vec3_t){0,0,-1};
+static void flush_batch(void) {
+    if (batch.tris_count == 0)
+        return;
 
-        // Backface culling
-        if (vec3_dot(cross_norm, to_camera) > 0.0f)
-            continue;
+    batch_span = pick_span(&batch);
+    thread_pool_run(pool, rasterize_tile, &batch, batch.grid.cols * batch.grid.rows);
+}
 
-        const vec3_t p1 = project_to_screen(proj_type, proj_mat, v1);
-        const vec3_t p2 = project_to_screen(proj_type, proj_mat, v2);
-        const vec3_t p3 = project_to_screen(proj_type, proj_mat, v3);
+#define RESOLVE_ROWS_PER_JOB 8
+
+// Starts a geometry pass in place of a forward Phong batch, the G-buffer is allocated on first use and grows
+// with the largest target drawn to
+static bool begin_gbuffer_batch(void) {
+    const size_t count = (size_t)batch.target->width * batch.target->height;
+    if (count > g_buffer_capacity) {
+        free(g_buffer.pos_x);
+        free(g_buffer.albedo);
+        g_buffer = (g_buffer_t){0};
+        g_buffer_capacity = 0;
+
+        float* floats = malloc(6 * count * sizeof(float));
+        uint32_t* ints = calloc(2 * count, sizeof(uint32_t));
+        if (floats == NULL || ints == NULL) {
+            fprintf(stderr, "Failed to allocate the G-buffer, falling back to forward shading.\n");
+            free(floats);
+            free(ints);
+            deferred_shading = false;
+            return false;
+        }
 
-        if (is_outside_frustum(p1, p2, p3))
-            continue;
+        g_buffer.pos_x = floats;
+        g_buffer.pos_y = floats + count;
+        g_buffer.pos_z = floats + 2 * count;
+        g_buffer.normal_x = floats + 3 * count;
+        g_buffer.normal_y = floats + 4 * count;
+        g_buffer.normal_z = floats + 5 * count;
+        g_buffer.albedo = ints;
+        g_buffer.stamps = ints + count;
+        g_buffer_capacity = count;
+    }
 
-        vec3_t light_accum = { ambient.x, ambient.y, ambient.z };
-        for (int j = 0; j < lights_count; ++j) {
-            const light_t* light = &lights[j];
-            const float diffuse = fmaxf(0.0f, vec3_dot(cross_norm, light->direction));
-            light_accum.x += diffuse * light->color.x * light->color.w;
-            light_accum.y += diffuse * light->color.y * light->color.w;
-            light_accum.z += diffuse * light->color.z * light->color.w;
-        }
-        light_accum.x = fminf(light_accum.x, 1.0f);
-        light_accum.y = fminf(light_accum.y, 1.0f);
-        light_accum.z = fminf(light_accum.z, 1.0f);
+    // Stamps left over from earlier draw calls must never match, so they are wiped when the counter wraps
+    if (++g_buffer.stamp == 0) {
+        memset(g_buffer.stamps, 0, g_buffer_capacity * sizeof(uint32_t));
+        g_buffer.stamp = 1;
+    }
+    batch.g_buffer = &g_buffer;
+    return true;
+}
 
-        const uint32_t r = RED(color) * light_accum.x;
-        const uint32_t g = GREEN(color) * light_accum.y ;
-        const uint32_t b = BLUE(color) * light_accum.z;
+static void resolve_rows(void* ctx, const int job) {
+    const raster_batch_t* b = ctx;
+    const int y0 = b->bounds.y0 + job * RESOLVE_ROWS_PER_JOB;
+    const int y1 = y0 + RESOLVE_ROWS_PER_JOB - 1 < b->bounds.y1 ? y0 + RESOLVE_ROWS_PER_JOB - 1 : b->bounds.y1;
 
-        draw_filled_triangle(gfx, p1, p2, p3, RGB(r,g,b), z_buffer);
+    // Split at the raster tiles, each piece is lit by its own tile's lights
+    for (int y = y0; y <= y1; ++y) {
+        for (int x = b->bounds.x0; x <= b->bounds.x1; x = (x / TILE_SIZE + 1) * TILE_SIZE) {
+            const int tile_end = (x / TILE_SIZE + 1) * TILE_SIZE - 1;
+            kernels->resolve(b, y, x, tile_end < b->bounds.x1 ? tile_end : b->bounds.x1);
+        }
     }
 }
 
-void draw_phong_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const vec3_t* normals,
-    const triangle_t* tris,
-    const int tris_count,
-    const uint32_t color,
-    const light_t* lights,
-    const int lights_count,
-    const mat4x4_t* proj_mat,
-    const projection_type proj_type,
-    z_buffer_t* z_buffer,
-    const vec3_t ambient)
-{
-    for (int i = 0; i < tris_count; ++i) {
-        const triangle_t tri = tris[i];
+// Lights every pixel the geometry pass left visible exactly once, the rows the batch covers are split across the pool
+static void resolve_gbuffer(void) {
+    if (batch.tris_count == 0)
+        return;
 
-        const vec3_t v1 = vertices[tri.v[0]];
-        const vec3_t v2 = vertices[tri.v[1]];
-        const vec3_t v3 = vertices[tri.v[2]];
+    PROFILE_BEGIN(PROFILE_DEFERRED_RESOLVE);
+    const int rows = batch.bounds.y1 - batch.bounds.y0 + 1;
+    thread_pool_run(pool, resolve_rows, &batch, (rows + RESOLVE_ROWS_PER_JOB - 1) / RESOLVE_ROWS_PER_JOB);
+    PROFILE_END(PROFILE_DEFERRED_RESOLVE);
+}
 
-        const vec3_t n1 = normals[tri.n[0]];
-        const vec3_t n2 = normals[tri.n[1]];
-        const vec3_t n3 = normals[tri.n[2]];
+static const span_kernels_t* kernels_for_isa(const isa_level level) {
+    switch (level) {
+        case ISA_AVX2: return SDL_HasAVX2() ? span_kernels_avx2() : NULL;
+        case ISA_SSE2: return SDL_HasSSE2() ? span_kernels_sse2() : NULL;
+        case ISA_SCALAR: return &span_kernels_scalar;
+    }
+    return NULL;
+}
 
-        if (is_back_face(proj_type, v1, v2, v3))
-            continue;
+isa_level draw_set_isa(isa_level level) {
+    while (level > ISA_SCALAR && kernels_for_isa(level) == NULL) {
+        level--;
+    }
+    kernels = kernels_for_isa(level);
+    active_isa = level;
+    return level;
+}
 
-        const vec3_t p1 = project_to_screen(proj_type, proj_mat, v1);
-        const vec3_t p2 = project_to_screen(proj_type, proj_mat, v2);
-        const vec3_t p3 = project_to_screen(proj_type, proj_mat, v3);
+isa_level draw_get_isa(void) {
+    return active_isa;
+}
 
-        if (is_outside_frustum(p1, p2, p3))
-            continue;
+const char* isa_name(const isa_level level) {
+    switch (level) {
+        case ISA_AVX2: return "avx2";
+        case ISA_SSE2: return "sse2";
+        case ISA_SCALAR: return "scalar";
+    }
+    return "unknown";
+}
 
-        draw_filled_triangle_phong(gfx, v1, v2, v3, p1, p2, p3, n1, n2, n3, color, lights, lights_count, z_buffer, ambient);
+bool isa_from_name(const char* name, isa_level* level) {
+    for (isa_level l = ISA_SCALAR; l <= ISA_AVX2; ++l) {
+        if (strcmp(name, isa_name(l)) == 0) {
+            *level = l;
+            return true;
+        }
     }
+    return false;
 }
 
-void draw_textured_unlit(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    const int tris_count,
-    const vec2_t* uvs,
-    const texture_t* texture,
-    const mat4x4_t* proj_mat,
-    const projection_type proj_type,
-    z_buffer_t* z_buffer)
-{
-    for (int i = 0; i < tris_count; ++i) {
-        const triangle_t tri = tris[i];
+void draw_init(const int thread_count) {
+    pool = thread_pool_init(thread_count);
 
-        const vec3_t v1 = vertices[tri.v[0]];
-        const vec3_t v2 = vertices[tri.v[1]];
-        const vec3_t v3 = vertices[tri.v[2]];
+    // RENDERER_ISA=scalar|sse2|avx2 caps the span kernels, otherwise the best one the CPU supports is used
+    isa_level isa = ISA_AVX2;
+    const char* forced = getenv("RENDERER_ISA");
+    if (forced != NULL) {
+        isa_from_name(forced, &isa);
+    }
+    draw_set_isa(isa);
 
-        const vec2_t uv1 = uvs[tri.uv[0]];
-        const vec2_t uv2 = uvs[tri.uv[1]];
-        const vec2_t uv3 = uvs[tri.uv[2]];
+    // RENDERER_DEFERRED=1 starts with deferred Phong shading
+    const char* deferred = getenv("RENDERER_DEFERRED");
+    draw_set_deferred(deferred != NULL && strcmp(deferred, "1") == 0);
 
-        if (is_back_face(proj_type, v1, v2, v3))
-            continue;
+    // RENDERER_TEXTURE_FILTER=nearest|bilinear|trilinear, nearest by default
+    const char* filter_name = getenv("RENDERER_TEXTURE_FILTER");
+    texture_filter filter;
+    if (filter_name != NULL && texture_filter_from_name(filter_name, &filter)) {
+        draw_set_texture_filter(filter);
+    }
+}
 
-        const vec3_t p1 = project_to_screen(proj_type, proj_mat, v1);
-        const vec3_t p2 = project_to_screen(proj_type, proj_mat, v2);
-        const vec3_t p3 = project_to_screen(proj_type, proj_mat, v3);
+void draw_set_deferred(const bool enabled) {
+    deferred_shading = enabled;
+}
 
-        if (is_outside_frustum(p1, p2, p3))
-            continue;
+bool draw_get_deferred(void) {
+    return deferred_shading;
+}
 
-        const vec3_t light = {1.0f, 1.0f, 1.0f}; // unlit
-        draw_textured_triangle_flat_shaded(gfx, p1, p2, p3, uv1, uv2, uv3, texture, light, z_buffer);
-    }
+void draw_set_texture_filter(const texture_filter filter) {
+    texture_filtering = filter;
 }
 
-void draw_textured_flat_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    const int tris_count,
-    const vec2_t* uvs,
-    const texture_t* texture,
-    const light_t* lights,
-    const int lights_count,
-    const mat4x4_t* proj_mat,
-    const projection_type proj_type,
-    z_buffer_t* z_buffer,
-    const vec3_t ambient)
-{
-    for (int i = 0; i < tris_count; ++i) {
-        const triangle_t tri = tris[i];
+texture_filter draw_get_texture_filter(void) {
+    return texture_filtering;
+}
 
-        const vec3_t v1 = vertices[tri.v[0]];
-        const vec3_t v2 = vertices[tri.v[1]];
-        const vec3_t v3 = vertices[tri.v[2]];
+int draw_thread_count(void) {
+    return thread_pool_thread_count(pool);
+}
 
-        const vec2_t uv1 = uvs[tri.uv[0]];
-        const vec2_t uv2 = uvs[tri.uv[1]];
-        const vec2_t uv3 = uvs[tri.uv[2]];
+void draw_dispose(void) {
+    thread_pool_dispose(pool);
+    pool = NULL;
 
-        const vec3_t cross = vec3_cross(vec3_diff(v2, v1), vec3_diff(v3, v1));
-        const vec3_t cross_norm = vec3_normalize(cross);
-        const vec3_t to_camera = proj_type == PERSPECTIVE ? vec3_normalize(v1) : (vec3_t){0,0,-1};
+    free(screen_vertices);
+    screen_vertices = NULL;
+    screen_vertices_capacity = 0;
 
-        // Backface culling
-        if (vec3_dot(cross_norm, to_camera) > 0.0f)
-            continue;
+    free(g_buffer.pos_x);
+    free(g_buffer.albedo);
+    g_buffer = (g_buffer_t){0};
+    g_buffer_capacity = 0;
 
-        const vec3_t p1 = project_to_screen(proj_type, proj_mat, v1);
-        const vec3_t p2 = project_to_screen(proj_type, proj_mat, v2);
-        const vec3_t p3 = project_to_screen(proj_type, proj_mat, v3);
+    free_tile_grid(&batch.grid);
+    free(batch.tris);
+    batch.tris = NULL;
+    batch.tris_count = batch.tris_capacity = 0;
+}
 
-        if (is_outside_frustum(p1, p2, p3))
-            continue;
+// Unit normal of the view space face, for back-face culling and flat shading
+static vec3_t face_normal(const vec3_t v1, const vec3_t v2, const vec3_t v3) {
+    return vec3_normalize(vec3_cross(vec3_diff(v2, v1), vec3_diff(v3, v1)));
+}
 
-        vec3_t light_accum = { ambient.x, ambient.y, ambient.z };
-        for (int j = 0; j < lights_count; ++j) {
-            const light_t* light = &lights[j];
-            const float diffuse = fmaxf(0.0f, vec3_dot(cross_norm, light->direction));
-            light_accum.x += diffuse * light->color.x * light->color.w;
-            light_accum.y += diffuse * light->color.y * light->color.w;
-            light_accum.z += diffuse * light->color.z * light->color.w;
+// The lights that can reach a view space point: those of the tile it projects into, or all of them when it lands
+// off the grid or the grid doesn't match the target. The rest would only add attenuations of exactly 0.
+static light_list_t point_lights(const vec3_t point, const draw_call_t* call) {
+    const light_grid_t* grid = batch.lights;
+    if (grid == NULL)
+        return (light_list_t){ NULL, NULL, 0 };
+
+    const vec4_t clip = mat4x4_mul_vec4(call->proj_mat, (vec4_t){ point.x, point.y, point.z, 1.0f });
+    if (!batch.unbinned_lights && clip.w > 0.0f) {
+        const float x = (clip.x / clip.w * 0.5f + 0.5f) * (float)grid->tiles.width;
+        const float y = (-clip.y / clip.w * 0.5f + 0.5f) * (float)grid->tiles.height;
+        if (x >= 0.0f && x < (float)grid->tiles.width && y >= 0.0f && y < (float)grid->tiles.height) {
+            const tile_bin_t* bin = &grid->tiles.bins[((int)y / TILE_SIZE) * grid->tiles.cols + (int)x / TILE_SIZE];
+            return (light_list_t){ grid->lights, bin->indices, bin->count };
         }
-        light_accum.x = fminf(light_accum.x, 1.0f);
-        light_accum.y = fminf(light_accum.y, 1.0f);
-        light_accum.z = fminf(light_accum.z, 1.0f);
-
-        draw_textured_triangle_flat_shaded(gfx, p1, p2, p3, uv1, uv2, uv3, texture, light_accum, z_buffer);
-    }
-}
-
-void draw_textured_phong_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const vec3_t* normals,
-    const triangle_t* tris,
-    const int tris_count,
-    const vec2_t* uvs,
-    const texture_t* texture,
-    const light_t* lights,
-    const int lights_count,
-    const mat4x4_t* proj_mat,
-    const projection_type proj_type,
-    z_buffer_t* z_buffer,
-    const vec3_t ambient)
-{
-    for (int i = 0; i < tris_count; ++i) {
-        const triangle_t tri = tris[i];
+    }
+    return (light_list_t){ grid->lights, grid->all.indices, grid->all.count };
+}
 
-        const vec3_t v1 = vertices[tri.v[0]];
-        const vec3_t v2 = vertices[tri.v[1]];
-        const vec3_t v3 = vertices[tri.v[2]];
+// Diffuse light over the whole face, per channel and at most 1, attenuated by the distance to its centroid
+static vec3_t face_light(const vec3_t normal, const vec3_t centroid, const draw_call_t* call) {
+    vec3_t light_accum = { call->ambient.x, call->ambient.y, call->ambient.z };
+    const light_list_t lights = point_lights(centroid, call);
+    for (int j = 0; j < lights.count; ++j) {
+        const light_t* light = &lights.lights[lights.indices[j]];
+        const vec3_t to_light = vec3_diff(light->position, centroid);
+        const float attenuation = light_attenuation(light, vec3_dot(to_light, to_light));
+        float diffuse = fmaxf(0.0f, vec3_dot(normal, light->direction)) * attenuation;
+        if (light->shadow != NULL) {
+            diffuse *= shadow_visibility(light->shadow, centroid);
+        }
+        light_accum.x += diffuse * light->color.x * light->color.w;
+        light_accum.y += diffuse * light->color.y * light->color.w;
+        light_accum.z += diffuse * light->color.z * light->color.w;
+    }
+    light_accum.x = fminf(light_accum.x, 1.0f);
+    light_accum.y = fminf(light_accum.y, 1.0f);
+    light_accum.z = fminf(light_accum.z, 1.0f);
+    return light_accum;
+}
 
-        const vec2_t uv1 = uvs[tri.uv[0]];
-        const vec2_t uv2 = uvs[tri.uv[1]];
-        const vec2_t uv3 = uvs[tri.uv[2]];
+static uint32_t modulate(const uint32_t color, const vec3_t light) {
+    const uint32_t r = RED(color) * light.x;
+    const uint32_t g = GREEN(color) * light.y;
+    const uint32_t b = BLUE(color) * light.z;
+    return RGB(r,g,b);
+}
 
-        const vec3_t n1 = normals[tri.n[0]];
-        const vec3_t n2 = normals[tri.n[1]];
-        const vec3_t n3 = normals[tri.n[2]];
+// Culls, rejects and pushes the triangles of a draw call. Every feature argument is a literal in each expansion
+// below, so the compiler drops the attributes a pipeline doesn't carry and the tests it doesn't make, and the loop
+// is left with no branches but the culling itself.
+#define SETUP_KERNEL(name, PROJ, CULL, COUNTED, SURFACE, UVS, FACE_LIT, TRI_COLORS)                             \
+    static void name(const draw_call_t* call, const screen_vertex_t* screen) {                                  \
+        for (int i = 0; i < call->tris_count; ++i) {                                                            \
+            const triangle_t tri = call->tris[i];                                                               \
+            const screen_vertex_t* s1 = &screen[tri.v[0]];                                                      \
+            const screen_vertex_t* s2 = &screen[tri.v[1]];                                                      \
+            const screen_vertex_t* s3 = &screen[tri.v[2]];                                                      \
+            const vec3_t v1 = call->vertices[tri.v[0]];                                                         \
+            const vec3_t v2 = call->vertices[tri.v[1]];                                                         \
+            const vec3_t v3 = call->vertices[tri.v[2]];                                                         \
+                                                                                                                \
+            const vec3_t normal = CULL || FACE_LIT ? face_normal(v1, v2, v3) : (vec3_t){0.0f, 0.0f, 0.0f};      \
+            const vec3_t to_camera = PROJ == PERSPECTIVE ? s1->to_camera : (vec3_t){0.0f, 0.0f, -1.0f};         \
+            if (CULL && vec3_dot(normal, to_camera) >= 0.0f) {                                                  \
+                if (COUNTED) PROFILE_COUNT(COUNTER_BACKFACE_CULLED, 1);                                         \
+                continue;                                                                                       \
+            }                                                                                                   \
+            if (is_outside_frustum(s1->clip, s2->clip, s3->clip)) {                                             \
+                if (COUNTED) PROFILE_COUNT(COUNTER_FRUSTUM_REJECTED, 1);                                        \
+                continue;                                                                                       \
+            }                                                                                                   \
+                                                                                                                \
+            raster_tri_t* t = push_tri();                                                                       \
+            t->p1 = s1->p;                                                                                      \
+            t->p2 = s2->p;                                                                                      \
+            t->p3 = s3->p;                                                                                      \
+            if (SURFACE) {                                                                                      \
+                t->v1 = v1;                                                                                     \
+                t->v2 = v2;                                                                                     \
+                t->v3 = v3;                                                                                     \
+                t->n1 = call->normals[tri.n[0]];                                                                \
+                t->n2 = call->normals[tri.n[1]];                                                                \
+                t->n3 = call->normals[tri.n[2]];                                                                \
+            }                                                                                                   \
+            if (UVS) {                                                                                          \
+                t->uv1 = call->uvs[tri.uv[0]];                                                                  \
+                t->uv2 = call->uvs[tri.uv[1]];                                                                  \
+                t->uv3 = call->uvs[tri.uv[2]];                                                                  \
+                t->light_accum = FACE_LIT ? face_light(normal, vec3_mul(vec3_add(vec3_add(v1, v2), v3), 1.0f / 3.0f), call) : (vec3_t){1.0f, 1.0f, 1.0f};              \
+            }                                                                                                   \
+            else {                                                                                              \
+                const uint32_t color = TRI_COLORS ? call->tri_colors[i] : call->color;                          \
+                t->color = FACE_LIT ? modulate(color, face_light(normal, vec3_mul(vec3_add(vec3_add(v1, v2), v3), 1.0f / 3.0f), call)) : color;            \
+            }                                                                                                   \
+            submit_tri(t, s1, s2, s3);                                                                          \
+        }                                                                                                       \
+    }
 
-        if (is_back_face(proj_type, v1, v2, v3))
-            continue;
+typedef void (*setup_fn)(const draw_call_t* call, const screen_vertex_t* screen);
+
+typedef struct {
+    raster_kind kind;
+    profile_stage stage;
+    bool counted; // the prepass leaves the pipeline counters to the pass that shades
+    bool surface; // view positions and vertex normals, lit per pixel
+    bool uvs;
+    bool face_lit;
+    setup_fn setup[2]; // by projection_type
+} pipeline_t;
+
+// Every pipeline and the features its setup kernels are compiled with
+//  X(pipeline,                        name,                       kind,                  stage,                              cull, counted, surface, uvs, face_lit, tri_colors)
+#define DRAW_PIPELINES(X)                                                                                       \
+    X(DRAW_WIREFRAME_CULLED,           wireframe_culled,           RASTER_LINES,          PROFILE_DRAW_WIREFRAME,             1, 1, 0, 0, 0, 0)\
+    X(DRAW_WIREFRAME,                  wireframe,                  RASTER_LINES,          PROFILE_DRAW_WIREFRAME,             0, 1, 0, 0, 0, 0)\
+    X(DRAW_DEPTH_ONLY,                 depth_only,                 RASTER_DEPTH,          PROFILE_DEPTH_PREPASS,              1, 0, 0, 0, 0, 0)\
+    X(DRAW_SHADOW_DEPTH,               shadow_depth,               RASTER_DEPTH,          PROFILE_SHADOW_MAPS,                0, 0, 0, 0, 0, 0)\
+    X(DRAW_UNLIT,                      unlit,                      RASTER_FLAT,           PROFILE_DRAW_UNLIT,                 1, 1, 0, 0, 0, 0)\
+    X(DRAW_FLAT_SHADED,                flat_shaded,                RASTER_FLAT,           PROFILE_DRAW_FLAT_SHADED,           1, 1, 0, 0, 1, 0)\
+    X(DRAW_PHONG_SHADED,               phong_shaded,               RASTER_PHONG,          PROFILE_DRAW_PHONG_SHADED,          1, 1, 1, 0, 0, 0)\
+    X(DRAW_TEXTURED_UNLIT,             textured_unlit,             RASTER_TEXTURED,       PROFILE_DRAW_TEXTURED_UNLIT,        1, 1, 0, 1, 0, 0)\
+    X(DRAW_TEXTURED_FLAT_SHADED,       textured_flat_shaded,       RASTER_TEXTURED,       PROFILE_DRAW_TEXTURED_FLAT_SHADED,  1, 1, 0, 1, 1, 0)\
+    X(DRAW_TEXTURED_PHONG_SHADED,      textured_phong_shaded,      RASTER_TEXTURED_PHONG, PROFILE_DRAW_TEXTURED_PHONG_SHADED, 1, 1, 1, 1, 0, 0)\
+    X(DRAW_UNLIT_PER_TRI_COLOR,        unlit_per_tri_color,        RASTER_FLAT,           PROFILE_DRAW_UNLIT,                 1, 1, 0, 0, 0, 1)\
+    X(DRAW_FLAT_SHADED_PER_TRI_COLOR,  flat_shaded_per_tri_color,  RASTER_FLAT,           PROFILE_DRAW_FLAT_SHADED,           1, 1, 0, 0, 1, 1)\
+    X(DRAW_PHONG_SHADED_PER_TRI_COLOR, phong_shaded_per_tri_color, RASTER_PHONG,          PROFILE_DRAW_PHONG_SHADED,          1, 1, 1, 0, 0, 1)
+
+#define SETUP_KERNELS(pipeline, name, kind, stage, cull, counted, surface, uvs, face_lit, tri_colors)           \
+    SETUP_KERNEL(setup_##name##_perspective, PERSPECTIVE, cull, counted, surface, uvs, face_lit, tri_colors)    \
+    SETUP_KERNEL(setup_##name##_orthographic, ORTHOGRAPHIC, cull, counted, surface, uvs, face_lit, tri_colors)
+
+DRAW_PIPELINES(SETUP_KERNELS)
+
+#define PIPELINE_ENTRY(pipeline, name, kind, stage, cull, counted, surface, uvs, face_lit, tri_colors)          \
+    [pipeline] = { kind, stage, counted, surface, uvs, face_lit,                                                \
+                   { [PERSPECTIVE] = setup_##name##_perspective, [ORTHOGRAPHIC] = setup_##name##_orthographic } },
+
+static const pipeline_t pipelines[DRAW_PIPELINE_COUNT] = {
+    DRAW_PIPELINES(PIPELINE_ENTRY)
+};
+
+void draw_mesh(const render_target_t* target, const draw_pipeline pipeline, const draw_call_t* call) {
+    const pipeline_t* p = &pipelines[pipeline];
+    const profile_stage stage = p->stage;
+
+    PROFILE_BEGIN(stage);
+    if (p->counted) {
+        PROFILE_COUNT(COUNTER_TRIANGLES_SUBMITTED, call->tris_count);
+    }
 
-        const vec3_t p1 = project_to_screen(proj_type, proj_mat, v1);
-        const vec3_t p2 = project_to_screen(proj_type, proj_mat, v2);
-        const vec3_t p3 = project_to_screen(proj_type, proj_mat, v3);
+    begin_batch(p->kind, target);
+    if (p->surface && deferred_shading && begin_gbuffer_batch()) {
+        batch.kind = p->uvs ? RASTER_GBUFFER_TEXTURED : RASTER_GBUFFER;
+    }
+    const screen_vertex_t* screen = project_vertices(call->vertices, call->vertices_count, call->proj_mat, call->proj_type);
+    if (p->uvs) {
+        batch.texture = call->texture;
+    }
+    if (p->surface || p->face_lit) {
+        batch.lights = call->lights;
+        batch.ambient = call->ambient;
+        // A grid binned for another size has tiles that don't line up with this target's, it still has every light
+        batch.unbinned_lights = batch.lights != NULL &&
+            (batch.lights->tiles.width != target->width || batch.lights->tiles.height != target->height);
+    }
 
-        if (is_outside_frustum(p1, p2, p3))
-            continue;
+    p->setup[call->proj_type](call, screen);
 
-        draw_textured_triangle_phong_shaded(gfx, v1, v2, v3, p1, p2, p3, uv1, uv2, uv3, n1, n2, n3, texture, lights, lights_count, z_buffer, ambient);
+    flush_batch();
+    if (batch.kind == RASTER_GBUFFER || batch.kind == RASTER_GBUFFER_TEXTURED) {
+        resolve_gbuffer();
     }
+
+    PROFILE_END(stage);
 }
@@ -5,97 +5,79 @@
 #include "vectors.h"
 #include "mesh.h"
 #include "sdl_gfx.h"
-#include "z_buffer.h"
-#include "light.h"
+#include "render_target.h"
+#include "light_grid.h"
 #include "texture.h"
 
 typedef enum { PERSPECTIVE, ORTHOGRAPHIC } projection_type;
+typedef enum { ISA_SCALAR, ISA_SSE2, ISA_AVX2 } isa_level;
 
-void draw_wireframe(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    int tris_count,
-    uint32_t color,
-    const mat4x4_t* proj_mat,
-    projection_type proj_type,
-    bool cull_back_face);
+// Starts the rasterizer worker pool, thread_count includes the calling thread and 0 picks one per logical core
+void draw_init(int thread_count);
+void draw_dispose(void);
+int  draw_thread_count(void);
 
-void draw_unlit(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    int tris_count,
-    uint32_t color,
-    const mat4x4_t* proj_mat,
-    projection_type proj_type,
-    z_buffer_t* z_buffer);
+// Selects the pixel kernels, levels the CPU or the build lacks fall back to the next lower one which is returned
+isa_level   draw_set_isa(isa_level level);
+isa_level   draw_get_isa(void);
+const char* isa_name(isa_level level);
+bool        isa_from_name(const char* name, isa_level* level);
 
-void draw_flat_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    int tris_count,
-    uint32_t color,
-    const light_t* lights,
-    int lights_count,
-    const mat4x4_t* proj_mat,
-    projection_type proj_type,
-    z_buffer_t* z_buffer,
-    vec3_t ambient);
+// Deferred shading for the Phong modes: a geometry pass fills a G-buffer and only the visible pixels are lit
+void draw_set_deferred(bool enabled);
+bool draw_get_deferred(void);
 
-void draw_phong_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const vec3_t* normals,
-    const triangle_t* tris,
-    int tris_count,
-    uint32_t color,
-    const light_t* lights,
-    int lights_count,
-    const mat4x4_t* proj_mat,
-    projection_type proj_type,
-    z_buffer_t* z_buffer,
-    vec3_t ambient);
+// Filtering of the textured modes, mip levels are picked per triangle for bilinear and blended for trilinear
+void           draw_set_texture_filter(texture_filter filter);
+texture_filter draw_get_texture_filter(void);
 
-void draw_textured_unlit(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    int tris_count,
-    const vec2_t* uvs,
-    const texture_t* texture,
-    const mat4x4_t* proj_mat,
-    projection_type proj_type,
-    z_buffer_t* z_buffer);
+// Conservative test of a view space cluster: true only when the per-triangle culling would reject all of its triangles
+bool is_cluster_culled(const cluster_bounds_t* view_bounds, const mat4x4_t* proj_mat, projection_type proj_type, bool cull_back_faces);
 
-void draw_textured_flat_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const triangle_t* tris,
-    int tris_count,
-    const vec2_t* uvs,
-    const texture_t* texture,
-    const light_t* lights,
-    int lights_count,
-    const mat4x4_t* proj_mat,
-    projection_type proj_type,
-    z_buffer_t* z_buffer,
-    vec3_t ambient);
+// Each pipeline has its own triangle setup kernels, one per projection, with everything it doesn't use compiled out
+typedef enum {
+    DRAW_WIREFRAME_CULLED,
+    DRAW_WIREFRAME,
+    // Fills the target's depth only, culling like the shaded pipelines. Drawing the same meshes again afterwards
+    // shades each visible pixel once, since only the fragments whose depth equals the stored one still pass.
+    DRAW_DEPTH_ONLY,
+    // Depth from a light into a shadow map's target, proj_mat taking view space to the light's clip space. Both
+    // faces are drawn, back-face culling would need the camera at the view space origin.
+    DRAW_SHADOW_DEPTH,
+    DRAW_UNLIT,
+    DRAW_FLAT_SHADED,
+    DRAW_PHONG_SHADED,
+    DRAW_TEXTURED_UNLIT,
+    DRAW_TEXTURED_FLAT_SHADED,
+    DRAW_TEXTURED_PHONG_SHADED,
+    // The untextured shaded pipelines with each triangle in its own color, taken from the call's tri_colors
+    DRAW_UNLIT_PER_TRI_COLOR,
+    DRAW_FLAT_SHADED_PER_TRI_COLOR,
+    DRAW_PHONG_SHADED_PER_TRI_COLOR,
+    DRAW_PIPELINE_COUNT
+} draw_pipeline;
 
-void draw_textured_phong_shaded(
-    const sdl_gfx* gfx,
-    const vec3_t* vertices,
-    const vec3_t* normals,
-    const triangle_t* tris,
-    int tris_count,
-    const vec2_t* uvs,
-    const texture_t* texture,
-    const light_t* lights,
-    int lights_count,
-    const mat4x4_t* proj_mat,
-    projection_type proj_type,
-    z_buffer_t* z_buffer,
-    vec3_t ambient);
+// The inputs of a draw call, pipelines ignore the ones they don't use. normals are the Phong pipelines' vertex
+// normals, uvs and texture the textured ones', lights and ambient the shaded ones'. The lights must have been
+// binned with proj_mat, each pixel and face then visits only its tile's, or all of them on a target of another
+// size than the grid's. tri_colors gives each triangle its own color in place of color, for the _PER_TRI_COLOR
+// pipelines only.
+typedef struct {
+    const vec3_t* vertices;
+    int vertices_count;
+    const vec3_t* normals;
+    const vec2_t* uvs;
+    const triangle_t* tris;
+    int tris_count;
+    uint32_t color;
+    const uint32_t* tri_colors;
+    const texture_t* texture;
+    const light_grid_t* lights;
+    vec3_t ambient;
+    const mat4x4_t* proj_mat;
+    projection_type proj_type;
+} draw_call_t;
+
+void draw_mesh(const render_target_t* target, draw_pipeline pipeline, const draw_call_t* call);
 
 #endif //SOFTWARE_RENDERER_C_DRAW_H
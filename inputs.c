@@ -6,6 +6,10 @@ void handle_inputs(
     int* render_mode, const int rend_modes_count,
     int* selected_model, const int model_count,
     projection_type *proj_type,
+    bool* show_stats,
+    bool* depth_prepass,
+    bool* sort_clusters,
+    bool* lod,
     bool* is_running,
     const float delta_time)
 {
@@ -65,6 +69,31 @@ void handle_inputs(
                 case SDL_SCANCODE_KP_1:
                     *proj_type = ORTHOGRAPHIC;
                     break;
+
+                    // Profiler HUD
+                case SDL_SCANCODE_F3:
+                    *show_stats = !*show_stats;
+                    break;
+
+                    // Depth prepass
+                case SDL_SCANCODE_F4:
+                    *depth_prepass = !*depth_prepass;
+                    break;
+
+                    // Front to back cluster order
+                case SDL_SCANCODE_F5:
+                    *sort_clusters = !*sort_clusters;
+                    break;
+
+                    // Texture filtering
+                case SDL_SCANCODE_F6:
+                    draw_set_texture_filter((draw_get_texture_filter() + 1) % (TEXTURE_TRILINEAR + 1));
+                    break;
+
+                    // Levels of detail
+                case SDL_SCANCODE_F7:
+                    *lod = !*lod;
+                    break;
                 default:
                     break;
             }
@@ -9,6 +9,10 @@ void handle_inputs(
     int* render_mode, int rend_modes_count,
     int* selected_model, int model_count,
     projection_type *proj_type,
+    bool* show_stats,
+    bool* depth_prepass,
+    bool* sort_clusters,
+    bool* lod,
     bool* is_running,
     float delta_time);
 
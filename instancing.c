@@ -0,0 +1,158 @@
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "instancing.h"
+
+#include "profiler.h"
+
+instance_batch_t* make_instance_batch(const model_t* model) {
+    const mesh_t* mesh = &model->lods[0];
+    const int per_instance = mesh->vertex_count > mesh->normals_count ? mesh->vertex_count : mesh->normals_count;
+    const int capacity = per_instance > 0 && per_instance < INSTANCE_BATCH_VERTICES ? INSTANCE_BATCH_VERTICES / per_instance : 1;
+
+    instance_batch_t* batch = calloc(1, sizeof(instance_batch_t));
+    if (batch == NULL) {
+        fprintf(stderr, "Failed to allocate an instance batch.\n");
+        return NULL;
+    }
+
+    batch->model = model;
+    batch->capacity = capacity;
+    batch->vertices = malloc((size_t)capacity * mesh->vertex_count * sizeof(vec3_t));
+    batch->normals = malloc((size_t)capacity * mesh->normals_count * sizeof(vec3_t));
+    batch->tris = malloc((size_t)capacity * mesh->triangle_count * sizeof(triangle_t));
+    batch->tri_colors = malloc((size_t)capacity * mesh->triangle_count * sizeof(uint32_t));
+    if (batch->vertices == NULL || batch->normals == NULL || batch->tris == NULL || batch->tri_colors == NULL) {
+        fprintf(stderr, "Failed to allocate an instance batch of %d instances.\n", capacity);
+        free_instance_batch(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+void free_instance_batch(instance_batch_t* batch) {
+    if (batch == NULL)
+        return;
+
+    free(batch->vertices);
+    free(batch->normals);
+    free(batch->tris);
+    free(batch->tri_colors);
+    free(batch);
+}
+
+// Bounds the instance without building its rotation, so culled instances cost no trig
+static cluster_bounds_t instance_bounds(const mesh_t* mesh, const instance_t* instance, const mat4x4_t* view_mat) {
+    const float radius = fabsf(instance->scale) * (sqrtf(vec3_dot(mesh->bounds_center, mesh->bounds_center)) + mesh->bounds_radius);
+    return (cluster_bounds_t){ mat4_mul_vec3(view_mat, instance->translation), radius, {0.0f, 0.0f, 0.0f}, 0.0f };
+}
+
+// Whether the batch has room left for another instance of mesh, its arrays being sized for capacity at full detail
+static bool has_room(const instance_batch_t* batch, const mesh_t* mesh) {
+    const mesh_t* full = &batch->model->lods[0];
+    return batch->vertices_count + mesh->vertex_count <= batch->capacity * full->vertex_count &&
+           batch->normals_count + mesh->normals_count <= batch->capacity * full->normals_count &&
+           batch->tris_count + mesh->triangle_count <= batch->capacity * full->triangle_count;
+}
+
+static void push_instance(instance_batch_t* batch, const instance_t* instance, const mat4x4_t* view_mat) {
+    const mesh_t* mesh = &batch->model->lods[batch->lod];
+
+    const mat4x4_t trans_mat = make_translation_matrix(instance->translation.x, instance->translation.y, instance->translation.z);
+    const mat4x4_t rot_mat   = make_rotation_matrix(instance->rotation.x, instance->rotation.y, instance->rotation.z);
+    const mat4x4_t scale_mat = make_scale_matrix(instance->scale, instance->scale, instance->scale);
+
+    const mat4x4_t rs_mat     = mat4_mul(&rot_mat, &scale_mat);
+    const mat4x4_t model_mat  = mat4_mul(&trans_mat, &rs_mat);
+    const mat4x4_t mv_mat     = mat4_mul(view_mat, &model_mat);
+    const mat4x4_t normal_mat = mat4_normal_matrix(&mv_mat);
+
+    const int first_vertex = batch->vertices_count;
+    const int first_normal = batch->normals_count;
+    transform_vertices(batch->vertices + first_vertex, mesh->vertices, &mesh->vertices_soa, mesh->vertex_count, &mv_mat);
+    transform_vertices(batch->normals + first_normal, mesh->normals, &mesh->normals_soa, mesh->normals_count, &normal_mat);
+
+    // The uvs are shared, only the vertex and normal indices move to the instance's copies
+    triangle_t* tris = batch->tris + batch->tris_count;
+    uint32_t* colors = batch->tri_colors + batch->tris_count;
+    for (int i = 0; i < mesh->triangle_count; ++i) {
+        triangle_t tri = mesh->triangles[i];
+        for (int k = 0; k < 3; ++k) {
+            tri.v[k] += first_vertex;
+            tri.n[k] += first_normal;
+        }
+        tris[i] = tri;
+        colors[i] = instance->color;
+    }
+
+    batch->instances_count++;
+    batch->vertices_count += mesh->vertex_count;
+    batch->normals_count += mesh->normals_count;
+    batch->tris_count += mesh->triangle_count;
+}
+
+int fill_instance_batch(
+    instance_batch_t* batch,
+    const instance_t* instances,
+    int first,
+    const int count,
+    const mat4x4_t* view_mat,
+    const mat4x4_t* proj_mat,
+    const projection_type proj_type,
+    const int lod_height)
+{
+    const model_t* model = batch->model;
+    batch->instances_count = 0;
+    batch->vertices_count = 0;
+    batch->normals_count = 0;
+    batch->tris_count = 0;
+    batch->lod = 0;
+
+    int culled = 0;
+    for (; first < count; ++first) {
+        const cluster_bounds_t bounds = instance_bounds(&model->lods[0], &instances[first], view_mat);
+        if (is_cluster_culled(&bounds, proj_mat, proj_type, false)) {
+            culled++;
+            continue;
+        }
+
+        // The batch shares one level's uvs, so an instance at another level starts the next batch
+        const int lod = lod_height > 0 ? model_lod_for_sphere(model, 0, bounds.center, bounds.radius, proj_mat, proj_type, lod_height) : 0;
+        if (batch->instances_count > 0 && lod != batch->lod)
+            break;
+        if (!has_room(batch, &model->lods[lod]))
+            break;
+        batch->lod = lod;
+        push_instance(batch, &instances[first], view_mat);
+    }
+    PROFILE_COUNT(COUNTER_INSTANCES_CULLED, culled);
+    return first;
+}
+
+static uint32_t hue_color(const float h) {
+    const vec3_t rgb = hue_rgb(h);
+    return RGB((uint32_t)(rgb.x * 255.0f), (uint32_t)(rgb.y * 255.0f), (uint32_t)(rgb.z * 255.0f));
+}
+
+void arrange_instance_grid(instance_t* instances, const int count, const vec3_t center, const float spacing, const float scale) {
+    int columns = 1;
+    while (columns * columns < count) {
+        columns++;
+    }
+    const int rows = (count + columns - 1) / columns;
+
+    for (int i = 0; i < count; ++i) {
+        const int column = i % columns;
+        const int row = i / columns;
+        instances[i] = (instance_t){
+            .translation = {
+                center.x + ((float)column - 0.5f * (float)(columns - 1)) * spacing,
+                center.y,
+                center.z + ((float)row - 0.5f * (float)(rows - 1)) * spacing
+            },
+            .rotation = { 0.0f, 360.0f * fraction(0.7548777f * (float)i), 0.0f },
+            .scale = scale,
+            .color = hue_color(fraction(0.618034f * (float)i))
+        };
+    }
+}
@@ -0,0 +1,56 @@
+﻿#ifndef SOFTWARE_RENDERER_C_INSTANCING_H
+#define SOFTWARE_RENDERER_C_INSTANCING_H
+
+#include "draw.h"
+#include "model.h"
+
+// Vertices of a whole instance batch, small enough for the batch's view space copies to stay in cache
+#define INSTANCE_BATCH_VERTICES 4096
+
+// One copy of a shared mesh, placed the way a model_t is
+typedef struct {
+    vec3_t translation;
+    vec3_t rotation;
+    float scale;
+    uint32_t color;
+} instance_t;
+
+// View space vertices of as many instances of one of a model's levels of detail as fit in INSTANCE_BATCH_VERTICES
+// at full detail, with their triangles pointing at them and one color per triangle. Instances are transformed into
+// it a batch at a time, so the mesh is stored once however many instances are drawn.
+typedef struct {
+    const model_t* model;
+    vec3_t* vertices;
+    vec3_t* normals;
+    triangle_t* tris;
+    uint32_t* tri_colors;
+    int capacity; // instances at full detail
+    int lod;      // the level every instance in the batch is drawn at
+    int instances_count;
+    int vertices_count;
+    int normals_count;
+    int tris_count;
+} instance_batch_t;
+
+instance_batch_t* make_instance_batch(const model_t* model);
+void free_instance_batch(instance_batch_t* batch);
+
+// Empties the batch and fills it with the instances from first on that survive culling against the frustum, until
+// it is full, count is reached or an instance needs another level of detail. With lod_height above 0 each instance
+// gets the level its size on a target that many pixels tall calls for, otherwise full detail. Returns the index of
+// the first instance left for the next batch.
+int fill_instance_batch(
+    instance_batch_t* batch,
+    const instance_t* instances,
+    int first,
+    int count,
+    const mat4x4_t* view_mat,
+    const mat4x4_t* proj_mat,
+    projection_type proj_type,
+    int lod_height);
+
+// count instances on a square grid spacing apart in the xz plane around center, deterministic so every run sees
+// the same field. Each one gets its own turn and the next hue around the color wheel.
+void arrange_instance_grid(instance_t* instances, int count, vec3_t center, float spacing, float scale);
+
+#endif //SOFTWARE_RENDERER_C_INSTANCING_H
@@ -1,9 +1,31 @@
-﻿#include "light.h"
+﻿#include <stddef.h>
+#include "light.h"
 
-light_t make_light(const vec3_t position, const vec3_t direction, const vec4_t color, const mat4x4_t view_matrix) {
+light_t make_light(const vec3_t position, const vec3_t direction, const vec4_t color, const float range, const mat4x4_t view_matrix) {
     light_t light;
     light.position = mat4_mul_vec3(&view_matrix, position);
     light.direction = vec3_normalize(direction);
     light.color = color;
+    light.range = range > 0.0f ? range : 0.0f;
+    light.inv_range_sq = range > 0.0f ? 1.0f / (range * range) : 0.0f;
+    light.shadow = NULL;
     return light;
-}
\ No newline at end of file
+}
+
+static vec4_t hue_color(const float h, const float intensity) {
+    const vec3_t rgb = hue_rgb(h);
+    return (vec4_t){ rgb.x, rgb.y, rgb.z, intensity };
+}
+
+void scatter_lights(light_t* lights, const int count, const float range, const float intensity, const mat4x4_t view_matrix) {
+    // Additive recurrence of the plastic number's powers, spreads any prefix of the sequence evenly over the box
+    for (int i = 0; i < count; ++i) {
+        const vec3_t position = {
+            -3.0f + 6.0f * fraction(0.5f + 0.8191725f * (float)i),
+            -2.0f + 4.0f * fraction(0.5f + 0.6710436f * (float)i),
+            -1.0f + 1.5f * fraction(0.5f + 0.5497005f * (float)i)
+        };
+        const vec3_t direction = { -position.x, -position.y, -position.z };
+        lights[i] = make_light(position, direction, hue_color(fraction(0.618034f * (float)i), intensity), range, view_matrix);
+    }
+}
@@ -3,13 +3,30 @@
 
 #include "vectors.h"
 #include "matrix.h"
+#include "shadow_map.h"
+
+#include <math.h>
 
 typedef struct {
     vec3_t position;
     vec3_t direction;
     vec4_t color;
+    float range;        // nothing farther is lit, 0 reaches everywhere
+    float inv_range_sq; // 1 / range^2, 0 without a range
+    const shadow_map_t* shadow; // NULL casts no shadows
 } light_t;
 
-light_t make_light(vec3_t position, vec3_t direction, vec4_t color, mat4x4_t view_matrix);
+// A range of 0 makes the light reach every surface unattenuated
+light_t make_light(vec3_t position, vec3_t direction, vec4_t color, float range, mat4x4_t view_matrix);
+
+// count point lights of the given range and intensity spread over a box around the origin, deterministic so
+// every run sees the same scene. Each one faces the origin and takes the next hue around the color wheel.
+void scatter_lights(light_t* lights, int count, float range, float intensity, mat4x4_t view_matrix);
+
+// Smooth falloff from 1 at the light to 0 at its range, squared distances at or past it give exactly 0
+static inline float light_attenuation(const light_t* light, const float distance_sq) {
+    const float falloff = fmaxf(1.0f - distance_sq * light->inv_range_sq, 0.0f);
+    return falloff * falloff;
+}
 
 #endif //SOFTWARE_RENDERER_C_LIGHT_H
\ No newline at end of file
@@ -0,0 +1,92 @@
+﻿#include <float.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "light_grid.h"
+#include "profiler.h"
+
+// Screen box of the cube around the light's range. The box holds the projection of the whole sphere as long as
+// every corner is in front of the camera, a cube crossing the eye plane gets the whole screen and one entirely
+// behind it none, since it can't reach anything visible.
+static bool light_screen_bounds(const light_t* light, const mat4x4_t* proj_mat, const int width, const int height,
+                                float* min_x, float* min_y, float* max_x, float* max_y) {
+    *min_x = *min_y = FLT_MAX;
+    *max_x = *max_y = -FLT_MAX;
+
+    int behind = 0;
+    for (int corner = 0; corner < 8; ++corner) {
+        const vec4_t p = {
+            light->position.x + (corner & 1 ? light->range : -light->range),
+            light->position.y + (corner & 2 ? light->range : -light->range),
+            light->position.z + (corner & 4 ? light->range : -light->range),
+            1.0f
+        };
+        const vec4_t clip = mat4x4_mul_vec4(proj_mat, p);
+        if (!(clip.w > 0.0f)) {
+            ++behind;
+            continue;
+        }
+
+        const float x = (clip.x / clip.w * 0.5f + 0.5f) * (float)width;
+        const float y = (-clip.y / clip.w * 0.5f + 0.5f) * (float)height;
+        *min_x = fminf(*min_x, x);
+        *min_y = fminf(*min_y, y);
+        *max_x = fmaxf(*max_x, x);
+        *max_y = fmaxf(*max_y, y);
+    }
+
+    if (behind == 8)
+        return false;
+
+    if (behind > 0) {
+        *min_x = *min_y = 0.0f;
+        *max_x = (float)width;
+        *max_y = (float)height;
+    }
+    return true;
+}
+
+void bin_lights(light_grid_t* grid, const light_t* lights, const int lights_count, const render_target_t* target, const mat4x4_t* proj_mat) {
+    if (grid->tiles.bins == NULL || grid->tiles.width != target->width || grid->tiles.height != target->height) {
+        free_tile_grid(&grid->tiles);
+        grid->tiles = make_tile_grid(target->width, target->height);
+    }
+    clear_tile_grid(&grid->tiles);
+    grid->lights = lights;
+    grid->lights_count = lights_count;
+
+    if (grid->all.capacity < lights_count) {
+        int* indices = realloc(grid->all.indices, lights_count * sizeof(int));
+        if (indices != NULL) {
+            grid->all.indices = indices;
+            grid->all.capacity = lights_count;
+        } else {
+            fprintf(stderr, "Failed to allocate the list of %d lights.\n", lights_count);
+        }
+    }
+    grid->all.count = grid->all.capacity >= lights_count ? lights_count : 0;
+    for (int i = 0; i < grid->all.count; ++i) {
+        grid->all.indices[i] = i;
+    }
+
+    for (int i = 0; i < lights_count; ++i) {
+        float min_x = 0.0f, min_y = 0.0f;
+        float max_x = (float)target->width, max_y = (float)target->height;
+        if (lights[i].range > 0.0f && !light_screen_bounds(&lights[i], proj_mat, target->width, target->height, &min_x, &min_y, &max_x, &max_y))
+            continue;
+
+        tile_grid_bin(&grid->tiles, i, min_x, min_y, max_x, max_y);
+    }
+
+    for (int i = 0; i < grid->tiles.cols * grid->tiles.rows; ++i) {
+        PROFILE_COUNT(COUNTER_LIGHT_TILE_ENTRIES, grid->tiles.bins[i].count);
+    }
+}
+
+void free_light_grid(light_grid_t* grid) {
+    free_tile_grid(&grid->tiles);
+    free(grid->all.indices);
+    grid->all = (tile_bin_t){0};
+    grid->lights = NULL;
+    grid->lights_count = 0;
+}
@@ -0,0 +1,23 @@
+﻿#ifndef SOFTWARE_RENDERER_C_LIGHT_GRID_H
+#define SOFTWARE_RENDERER_C_LIGHT_GRID_H
+
+#include "light.h"
+#include "matrix.h"
+#include "render_target.h"
+#include "tiles.h"
+
+// The lights of a frame binned into the rasterizer's screen tiles, so per pixel lighting only visits the lights
+// whose range reaches the tile. Lights without a range land in every tile.
+typedef struct {
+    const light_t* lights;
+    int lights_count;
+    tile_grid_t tiles; // indices into lights, in their original order
+    tile_bin_t all;    // every light, for what falls outside the tiles or a target of another size
+} light_grid_t;
+
+// Bins lights for drawing into target with proj_mat, lights must stay alive while the grid is drawn with. A zeroed
+// grid is (re)sized on first use and whenever the target's size changes.
+void bin_lights(light_grid_t* grid, const light_t* lights, int lights_count, const render_target_t* target, const mat4x4_t* proj_mat);
+void free_light_grid(light_grid_t* grid);
+
+#endif //SOFTWARE_RENDERER_C_LIGHT_GRID_H
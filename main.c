@@ -1,4 +1,6 @@
 ﻿#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL3/SDL.h>
 
 #include "camera.h"
@@ -6,162 +8,347 @@
 #include "draw.h"
 #include "inputs.h"
 #include "sdl_gfx.h"
-#include "z_buffer.h"
+#include "render_target.h"
 #include "model.h"
+#include "profiler.h"
+#include "render_modes.h"
+#include "resolution.h"
 
-int main(void) {
-    const sdl_gfx* gfx = sdl_gfx_init("Software Renderer", SCREEN_WIDTH, SCREEN_HEIGHT);
+// Options:
+//   --headless             renders without a window
+//   --frames count         stops after that many frames, 1 by default when headless
+//   --dump path            writes each frame to a .ppm/.png, path may hold one %d for the frame index
+//   --profile-csv path     streams the per-frame profile, in builds with RENDERER_PROFILE
+//   --profile-trace path   streams it as a JSON trace as well
+//   --deferred             lights the Phong modes from a G-buffer instead of per fragment
+//   --depth-prepass        starts with the depth prepass on (F4 toggles it)
+//   --sort-clusters        draws each mesh's triangle clusters front to back (F5)
+//   --lod                  draws each model at the level of detail its size on screen calls for (F7)
+//   --filter name          picks the texture filtering, nearest, bilinear or trilinear (F6 cycles it)
+//   --address name         makes texture coordinates wrap or clamp
+//   --frame-budget ms      renders below the window resolution whenever that keeps frames within the budget
+//   --lights count         replaces the two scene lights with that many point lights of limited range
+//   --shadows              gives the two scene lights shadow maps
+//   --shadow-pcf radius    filters the shadow maps over (2 * radius + 1)^2 texels (1 by default)
+//   --instances count      adds a field of that many cubes drawn from the one cube mesh
+
+// Points target at the top-left width x height pixels of the window's buffer, the window scales them up
+static render_target_t* resize_target(sdl_gfx* gfx, render_target_t* target, const int width, const int height) {
+    render_target_t* resized = make_render_target_for_buffer(gfx->buffer, width, height, gfx->width);
+    if (resized == NULL)
+        return target;
+
+    free_render_target(target);
+    sdl_gfx_set_source_size(gfx, width, height);
+    return resized;
+}
+
+int main(const int argc, char* argv[]) {
+    bool headless = false;
+    bool deferred = false;
+    bool depth_prepass = false;
+    bool sort_clusters = false;
+    bool lod = false;
+    texture_filter filter = TEXTURE_NEAREST;
+    texture_address address = TEXTURE_WRAP;
+    float frame_budget_ms = 0.0f;
+    int point_lights = 0;
+    bool shadows = false;
+    int shadow_pcf = 1;
+    int instance_count = 0;
+    int frame_limit = 0;
+    const char* dump_path = NULL;
+    const char* profile_csv = NULL;
+    const char* profile_trace = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--deferred") == 0) {
+            deferred = true;
+        } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            depth_prepass = true;
+        } else if (strcmp(argv[i], "--sort-clusters") == 0) {
+            sort_clusters = true;
+        } else if (strcmp(argv[i], "--lod") == 0) {
+            lod = true;
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc && texture_filter_from_name(argv[i + 1], &filter)) {
+            ++i;
+        } else if (strcmp(argv[i], "--address") == 0 && i + 1 < argc && texture_address_from_name(argv[i + 1], &address)) {
+            ++i;
+        } else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+            frame_budget_ms = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+            point_lights = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shadows") == 0) {
+            shadows = true;
+        } else if (strcmp(argv[i], "--shadow-pcf") == 0 && i + 1 < argc) {
+            shadow_pcf = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            instance_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frame_limit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc) {
+            profile_csv = argv[++i];
+        } else if (strcmp(argv[i], "--profile-trace") == 0 && i + 1 < argc) {
+            profile_trace = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--headless] [--frames count] [--dump path%%d.ppm|png]"
+                            " [--profile-csv path] [--profile-trace path.json] [--deferred]"
+                            " [--depth-prepass] [--sort-clusters] [--lod] [--filter nearest|bilinear|trilinear]"
+                            " [--address wrap|clamp] [--frame-budget ms] [--lights count] [--shadows] [--shadow-pcf radius]"
+                            " [--instances count]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if ((profile_csv != NULL && !profiler_open_csv(profile_csv)) ||
+        (profile_trace != NULL && !profiler_open_trace(profile_trace))) {
+        return 1;
+    }
+
+    if (headless && frame_limit <= 0) {
+        frame_limit = 1;
+    }
+
+    sdl_gfx* gfx = headless
+        ? sdl_gfx_init_headless(SCREEN_WIDTH, SCREEN_HEIGHT)
+        : sdl_gfx_init("Software Renderer", SCREEN_WIDTH, SCREEN_HEIGHT);
 
     if (gfx == NULL) {
         return 1;
     }
 
+    sdl_gfx_set_dump_path(gfx, dump_path);
+
+    // Draws straight into the window's buffer
+    render_target_t* target = make_render_target_for_buffer(gfx->buffer, gfx->width, gfx->height, gfx->width);
+    if (target == NULL) {
+        sdl_gfx_dispose(gfx);
+        return 1;
+    }
+
+    draw_init(0);
+    if (deferred) {
+        draw_set_deferred(true);
+    }
+    if (filter != TEXTURE_NEAREST) {
+        draw_set_texture_filter(filter);
+    }
+
     model_t cube = load_model("./assets/cube.obj", "./assets/box.png", COLOR_WHITE, COLOR_GREEN);
     model_t monkey = load_model("./assets/monkey.obj", "./assets/uv_checker.png", COLOR_WHITE, COLOR_RED);
     model_t* models[] = { &cube, &monkey };
+    texture_set_address(&cube.texture, address);
+    texture_set_address(&monkey.texture, address);
 
     cube.translation = (vec3_t) {-1.25f, 0.0f, 0.5f};
     monkey.translation = (vec3_t) {1.5f, 0.0f, 0.5f};
     monkey.rotation = (vec3_t) {180.0f, 0.0f, 0.0f};
 
     const camera_t camera = make_camera((vec3_t){0.0f, 0.0f, -3.0f});
-    const mat4x4_t view_mat  = make_view_matrix(camera.position, camera.target);
+    const mat4x4_t view_mat  = camera.view_mat;
 
-    const light_t light = make_light((vec3_t){-2.0f, 2.0f, 1.0f}, (vec3_t){ 1.0f, 1.0f, 0.0f}, (vec4_t){1.0f, 0.0f, 0.0f, 1.0f}, view_mat);
-    const light_t light2 = make_light((vec3_t){2.0f, -2.0f, 1.0f}, (vec3_t){-1.0f, -1.0f, 0.0f}, (vec4_t){0.0f, 1.0f, 0.0f, 1.0f}, view_mat);
-    const light_t lights[] = { light, light2 };
-    const int lights_count = 2;
+    const light_t light = make_light((vec3_t){-2.0f, 2.0f, 1.0f}, (vec3_t){ 1.0f, 1.0f, 0.0f}, (vec4_t){1.0f, 0.0f, 0.0f, 1.0f}, 0.0f, view_mat);
+    const light_t light2 = make_light((vec3_t){2.0f, -2.0f, 1.0f}, (vec3_t){-1.0f, -1.0f, 0.0f}, (vec4_t){0.0f, 1.0f, 0.0f, 1.0f}, 0.0f, view_mat);
+    light_t scene_lights[] = { light, light2 };
+    const light_t* lights = scene_lights;
+    int lights_count = 2;
+
+    // Redrawn only when a light or a model in its frustum moves
+    shadow_map_t* shadow_maps[] = { NULL, NULL };
+    const vec3_t shadow_target = mat4_mul_vec3(&view_mat, (vec3_t){0.0f, 0.0f, 0.5f});
+    for (int i = 0; shadows && point_lights <= 0 && i < 2; ++i) {
+        shadow_maps[i] = make_shadow_map(SHADOW_MAP_SIZE, SHADOW_FOV, shadow_pcf);
+        scene_lights[i].shadow = shadow_maps[i];
+    }
+
+    light_t* scattered_lights = NULL;
+    if (point_lights > 0) {
+        scattered_lights = malloc(point_lights * sizeof(light_t));
+        if (scattered_lights == NULL) {
+            fprintf(stderr, "Failed to allocate %d lights.\n", point_lights);
+            draw_dispose();
+            free_render_target(target);
+            sdl_gfx_dispose(gfx);
+            return 1;
+        }
+        scatter_lights(scattered_lights, point_lights, POINT_LIGHT_RANGE, POINT_LIGHT_INTENSITY, view_mat);
+        lights = scattered_lights;
+        lights_count = point_lights;
+    }
+
+    // Share the cube's mesh and texture, only the batch's view space copies are allocated for them
+    instance_t* instances = NULL;
+    instance_batch_t* instance_batch = NULL;
+    if (instance_count > 0) {
+        instances = malloc(instance_count * sizeof(instance_t));
+        instance_batch = make_instance_batch(&cube);
+        if (instances == NULL || instance_batch == NULL) {
+            fprintf(stderr, "Failed to allocate %d instances.\n", instance_count);
+            instance_count = 0;
+        } else {
+            arrange_instance_grid(instances, instance_count, INSTANCE_FIELD_CENTER, INSTANCE_FIELD_SPACING, INSTANCE_FIELD_SCALE);
+        }
+    }
+
+    // The lights and the camera stay put, so the lights are only binned again when the projection or the target's
+    // size changes
+    light_grid_t light_grid = {0};
+    bool lights_binned = false;
+    projection_type binned_proj_type = PERSPECTIVE;
 
     const vec3_t ambient = { 0.2f, 0.2f, 0.2f };
     const vec3_t ambient2 = { 0.1f, 0.1f, 0.2f };
 
-    const int rend_modes_count = 8;
+    const int rend_modes_count = RENDER_MODES_COUNT;
     int render_mode = rend_modes_count - 1;
     projection_type proj_type = PERSPECTIVE;
 
-    const mat4x4_t perspective_mat = make_perspective_matrix(FOV, SCREEN_WIDTH, SCREEN_HEIGHT, NEAR_PLANE, FAR_PLANE);
-    const mat4x4_t ortho_mat = make_orthographic_matrix(SCREEN_WIDTH, SCREEN_HEIGHT, NEAR_PLANE, FAR_PLANE);
+    const mat4x4_t perspective_mat = make_perspective_matrix(FOV, gfx->width, gfx->height, NEAR_PLANE, FAR_PLANE);
+    const mat4x4_t ortho_mat = make_orthographic_matrix(gfx->width, gfx->height, NEAR_PLANE, FAR_PLANE);
 
-    z_buffer_t* z_buffer = make_z_buffer();
+    resolution_governor_t governor = make_resolution_governor(frame_budget_ms);
 
     int selected_model_idx = 0;
     const int model_count = sizeof(models) / sizeof(models[0]);
     model_t* selected_model;
 
-    for (int i = 0; i < model_count; ++i) {
-        model_t* model = models[i];
-        apply_transformations(model, &camera);
-    }
+    model_t* draw_order[sizeof(models) / sizeof(models[0])];
 
     Uint64 last_time = SDL_GetPerformanceCounter();
 
     bool is_running = true;
+    bool show_stats = false;
+    char stats_text[1024];
 
     while (is_running) {
+        profiler_begin_frame();
+
         const Uint64 current_time = SDL_GetPerformanceCounter();
         const float delta_time = (float)(current_time - last_time)/(float)SDL_GetPerformanceFrequency();
         last_time = current_time;
 
         selected_model = models[selected_model_idx];
 
-        handle_inputs(&selected_model->translation, &selected_model->rotation, &selected_model->scale, &render_mode, rend_modes_count, &selected_model_idx, model_count, &proj_type, &is_running, delta_time);
-
-        apply_transformations(selected_model, &camera);
+        if (!headless) {
+            handle_inputs(&selected_model->translation, &selected_model->rotation, &selected_model->scale, &render_mode, rend_modes_count, &selected_model_idx, model_count, &proj_type, &show_stats, &depth_prepass, &sort_clusters, &lod, &is_running, delta_time);
+        }
 
         const mat4x4_t proj_mat = (proj_type == PERSPECTIVE) ? perspective_mat : ortho_mat;
 
-        clear_z_buffer(z_buffer);
-
-        sdl_gfx_clear(gfx, COLOR_BLACK);
+        // Models that didn't move keep last frame's view space vertices
+        PROFILE_BEGIN(PROFILE_TRANSFORM);
+        for (int i = 0; i < model_count; ++i) {
+            apply_transformations(models[i], &camera);
+            if (lod) {
+                select_model_lod(models[i], &camera, &proj_mat, proj_type, target->height);
+            } else {
+                set_model_lod(models[i], &camera, 0);
+            }
+        }
+        PROFILE_END(PROFILE_TRANSFORM);
 
         for (int i = 0; i < model_count; ++i) {
-            const model_t* model = models[i];
-
-            switch (render_mode) {
-                case 7:
-                    draw_textured_phong_shaded(gfx,
-                        model->mesh.transformed_vertices, model->mesh.transformed_normals,
-                        model->mesh.triangles,model->mesh.triangle_count,
-                        model->mesh.uvs,
-                        &model->texture,
-                        lights, lights_count,
-                        &proj_mat, proj_type,
-                        z_buffer,
-                        ambient2);
-                    break;
-                case 6:
-                    draw_textured_flat_shaded(gfx,
-                        model->mesh.transformed_vertices,
-                        model->mesh.triangles, model->mesh.triangle_count,
-                        model->mesh.uvs, &model->texture,
-                        lights, lights_count,
-                        &proj_mat, proj_type,
-                        z_buffer,
-                        ambient);
-                    break;
-                case 5:
-                    draw_textured_unlit(gfx,
-                        model->mesh.transformed_vertices,
-                        model->mesh.triangles, model->mesh.triangle_count,
-                        model->mesh.uvs,
-                        &model->texture,
-                        &proj_mat, proj_type,
-                        z_buffer);
-                    break;
-                case 4:
-                    draw_phong_shaded(gfx,
-                        model->mesh.transformed_vertices,
-                        model->mesh.transformed_normals,
-                        model->mesh.triangles,
-                        model->mesh.triangle_count,
-                        model->color,
-                        lights, lights_count,
-                        &proj_mat, proj_type,
-                        z_buffer,
-                        ambient2);
-                    break;
-                case 3:
-                    draw_flat_shaded(gfx,
-                        model->mesh.transformed_vertices,
-                        model->mesh.triangles, model->mesh.triangle_count,
-                        model->color,
-                        lights, lights_count,
-                        &proj_mat, proj_type,
-                        z_buffer,
-                        ambient);
-                    break;
-                case 2:
-                    draw_unlit(gfx,
-                        model->mesh.transformed_vertices,
-                        model->mesh.triangles, model->mesh.triangle_count,
-                        model->color,
-                        &proj_mat, proj_type,
-                        z_buffer);
-                    break;
-                case 1:
-                    draw_wireframe(gfx,
-                        model->mesh.transformed_vertices,
-                        model->mesh.triangles, model->mesh.triangle_count,
-                        model->wire_color,
-                        &proj_mat, proj_type,
-                        false);
-                    break;
-                case 0:
-                    draw_wireframe(gfx,
-                        model->mesh.transformed_vertices,
-                        model->mesh.triangles, model->mesh.triangle_count,
-                        model->wire_color,
-                        &proj_mat, proj_type,
-                        true);
-                    break;
-                default:
-                    break;
+            models[i]->sort_clusters = sort_clusters;
+        }
+
+        // Nearer models first, so the z test rejects as much of the farther ones as possible
+        memcpy(draw_order, models, sizeof(draw_order));
+        sort_models_front_to_back(draw_order, model_count);
+
+        for (int i = 0; i < 2; ++i) {
+            if (shadow_maps[i] != NULL) {
+                update_shadow_map(shadow_maps[i], &scene_lights[i], shadow_target, models, model_count);
+            }
+        }
+
+        PROFILE_BEGIN(PROFILE_CLEAR_Z);
+        clear_z_buffer(target->z_buffer);
+        PROFILE_END(PROFILE_CLEAR_Z);
+
+        PROFILE_BEGIN(PROFILE_CLEAR_COLOR);
+        clear_render_target_color(target, COLOR_BLACK);
+        PROFILE_END(PROFILE_CLEAR_COLOR);
+
+        if (!lights_binned || binned_proj_type != proj_type) {
+            PROFILE_BEGIN(PROFILE_BIN_LIGHTS);
+            bin_lights(&light_grid, lights, lights_count, target, &proj_mat);
+            PROFILE_END(PROFILE_BIN_LIGHTS);
+            lights_binned = true;
+            binned_proj_type = proj_type;
+        }
+
+        // With the prepass the z buffer already holds the final depths, so the shading pass below only
+        // writes pixels whose depth matches and every visible pixel is shaded once
+        if (depth_prepass) {
+            for (int i = 0; i < model_count; ++i) {
+                draw_model_depth(target, draw_order[i], render_mode, &proj_mat, proj_type);
             }
         }
 
+        for (int i = 0; i < model_count; ++i) {
+            model_t* model = draw_order[i];
+
+            draw_model(target, model, render_mode,
+                &light_grid,
+                &proj_mat, proj_type,
+                ambient, ambient2);
+        }
+
+        if (instance_count > 0) {
+            draw_instances(target, instance_batch, instances, instance_count, render_mode,
+                &light_grid,
+                &camera.view_mat, &proj_mat, proj_type,
+                ambient, ambient2, lod ? target->height : 0);
+        }
+
+        // The HUD shows the previous frame, the current one is still being measured
+        if (show_stats) {
+            const int len = SDL_snprintf(stats_text, sizeof(stats_text), "render scale %.4g (%dx%d)\n",
+                governor.scale, target->width, target->height);
+            profiler_format_hud(stats_text + len, sizeof(stats_text) - len);
+        }
+        sdl_gfx_set_overlay_text(gfx, show_stats ? stats_text : NULL);
+
+        PROFILE_BEGIN(PROFILE_PRESENT);
         sdl_gfx_render(gfx);
+        PROFILE_END(PROFILE_PRESENT);
+
+        profiler_end_frame();
+
+        // The next frame renders at whatever resolution fits the budget given this one's time
+        if (frame_budget_ms > 0.0f) {
+            const float frame_ms = (float)(SDL_GetPerformanceCounter() - current_time) * 1000.0f / (float)SDL_GetPerformanceFrequency();
+            if (resolution_governor_update(&governor, frame_ms)) {
+                int width, height;
+                resolution_scaled_size(governor.scale, gfx->width, gfx->height, &width, &height);
+                target = resize_target(gfx, target, width, height);
+                if (target->width != light_grid.tiles.width || target->height != light_grid.tiles.height) {
+                    bin_lights(&light_grid, lights, lights_count, target, &proj_mat);
+                }
+            }
+            profiler_set_render_scale(governor.scale);
+        }
+
+        if (frame_limit > 0 && gfx->frame_index >= frame_limit) {
+            is_running = false;
+        }
     }
 
+    profiler_close();
+    draw_dispose();
+    free_light_grid(&light_grid);
+    free(scattered_lights);
+    free_instance_batch(instance_batch);
+    free(instances);
+    free_shadow_map(shadow_maps[0]);
+    free_shadow_map(shadow_maps[1]);
+    free_model(&monkey);
+    free_model(&cube);
+    free_render_target(target);
     sdl_gfx_dispose(gfx);
     return 0;
 }
@@ -1,6 +1,12 @@
 ﻿#include <math.h>
+#include <string.h>
 #include "matrix.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MATRIX_SSE2
+#endif
+
 vec3_t mat4_mul_vec3(const mat4x4_t* mat, const vec3_t vec) {
     return (vec3_t){
         mat->m[0][0] * vec.x + mat->m[0][1] * vec.y + mat->m[0][2] * vec.z + mat->m[0][3],
@@ -9,6 +15,59 @@ vec3_t mat4_mul_vec3(const mat4x4_t* mat, const vec3_t vec) {
     };
 }
 
+#ifdef MATRIX_SSE2
+
+// One matrix row applied to 4 points, summed in the same order as mat4_mul_vec3
+static __m128 mul_row4(const float* row, const __m128 x, const __m128 y, const __m128 z) {
+    const __m128 xy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), x), _mm_mul_ps(_mm_set1_ps(row[1]), y));
+    return _mm_add_ps(_mm_add_ps(xy, _mm_mul_ps(_mm_set1_ps(row[2]), z)), _mm_set1_ps(row[3]));
+}
+
+// Interleaves 4 results back into vec3_t without touching memory past the 4th one
+static void store_vec3x4(vec3_t* out, __m128 x, __m128 y, __m128 z) {
+    __m128 w = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    float* dst = &out->x;
+    _mm_storeu_ps(dst, x);
+    _mm_storeu_ps(dst + 3, y);
+    _mm_storeu_ps(dst + 6, z);
+    _mm_storel_pi((__m64*)(dst + 9), w);
+    _mm_store_ss(dst + 11, _mm_movehl_ps(w, w));
+}
+
+static void mul_batch8(const mat4x4_t* mat, const float* x, const float* y, const float* z, vec3_t* out) {
+    for (int half = 0; half < 8; half += 4) {
+        const __m128 px = _mm_load_ps(x + half);
+        const __m128 py = _mm_load_ps(y + half);
+        const __m128 pz = _mm_load_ps(z + half);
+        store_vec3x4(out + half, mul_row4(mat->m[0], px, py, pz), mul_row4(mat->m[1], px, py, pz), mul_row4(mat->m[2], px, py, pz));
+    }
+}
+
+#else
+
+static void mul_batch8(const mat4x4_t* mat, const float* x, const float* y, const float* z, vec3_t* out) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = mat4_mul_vec3(mat, (vec3_t){x[i], y[i], z[i]});
+    }
+}
+
+#endif
+
+void mat4_mul_vec3_batch(const mat4x4_t* mat, const float* x, const float* y, const float* z, const int count, vec3_t* out) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        mul_batch8(mat, x + i, y + i, z + i, out + i);
+    }
+
+    // The inputs are padded, so the last partial batch runs whole and only its live results are kept
+    if (i < count) {
+        vec3_t tail[8];
+        mul_batch8(mat, x + i, y + i, z + i, tail);
+        memcpy(out + i, tail, (count - i) * sizeof(vec3_t));
+    }
+}
+
 vec4_t mat4x4_mul_vec4(const mat4x4_t* mat, const vec4_t vec) {
     return (vec4_t){
         mat->m[0][0] * vec.x + mat->m[0][1] * vec.y + mat->m[0][2] * vec.z + mat->m[0][3] * vec.w,
@@ -31,6 +90,28 @@ mat4x4_t mat4_mul(const mat4x4_t* a, const mat4x4_t* b) {
     return result;
 }
 
+mat4x4_t mat4_normal_matrix(const mat4x4_t* mat) {
+    const float (*m)[4] = mat->m;
+
+    // The inverse is the transposed cofactor matrix over the determinant, so its transpose is the cofactors
+    const float c[3][3] = {
+        { m[1][1] * m[2][2] - m[1][2] * m[2][1], m[1][2] * m[2][0] - m[1][0] * m[2][2], m[1][0] * m[2][1] - m[1][1] * m[2][0] },
+        { m[0][2] * m[2][1] - m[0][1] * m[2][2], m[0][0] * m[2][2] - m[0][2] * m[2][0], m[0][1] * m[2][0] - m[0][0] * m[2][1] },
+        { m[0][1] * m[1][2] - m[0][2] * m[1][1], m[0][2] * m[1][0] - m[0][0] * m[1][2], m[0][0] * m[1][1] - m[0][1] * m[1][0] }
+    };
+    const float det = m[0][0] * c[0][0] + m[0][1] * c[0][1] + m[0][2] * c[0][2];
+    const float inv_det = det != 0.0f ? 1.0f / det : 1.0f;
+
+    mat4x4_t result = {0};
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            result.m[i][j] = c[i][j] * inv_det;
+        }
+    }
+    result.m[3][3] = 1.0f;
+    return result;
+}
+
 mat4x4_t make_translation_matrix(const float x, const float y, const float z) {
     return (mat4x4_t){{
         {1.0f, 0.0f, 0.0f,   x},
@@ -13,6 +13,14 @@ vec3_t   mat4_mul_vec3(const mat4x4_t* mat, vec3_t vec);
 vec4_t   mat4x4_mul_vec4(const mat4x4_t* mat, vec4_t vec);
 mat4x4_t mat4_mul(const mat4x4_t* a, const mat4x4_t* b);
 
+// Inverse transpose of the upper 3x3 with no translation, takes the normals of the points mat transforms.
+// A singular mat gives its cofactors, which still point the right way where they are not zero.
+mat4x4_t mat4_normal_matrix(const mat4x4_t* mat);
+
+// mat4_mul_vec3 over count points given as component arrays, which must be 16-byte aligned and readable up to
+// the next multiple of 8 entries. The results match mat4_mul_vec3 bit for bit.
+void mat4_mul_vec3_batch(const mat4x4_t* mat, const float* x, const float* y, const float* z, int count, vec3_t* out);
+
 mat4x4_t make_translation_matrix(float x, float y, float z);
 mat4x4_t make_scale_matrix(float sx, float sy, float sz);
 mat4x4_t make_rotation_matrix(float pitch, float yaw, float roll);
@@ -1,120 +1,662 @@
 ﻿#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <SDL3/SDL.h>
 #include "mesh.h"
+#include "thread_pool.h"
 
-#define LINE_MAX 512
+// Files at least this large are split into line aligned chunks that are counted and parsed on a thread pool
+#define PARALLEL_MIN_BYTES (1 << 20)
+#define CHUNKS_PER_THREAD 4
 
-static void parse_face(const char** tokens, triangle_t* tri) {
-    for (int i = 0; i < 3; i++) {
-        int v = 0, vt = 0, vn = 0;
-        if (sscanf(tokens[i+1], "%d/%d/%d", &v, &vt, &vn) == 3) {
-            tri->v[i] = v - 1;
-            tri->uv[i] = vt - 1;
-            tri->n[i] = vn - 1;
+typedef struct {
+    const char* begin;
+    const char* end;
+
+    // Element counts of the chunk, then the number of elements in all chunks before it
+    int v_count, vt_count, vn_count, tri_count;
+    int v_base, vt_base, vn_base, tri_base;
+
+    int tris_written;
+    int bad_faces;
+} obj_chunk_t;
+
+typedef struct {
+    obj_chunk_t* chunks;
+    vec3_t* vertices;
+    vec3_t* normals;
+    vec2_t* uvs;
+    triangle_t* triangles;
+    int v_total, vt_total, vn_total;
+} obj_parse_t;
+
+static const float powers_of_ten[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+static bool is_space(const char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_digit(const char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char* skip_spaces(const char* p) {
+    while (is_space(*p)) ++p;
+    return p;
+}
+
+static const char* next_line(const char* p, const char* end) {
+    const char* nl = memchr(p, '\n', end - p);
+    return nl != NULL ? nl + 1 : end;
+}
+
+// Exact for up to 7 significant digits and small exponents, which covers what exporters write. Anything
+// else goes through strtof so the result always matches it.
+static const char* parse_float(const char* p, float* out) {
+    const char* start = p;
+
+    const bool negative = *p == '-';
+    if (*p == '-' || *p == '+') ++p;
+
+    unsigned int mantissa = 0;
+    int exponent = 0;
+    bool exact = true;
+
+    for (; is_digit(*p); ++p) {
+        if (mantissa < 100000000u) mantissa = mantissa * 10 + (*p - '0');
+        else { exact = false; exponent++; }
+    }
+    if (*p == '.') {
+        for (++p; is_digit(*p); ++p) {
+            if (mantissa < 100000000u) { mantissa = mantissa * 10 + (*p - '0'); exponent--; }
+            else if (*p != '0') exact = false;
         }
-        else if (sscanf(tokens[i+1], "%d//%d", &v, &vn) == 2) {
-            tri->v[i] = v - 1;
-            tri->uv[i] = 0;
-            tri->n[i] = vn - 1;
+    }
+    if (*p == 'e' || *p == 'E') {
+        const char* e = p + 1;
+        const bool exp_negative = *e == '-';
+        if (*e == '-' || *e == '+') ++e;
+        if (is_digit(*e)) {
+            int value = 0;
+            for (; is_digit(*e); ++e) {
+                if (value < 10000) value = value * 10 + (*e - '0');
+            }
+            exponent += exp_negative ? -value : value;
+            p = e;
         }
     }
+
+    if (exact && mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+        const float value = exponent < 0 ? (float)mantissa / powers_of_ten[-exponent] : (float)mantissa * powers_of_ten[exponent];
+        *out = negative ? -value : value;
+    }
+    else {
+        char* end;
+        *out = strtof(start, &end);
+        p = end;
+    }
+    return p;
 }
 
+// Saturates at +-INT_MAX, far past any element count, so an overlong index resolves out of range and its face is
+// rejected instead of overflowing
+static const char* parse_int(const char* p, int* out) {
+    const bool negative = *p == '-';
+    if (*p == '-' || *p == '+') ++p;
 
-static vec2_t parse_vec2(const char** tokens) {
-    vec2_t v;
-    v.x = strtof(tokens[1], NULL);
-    v.y = strtof(tokens[2], NULL);
-    return v;
+    int value = 0;
+    for (; is_digit(*p); ++p) {
+        const int digit = *p - '0';
+        value = value > (INT_MAX - digit) / 10 ? INT_MAX : value * 10 + digit;
+    }
+    *out = negative ? -value : value;
+    return p;
 }
 
-static vec3_t parse_vec3(const char** tokens) {
-    vec3_t v;
-    v.x = strtof(tokens[1], NULL);
-    v.y = strtof(tokens[2], NULL);
-    v.z = strtof(tokens[3], NULL);
-    return v;
+// One face corner in the v, v/vt, v//vn or v/vt/vn form, absent indices are left at 0 which OBJ never uses
+static const char* parse_corner(const char* p, int* v, int* vt, int* vn) {
+    *v = *vt = *vn = 0;
+    p = parse_int(p, v);
+    if (*p == '/') {
+        ++p;
+        if (*p != '/') p = parse_int(p, vt);
+        if (*p == '/') p = parse_int(p + 1, vn);
+    }
+    // Skip whatever is left of a malformed corner
+    while (*p != '\0' && *p != '\n' && !is_space(*p)) ++p;
+    return p;
 }
 
-mesh_t load_mesh_from_obj(const char* filename) {
-    FILE* f = fopen(filename, "r");
-    if (!f) {
-        fprintf(stderr, "Failed to read file %s\n", filename);
-        exit(1);
+// 1-based indices count from the start of the file and negative ones back from the current element,
+// returns -1 for absent or out of range indices
+static int resolve_index(const int index, const int seen, const int total) {
+    const int resolved = index > 0 ? index - 1 : seen + index;
+    return index != 0 && resolved >= 0 && resolved < total ? resolved : -1;
+}
+
+typedef enum { OBJ_OTHER, OBJ_VERTEX, OBJ_UV, OBJ_NORMAL, OBJ_FACE } obj_line_kind;
+
+static obj_line_kind line_kind(const char** p) {
+    const char* s = skip_spaces(*p);
+    obj_line_kind kind = OBJ_OTHER;
+    int keyword_len = 1;
+
+    if (s[0] == 'v') {
+        if (is_space(s[1])) kind = OBJ_VERTEX;
+        else if (s[1] == 't' && is_space(s[2])) { kind = OBJ_UV; keyword_len = 2; }
+        else if (s[1] == 'n' && is_space(s[2])) { kind = OBJ_NORMAL; keyword_len = 2; }
+    }
+    else if (s[0] == 'f' && is_space(s[1])) {
+        kind = OBJ_FACE;
     }
 
-    vec3_t* vertices = NULL;
-    vec3_t* normals = NULL;
-    vec2_t* uvs = NULL;
-    triangle_t* triangles = NULL;
-    int v_count = 0, n_count = 0, uv_count = 0, t_count = 0;
+    *p = s + keyword_len;
+    return kind;
+}
 
-    char line[LINE_MAX];
-    while (fgets(line, LINE_MAX, f)) {
-        if (line[0] == '#') continue;
-        const char* tokens[8];
-        int tok_count = 0;
+static int count_face_corners(const char* p) {
+    int corners = 0;
+    for (;;) {
+        p = skip_spaces(p);
+        if (*p == '\0' || *p == '\n')
+            return corners;
+        corners++;
+        while (*p != '\0' && *p != '\n' && !is_space(*p)) ++p;
+    }
+}
 
-        const char* token = strtok(line, " \t\r\n");
-        while (token && tok_count < 8) {
-            tokens[tok_count++] = token;
-            token = strtok(NULL, " \t\r\n");
-        }
-        if (tok_count == 0)
-            continue;
+static void count_chunk(void* ctx, const int chunk_index) {
+    obj_chunk_t* chunk = &((obj_parse_t*)ctx)->chunks[chunk_index];
 
-        switch (tokens[0][0]) {
-            case 'v':
-                if (tokens[0][1] == '\0') {
-                    vertices = realloc(vertices, (v_count+1) * sizeof(vec3_t));
-                    vertices[v_count++] = parse_vec3(tokens);
-                } else if (tokens[0][1] == 'n' && tokens[0][2] == '\0') {
-                    normals = realloc(normals, (n_count+1) * sizeof(vec3_t));
-                    normals[n_count++] = parse_vec3(tokens);
-                } else if (tokens[0][1] == 't' && tokens[0][2] == '\0') {
-                    uvs = realloc(uvs, (uv_count+1) * sizeof(vec2_t));
-                    uvs[uv_count++] = parse_vec2(tokens);
-                }
+    for (const char* line = chunk->begin; line < chunk->end; line = next_line(line, chunk->end)) {
+        const char* p = line;
+        switch (line_kind(&p)) {
+            case OBJ_VERTEX: chunk->v_count++; break;
+            case OBJ_UV:     chunk->vt_count++; break;
+            case OBJ_NORMAL: chunk->vn_count++; break;
+            case OBJ_FACE: {
+                const int corners = count_face_corners(p);
+                if (corners >= 3) chunk->tri_count += corners - 2;
                 break;
+            }
+            case OBJ_OTHER: break;
+        }
+    }
+}
 
-            case 'f':
-                if (tokens[0][1] == '\0') {
-                    triangles = realloc(triangles, (t_count+1) * sizeof(triangle_t));
-                    parse_face(tokens, &triangles[t_count]);
-                    t_count++;
-                }
-                break;
+static void parse_face(const obj_parse_t* obj, obj_chunk_t* chunk, const char* p, const int v_seen, const int vt_seen, const int vn_seen) {
+    triangle_t fan = {0};
+    int corner = 0;
+    triangle_t* out = &obj->triangles[chunk->tri_base + chunk->tris_written];
+    int written = 0;
+
+    for (;;) {
+        p = skip_spaces(p);
+        if (*p == '\0' || *p == '\n')
+            break;
+
+        int v, vt, vn;
+        p = parse_corner(p, &v, &vt, &vn);
+
+        v = resolve_index(v, v_seen, obj->v_total);
+        vt = resolve_index(vt, vt_seen, obj->vt_total);
+        vn = resolve_index(vn, vn_seen, obj->vn_total);
+        if (v < 0) {
+            chunk->bad_faces++;
+            return;
+        }
+
+        // Fan triangulation, corner 0 is shared and each new corner closes a triangle with the previous one
+        const int slot = corner < 2 ? corner : 2;
+        fan.v[slot] = v;
+        fan.uv[slot] = vt < 0 ? 0 : vt;
+        fan.n[slot] = vn;
+
+        if (corner >= 2) {
+            out[written++] = fan;
+            fan.v[1] = fan.v[2];
+            fan.uv[1] = fan.uv[2];
+            fan.n[1] = fan.n[2];
+        }
+        corner++;
+    }
 
-            default:
+    chunk->tris_written += written;
+}
+
+static void parse_chunk(void* ctx, const int chunk_index) {
+    const obj_parse_t* obj = ctx;
+    obj_chunk_t* chunk = &obj->chunks[chunk_index];
+    int v = 0, vt = 0, vn = 0;
+
+    for (const char* line = chunk->begin; line < chunk->end; line = next_line(line, chunk->end)) {
+        const char* p = line;
+        switch (line_kind(&p)) {
+            case OBJ_VERTEX: {
+                vec3_t* out = &obj->vertices[chunk->v_base + v++];
+                p = parse_float(skip_spaces(p), &out->x);
+                p = parse_float(skip_spaces(p), &out->y);
+                parse_float(skip_spaces(p), &out->z);
+                break;
+            }
+            case OBJ_UV: {
+                vec2_t* out = &obj->uvs[chunk->vt_base + vt++];
+                p = parse_float(skip_spaces(p), &out->x);
+                parse_float(skip_spaces(p), &out->y);
+                break;
+            }
+            case OBJ_NORMAL: {
+                vec3_t* out = &obj->normals[chunk->vn_base + vn++];
+                p = parse_float(skip_spaces(p), &out->x);
+                p = parse_float(skip_spaces(p), &out->y);
+                parse_float(skip_spaces(p), &out->z);
+                break;
+            }
+            case OBJ_FACE:
+                parse_face(obj, chunk, p, chunk->v_base + v, chunk->vt_base + vt, chunk->vn_base + vn);
+                break;
+            case OBJ_OTHER:
                 break;
         }
     }
+}
+
+static char* read_file(const char* filename, size_t* size) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    const long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char* data = length >= 0 ? malloc((size_t)length + 1) : NULL;
+    if (data != NULL) {
+        *size = fread(data, 1, (size_t)length, f);
+        data[*size] = '\0';
+    }
     fclose(f);
+    return data;
+}
+
+// Corners without a normal index get the face normal of their triangle, appended after the file's normals
+static void add_face_normals(mesh_t* mesh) {
+    int missing = 0;
+    for (int i = 0; i < mesh->triangle_count; ++i) {
+        const triangle_t* t = &mesh->triangles[i];
+        missing += t->n[0] < 0 || t->n[1] < 0 || t->n[2] < 0;
+    }
+    if (missing == 0)
+        return;
+
+    mesh->normals = realloc(mesh->normals, (mesh->normals_count + missing) * sizeof(vec3_t));
+    for (int i = 0; i < mesh->triangle_count; ++i) {
+        triangle_t* t = &mesh->triangles[i];
+        if (t->n[0] >= 0 && t->n[1] >= 0 && t->n[2] >= 0)
+            continue;
+
+        const vec3_t v1 = mesh->vertices[t->v[0]];
+        const vec3_t v2 = mesh->vertices[t->v[1]];
+        const vec3_t v3 = mesh->vertices[t->v[2]];
+        mesh->normals[mesh->normals_count] = vec3_normalize(vec3_cross(vec3_diff(v2, v1), vec3_diff(v3, v1)));
+
+        for (int j = 0; j < 3; ++j) {
+            if (t->n[j] < 0) t->n[j] = mesh->normals_count;
+        }
+        mesh->normals_count++;
+    }
+}
+
+mesh_t load_mesh_from_obj(const char* filename) {
+    size_t size = 0;
+    char* data = read_file(filename, &size);
+    if (!data) {
+        fprintf(stderr, "Failed to read file %s\n", filename);
+        exit(1);
+    }
+
+    thread_pool_t* pool = size >= PARALLEL_MIN_BYTES ? thread_pool_init(0) : NULL;
+    int chunk_count = thread_pool_thread_count(pool) * (pool != NULL ? CHUNKS_PER_THREAD : 1);
 
+    obj_parse_t obj = {0};
+    obj.chunks = calloc(chunk_count, sizeof(obj_chunk_t));
+
+    // Chunk boundaries are moved forward to the next line start, so no line is split
+    const char* end = data + size;
+    const char* begin = data;
+    for (int i = 0; i < chunk_count; ++i) {
+        const char* chunk_end = i == chunk_count - 1 ? end : data + size / chunk_count * (i + 1);
+        if (chunk_end < begin) chunk_end = begin;
+        if (chunk_end > data && chunk_end < end && chunk_end[-1] != '\n') chunk_end = next_line(chunk_end, end);
+        obj.chunks[i].begin = begin;
+        obj.chunks[i].end = chunk_end;
+        begin = chunk_end;
+    }
+
+    thread_pool_run(pool, count_chunk, &obj, chunk_count);
+
+    int tri_total = 0;
+    for (int i = 0; i < chunk_count; ++i) {
+        obj_chunk_t* chunk = &obj.chunks[i];
+        chunk->v_base = obj.v_total;
+        chunk->vt_base = obj.vt_total;
+        chunk->vn_base = obj.vn_total;
+        chunk->tri_base = tri_total;
+        obj.v_total += chunk->v_count;
+        obj.vt_total += chunk->vt_count;
+        obj.vn_total += chunk->vn_count;
+        tri_total += chunk->tri_count;
+    }
+
+    obj.vertices = malloc((obj.v_total > 0 ? obj.v_total : 1) * sizeof(vec3_t));
+    obj.normals = malloc((obj.vn_total > 0 ? obj.vn_total : 1) * sizeof(vec3_t));
+    obj.uvs = malloc((obj.vt_total > 0 ? obj.vt_total : 1) * sizeof(vec2_t));
+    obj.triangles = malloc((tri_total > 0 ? tri_total : 1) * sizeof(triangle_t));
+
+    thread_pool_run(pool, parse_chunk, &obj, chunk_count);
+    thread_pool_dispose(pool);
+
+    // Faces with bad vertex indices left gaps at the end of their chunk's range
+    int t_count = 0;
+    int bad_faces = 0;
+    for (int i = 0; i < chunk_count; ++i) {
+        const obj_chunk_t* chunk = &obj.chunks[i];
+        memmove(&obj.triangles[t_count], &obj.triangles[chunk->tri_base], chunk->tris_written * sizeof(triangle_t));
+        t_count += chunk->tris_written;
+        bad_faces += chunk->bad_faces;
+    }
+    if (bad_faces > 0) {
+        fprintf(stderr, "Skipped %d faces with invalid vertex indices in %s\n", bad_faces, filename);
+    }
+
+    free(obj.chunks);
+    free(data);
+
+    int uv_count = obj.vt_total;
     if (uv_count == 0) {
-        uvs = malloc(sizeof(vec2_t));
-        uvs[0].x = 0.0f;
-        uvs[0].y = 0.0f;
+        obj.uvs[0].x = 0.0f;
+        obj.uvs[0].y = 0.0f;
         uv_count = 1;
     }
 
     mesh_t mesh = {0};
-    mesh.vertex_count    = v_count;
-    mesh.normals_count   = n_count;
+    mesh.vertex_count    = obj.v_total;
+    mesh.normals_count   = obj.vn_total;
     mesh.uvs_count       = uv_count;
     mesh.triangle_count  = t_count;
 
-    mesh.vertices             = vertices;
-    mesh.normals              = normals;
-    mesh.uvs                  = uvs;
-    mesh.triangles            = triangles;
-    mesh.transformed_vertices = calloc(v_count, sizeof(vec3_t));
-    mesh.transformed_normals  = calloc(n_count, sizeof(vec3_t));
+    mesh.vertices             = obj.vertices;
+    mesh.normals              = obj.normals;
+    mesh.uvs                  = obj.uvs;
+    mesh.triangles            = obj.triangles;
+
+    add_face_normals(&mesh);
+
+    mesh.vertices_soa = make_vec3_soa(mesh.vertices, mesh.vertex_count);
+    mesh.normals_soa  = make_vec3_soa(mesh.normals, mesh.normals_count);
+    build_mesh_bounds(&mesh);
+
+    mesh.transformed_vertices = calloc(mesh.vertex_count, sizeof(vec3_t));
+    mesh.transformed_normals  = calloc(mesh.normals_count, sizeof(vec3_t));
 
     return mesh;
 }
 
+// Centered on the bounding box, which is close enough for ordering and cheap to compute
+static void bounding_sphere(const vec3_t* vertices, const triangle_t* triangles, const int triangle_count, vec3_t* center, float* radius) {
+    vec3_t lo = vertices[triangles[0].v[0]];
+    vec3_t hi = lo;
+    for (int i = 0; i < triangle_count; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            const vec3_t v = vertices[triangles[i].v[j]];
+            lo.x = fminf(lo.x, v.x); hi.x = fmaxf(hi.x, v.x);
+            lo.y = fminf(lo.y, v.y); hi.y = fmaxf(hi.y, v.y);
+            lo.z = fminf(lo.z, v.z); hi.z = fmaxf(hi.z, v.z);
+        }
+    }
+    *center = vec3_mul(vec3_add(lo, hi), 0.5f);
+
+    float radius_sq = 0.0f;
+    for (int i = 0; i < triangle_count; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            const vec3_t d = vec3_diff(vertices[triangles[i].v[j]], *center);
+            radius_sq = fmaxf(radius_sq, vec3_dot(d, d));
+        }
+    }
+    *radius = sqrtf(radius_sq);
+}
+
+// Normal cone of the faces, normals come from the same cross product back-face culling uses
+static void normal_cone(const vec3_t* vertices, const triangle_t* triangles, const int triangle_count, vec3_t* axis, float* cone_cos) {
+    vec3_t sum = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < triangle_count; ++i) {
+        const vec3_t v1 = vertices[triangles[i].v[0]];
+        const vec3_t edge1 = vec3_diff(vertices[triangles[i].v[1]], v1);
+        const vec3_t edge2 = vec3_diff(vertices[triangles[i].v[2]], v1);
+        const vec3_t cross = vec3_cross(edge1, edge2);
+        const float length = sqrtf(vec3_dot(cross, cross));
+        // Slivers get their normal from rounding noise once transformed, so they can't be bounded
+        if (length <= 1e-4f * sqrtf(vec3_dot(edge1, edge1) * vec3_dot(edge2, edge2))) {
+            *axis = (vec3_t){0.0f, 0.0f, 1.0f};
+            *cone_cos = -1.0f;
+            return;
+        }
+        sum = vec3_add(sum, vec3_mul(cross, 1.0f / length));
+    }
+
+    const float sum_length = sqrtf(vec3_dot(sum, sum));
+    if (sum_length < 1e-6f) {
+        *axis = (vec3_t){0.0f, 0.0f, 1.0f};
+        *cone_cos = -1.0f;
+        return;
+    }
+    *axis = vec3_mul(sum, 1.0f / sum_length);
+
+    float min_cos = 1.0f;
+    for (int i = 0; i < triangle_count; ++i) {
+        const vec3_t v1 = vertices[triangles[i].v[0]];
+        const vec3_t cross = vec3_cross(vec3_diff(vertices[triangles[i].v[1]], v1), vec3_diff(vertices[triangles[i].v[2]], v1));
+        min_cos = fminf(min_cos, vec3_dot(cross, *axis) / sqrtf(vec3_dot(cross, cross)));
+    }
+    *cone_cos = min_cos;
+}
+
+static vec3_t face_cross(const vec3_t* vertices, const triangle_t* triangle) {
+    const vec3_t v1 = vertices[triangle->v[0]];
+    return vec3_cross(vec3_diff(vertices[triangle->v[1]], v1), vec3_diff(vertices[triangle->v[2]], v1));
+}
+
+// Reorders the triangles so every run of MESH_CLUSTER_TRIANGLES is a compact patch facing one way. Each meshlet
+// grows from a seed over the triangles sharing a vertex with it, taking the one closest in direction and position.
+static void build_meshlets(mesh_t* mesh) {
+    const int triangle_count = mesh->triangle_count;
+    int* offsets = calloc(mesh->vertex_count + 1, sizeof(int));
+    int* adjacency = malloc(triangle_count * 3 * sizeof(int));
+    vec3_t* normals = malloc(triangle_count * sizeof(vec3_t));
+    vec3_t* centroids = malloc(triangle_count * sizeof(vec3_t));
+    bool* emitted = calloc(triangle_count, sizeof(bool));
+    int* candidates = malloc(triangle_count * sizeof(int));
+    triangle_t* ordered = malloc(triangle_count * sizeof(triangle_t));
+    if (offsets == NULL || adjacency == NULL || normals == NULL || centroids == NULL || emitted == NULL || candidates == NULL || ordered == NULL) {
+        fprintf(stderr, "Failed to allocate the meshlet builder, clusters follow the file order.\n");
+        goto done;
+    }
+
+    // Triangles around each vertex
+    for (int i = 0; i < triangle_count; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            offsets[mesh->triangles[i].v[j] + 1]++;
+        }
+    }
+    for (int i = 0; i < mesh->vertex_count; ++i) {
+        offsets[i + 1] += offsets[i];
+    }
+    for (int i = 0; i < triangle_count; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            adjacency[offsets[mesh->triangles[i].v[j]]++] = i;
+        }
+    }
+    for (int i = mesh->vertex_count; i > 0; --i) {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+
+    float area = 0.0f;
+    for (int i = 0; i < triangle_count; ++i) {
+        const triangle_t* t = &mesh->triangles[i];
+        const vec3_t cross = face_cross(mesh->vertices, t);
+        const float length = sqrtf(vec3_dot(cross, cross));
+        normals[i] = length > 0.0f ? vec3_mul(cross, 1.0f / length) : (vec3_t){0.0f, 0.0f, 0.0f};
+        centroids[i] = vec3_mul(vec3_add(vec3_add(mesh->vertices[t->v[0]], mesh->vertices[t->v[1]]), mesh->vertices[t->v[2]]), 1.0f / 3.0f);
+        area += 0.5f * length;
+    }
+    // Radius of a disc holding one meshlet's worth of the average triangle area
+    const float expected_radius = fmaxf(sqrtf(area / triangle_count * MESH_CLUSTER_TRIANGLES / 3.14159265f), 1e-12f);
+
+    int ordered_count = 0;
+    int seed = 0;
+    while (ordered_count < triangle_count) {
+        while (emitted[seed]) {
+            ++seed;
+        }
+
+        const int first = ordered_count;
+        int candidate_count = 0;
+        vec3_t normal_sum = {0.0f, 0.0f, 0.0f};
+        vec3_t centroid_sum = {0.0f, 0.0f, 0.0f};
+        int next = seed;
+
+        while (next >= 0) {
+            emitted[next] = true;
+            ordered[ordered_count++] = mesh->triangles[next];
+            normal_sum = vec3_add(normal_sum, normals[next]);
+            centroid_sum = vec3_add(centroid_sum, centroids[next]);
+            if (ordered_count - first == MESH_CLUSTER_TRIANGLES)
+                break;
+
+            for (int j = 0; j < 3; ++j) {
+                const int v = mesh->triangles[next].v[j];
+                for (int k = offsets[v]; k < offsets[v + 1]; ++k) {
+                    const int neighbor = adjacency[k];
+                    if (!emitted[neighbor]) {
+                        candidates[candidate_count++] = neighbor;
+                        emitted[neighbor] = true; // queued, cleared again below unless it's taken
+                    }
+                }
+            }
+
+            const float axis_length = sqrtf(vec3_dot(normal_sum, normal_sum));
+            const vec3_t axis = axis_length > 0.0f ? vec3_mul(normal_sum, 1.0f / axis_length) : normal_sum;
+            const vec3_t center = vec3_mul(centroid_sum, 1.0f / (ordered_count - first));
+
+            int best = -1;
+            float best_score = -FLT_MAX;
+            for (int i = 0; i < candidate_count; ++i) {
+                const int c = candidates[i];
+                const vec3_t d = vec3_diff(centroids[c], center);
+                const float score = vec3_dot(normals[c], axis) - sqrtf(vec3_dot(d, d)) / expected_radius;
+                if (score > best_score) {
+                    best_score = score;
+                    best = i;
+                }
+            }
+
+            next = -1;
+            if (best >= 0) {
+                next = candidates[best];
+                candidates[best] = candidates[--candidate_count];
+            }
+        }
+
+        for (int i = 0; i < candidate_count; ++i) {
+            emitted[candidates[i]] = false;
+        }
+    }
+
+    memcpy(mesh->triangles, ordered, triangle_count * sizeof(triangle_t));
+
+done:
+    free(offsets);
+    free(adjacency);
+    free(normals);
+    free(centroids);
+    free(emitted);
+    free(candidates);
+    free(ordered);
+}
+
+void build_mesh_bounds(mesh_t* mesh) {
+    if (mesh->triangle_count == 0)
+        return;
+
+    bounding_sphere(mesh->vertices, mesh->triangles, mesh->triangle_count, &mesh->bounds_center, &mesh->bounds_radius);
+    if (mesh->triangle_count > MESH_CLUSTER_TRIANGLES) {
+        build_meshlets(mesh);
+    }
+
+    mesh->cluster_count = (mesh->triangle_count + MESH_CLUSTER_TRIANGLES - 1) / MESH_CLUSTER_TRIANGLES;
+    mesh->clusters = malloc(mesh->cluster_count * sizeof(mesh_cluster_t));
+    mesh->transformed_clusters = malloc(mesh->cluster_count * sizeof(cluster_bounds_t));
+    mesh->cluster_order = malloc(mesh->cluster_count * sizeof(mesh_cluster_order_t));
+    mesh->draw_triangles = malloc(mesh->triangle_count * sizeof(triangle_t));
+    if (mesh->clusters == NULL || mesh->transformed_clusters == NULL || mesh->cluster_order == NULL || mesh->draw_triangles == NULL) {
+        fprintf(stderr, "Failed to allocate the clusters of a %d triangle mesh.\n", mesh->triangle_count);
+        free(mesh->clusters);
+        free(mesh->transformed_clusters);
+        free(mesh->cluster_order);
+        free(mesh->draw_triangles);
+        mesh->clusters = NULL;
+        mesh->transformed_clusters = NULL;
+        mesh->cluster_order = NULL;
+        mesh->draw_triangles = NULL;
+        mesh->cluster_count = 0;
+        return;
+    }
+
+    for (int i = 0; i < mesh->cluster_count; ++i) {
+        mesh_cluster_t* cluster = &mesh->clusters[i];
+        cluster->first_triangle = i * MESH_CLUSTER_TRIANGLES;
+        cluster->triangle_count = mesh->triangle_count - cluster->first_triangle < MESH_CLUSTER_TRIANGLES
+            ? mesh->triangle_count - cluster->first_triangle
+            : MESH_CLUSTER_TRIANGLES;
+
+        const triangle_t* triangles = mesh->triangles + cluster->first_triangle;
+        bounding_sphere(mesh->vertices, triangles, cluster->triangle_count, &cluster->bounds.center, &cluster->bounds.radius);
+        normal_cone(mesh->vertices, triangles, cluster->triangle_count, &cluster->bounds.cone_axis, &cluster->bounds.cone_cos);
+    }
+}
+
+vec3_soa_t make_vec3_soa(const vec3_t* vecs, const int count) {
+    vec3_soa_t soa = {0};
+
+    // Rounding every component up to 16 floats keeps all three of them on 64-byte boundaries
+    const int stride = (count + 15) & ~15;
+    float* data = SDL_aligned_alloc(64, 3 * (size_t)(stride > 0 ? stride : 16) * sizeof(float));
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate the structure of arrays copy of %d vectors.\n", count);
+        return soa;
+    }
+
+    soa.x = data;
+    soa.y = data + stride;
+    soa.z = data + 2 * stride;
+    soa.count = count;
+
+    for (int i = 0; i < count; ++i) {
+        soa.x[i] = vecs[i].x;
+        soa.y[i] = vecs[i].y;
+        soa.z[i] = vecs[i].z;
+    }
+    for (int i = count; i < stride; ++i) {
+        soa.x[i] = soa.y[i] = soa.z[i] = 0.0f;
+    }
+    return soa;
+}
+
 mesh_t make_cube(void) {
     mesh_t mesh = {0};
 
@@ -164,5 +706,25 @@ mesh_t make_cube(void) {
     mesh.triangles[10] = (triangle_t){{5,7,0}, {0,1,2}, {5,5,5}};
     mesh.triangles[11] = (triangle_t){{5,0,3}, {0,2,3}, {5,5,5}};
 
+    mesh.vertices_soa = make_vec3_soa(mesh.vertices, mesh.vertex_count);
+    mesh.normals_soa  = make_vec3_soa(mesh.normals, mesh.normals_count);
+    build_mesh_bounds(&mesh);
+
     return mesh;
+}
+
+void free_mesh(mesh_t* mesh) {
+    free(mesh->transformed_vertices);
+    free(mesh->transformed_normals);
+    free(mesh->vertices);
+    free(mesh->normals);
+    free(mesh->uvs);
+    free(mesh->triangles);
+    SDL_aligned_free(mesh->vertices_soa.x);
+    SDL_aligned_free(mesh->normals_soa.x);
+    free(mesh->clusters);
+    free(mesh->transformed_clusters);
+    free(mesh->cluster_order);
+    free(mesh->draw_triangles);
+    *mesh = (mesh_t){0};
 }
\ No newline at end of file
@@ -9,6 +9,41 @@ typedef struct {
     int n[3];
 } triangle_t;
 
+// Batch kernels consume this many vectors per iteration
+#define VEC3_SOA_BATCH 8
+
+// A structure of arrays copy of a vec3_t array. Every component array is 64-byte aligned and zero padded
+// to a multiple of VEC3_SOA_BATCH entries, so kernels can always load whole aligned batches.
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+    int count;
+} vec3_soa_t;
+
+// Triangles per cluster (meshlet), the granularity of cluster culling and of the front-to-back draw order
+#define MESH_CLUSTER_TRIANGLES 64
+
+// Bounds of a cluster, in model space in mesh.clusters and in view space in mesh.transformed_clusters
+typedef struct {
+    vec3_t center;
+    float radius;
+    vec3_t cone_axis; // the face normals all lie within acos(cone_cos) of this unit axis
+    float cone_cos;   // <= 0 when they spread too far, or some face is degenerate, for the cone to cull anything
+} cluster_bounds_t;
+
+// A run of consecutive triangles
+typedef struct {
+    int first_triangle;
+    int triangle_count;
+    cluster_bounds_t bounds;
+} mesh_cluster_t;
+
+typedef struct {
+    float distance;
+    int cluster;
+} mesh_cluster_order_t;
+
 typedef struct {
     vec3_t* transformed_vertices;
     vec3_t* transformed_normals;
@@ -17,13 +52,35 @@ typedef struct {
     vec2_t* uvs;
     triangle_t* triangles;
 
+    // Optional, the transform falls back to the arrays above when these are empty
+    vec3_soa_t vertices_soa;
+    vec3_soa_t normals_soa;
+
+    // Model space bounding sphere of all vertices
+    vec3_t bounds_center;
+    float bounds_radius;
+
+    mesh_cluster_t* clusters;
+    cluster_bounds_t* transformed_clusters;
+    mesh_cluster_order_t* cluster_order; // per draw scratch for the surviving clusters
+    triangle_t* draw_triangles;          // triangles of the surviving clusters, in draw order
+    int cluster_count;
+
     int vertex_count;
     int normals_count;
     int uvs_count;
     int triangle_count;
+
+    float lod_error; // distance the surface may have moved by simplification, 0 unless built by build_mesh_lods
 } mesh_t;
 
+vec3_soa_t make_vec3_soa(const vec3_t* vecs, int count);
+
+// Computes the bounding sphere and splits the triangles into clusters with their own bounds, called once after loading
+void build_mesh_bounds(mesh_t* mesh);
+
 mesh_t make_cube(void);
 mesh_t load_mesh_from_obj(const char* filename);
+void   free_mesh(mesh_t* mesh);
 
 #endif //SOFTWARE_RENDERER_C_MESH_H
\ No newline at end of file
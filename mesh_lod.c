@@ -0,0 +1,564 @@
+﻿#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "mesh_lod.h"
+
+// Boundary edges are held in place by a plane through them at this many times the weight of a face's plane
+#define LOD_BOUNDARY_WEIGHT 10.0
+// A level that keeps more than this fraction of the previous level's triangles ends the chain
+#define LOD_MIN_REDUCTION 0.9f
+
+// Sum of squared distances to a set of planes, as the symmetric 4x4 matrix of their (a, b, c, d) outer products:
+// a2 ab ac ad b2 bc bd c2 cd d2
+typedef struct {
+    double q[10];
+} quadric_t;
+
+typedef struct {
+    int* tris;
+    int count;
+    int capacity;
+} vertex_tris_t;
+
+typedef struct {
+    double cost;
+    int from; // collapses onto to and takes its position
+    int to;
+    int from_version;
+    int to_version;
+} collapse_t;
+
+typedef struct {
+    const mesh_t* mesh;
+    quadric_t* quadrics;
+    vertex_tris_t* vertex_tris;
+    int* versions;
+    bool* vertex_alive;
+    int* stamps;
+    int stamp;
+    triangle_t* tris; // corners move to the vertex they collapse onto
+    bool* tri_alive;
+    int tris_alive;
+    collapse_t* heap;
+    int heap_count;
+    int heap_capacity;
+    double max_cost;
+} simplifier_t;
+
+typedef struct {
+    int a, b; // a < b
+    int tri;
+} edge_t;
+
+static void quadric_add_plane(quadric_t* quadric, const double a, const double b, const double c, const double d, const double weight) {
+    double* q = quadric->q;
+    q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * d;
+    q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * d;
+    q[7] += weight * c * c; q[8] += weight * c * d;
+    q[9] += weight * d * d;
+}
+
+static double quadric_error(const quadric_t* a, const quadric_t* b, const vec3_t p) {
+    double q[10];
+    for (int i = 0; i < 10; ++i) {
+        q[i] = a->q[i] + b->q[i];
+    }
+    const double x = p.x, y = p.y, z = p.z;
+    const double error = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+                       + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+                       + q[7] * z * z + 2.0 * q[8] * z
+                       + q[9];
+    return error > 0.0 ? error : 0.0;
+}
+
+static vec3_t face_cross(const mesh_t* mesh, const int v0, const int v1, const int v2) {
+    const vec3_t p0 = mesh->vertices[v0];
+    return vec3_cross(vec3_diff(mesh->vertices[v1], p0), vec3_diff(mesh->vertices[v2], p0));
+}
+
+static bool tri_has(const triangle_t* t, const int v) {
+    return t->v[0] == v || t->v[1] == v || t->v[2] == v;
+}
+
+static bool push_vertex_tri(vertex_tris_t* list, const int tri) {
+    if (list->count == list->capacity) {
+        const int capacity = list->capacity > 0 ? list->capacity * 2 : 8;
+        int* tris = realloc(list->tris, capacity * sizeof(int));
+        if (tris == NULL)
+            return false;
+        list->tris = tris;
+        list->capacity = capacity;
+    }
+    list->tris[list->count++] = tri;
+    return true;
+}
+
+static bool heap_push(simplifier_t* s, const collapse_t collapse) {
+    if (s->heap_count == s->heap_capacity) {
+        const int capacity = s->heap_capacity > 0 ? s->heap_capacity * 2 : 1024;
+        collapse_t* heap = realloc(s->heap, capacity * sizeof(collapse_t));
+        if (heap == NULL)
+            return false;
+        s->heap = heap;
+        s->heap_capacity = capacity;
+    }
+
+    int i = s->heap_count++;
+    while (i > 0 && s->heap[(i - 1) / 2].cost > collapse.cost) {
+        s->heap[i] = s->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    s->heap[i] = collapse;
+    return true;
+}
+
+static collapse_t heap_pop(simplifier_t* s) {
+    const collapse_t top = s->heap[0];
+    const collapse_t last = s->heap[--s->heap_count];
+
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->heap_count)
+            break;
+        if (child + 1 < s->heap_count && s->heap[child + 1].cost < s->heap[child].cost)
+            ++child;
+        if (s->heap[child].cost >= last.cost)
+            break;
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if (s->heap_count > 0) {
+        s->heap[i] = last;
+    }
+    return top;
+}
+
+// The cheaper direction of collapsing the edge a-b
+static bool push_edge(simplifier_t* s, const int a, const int b) {
+    const vec3_t pa = s->mesh->vertices[a];
+    const vec3_t pb = s->mesh->vertices[b];
+    const double onto_b = quadric_error(&s->quadrics[a], &s->quadrics[b], pb);
+    const double onto_a = quadric_error(&s->quadrics[a], &s->quadrics[b], pa);
+
+    const int from = onto_b <= onto_a ? a : b;
+    const int to = onto_b <= onto_a ? b : a;
+    return heap_push(s, (collapse_t){ onto_b <= onto_a ? onto_b : onto_a, from, to, s->versions[from], s->versions[to] });
+}
+
+static int compare_edges(const void* x, const void* y) {
+    const edge_t* a = x;
+    const edge_t* b = y;
+    if (a->a != b->a)
+        return a->a < b->a ? -1 : 1;
+    if (a->b != b->b)
+        return a->b < b->b ? -1 : 1;
+    return a->tri - b->tri;
+}
+
+// Face planes into the quadrics of their corners, boundary planes into the ends of open edges, and every edge into
+// the heap
+static bool init_quadrics(simplifier_t* s) {
+    const mesh_t* mesh = s->mesh;
+    for (int i = 0; i < mesh->triangle_count; ++i) {
+        const triangle_t* t = &mesh->triangles[i];
+        const vec3_t cross = face_cross(mesh, t->v[0], t->v[1], t->v[2]);
+        const double length = sqrt((double)vec3_dot(cross, cross));
+        if (length <= 0.0)
+            continue;
+
+        const double a = cross.x / length, b = cross.y / length, c = cross.z / length;
+        const vec3_t p = mesh->vertices[t->v[0]];
+        const double d = -(a * p.x + b * p.y + c * p.z);
+        for (int j = 0; j < 3; ++j) {
+            quadric_add_plane(&s->quadrics[t->v[j]], a, b, c, d, 1.0);
+        }
+    }
+
+    edge_t* edges = malloc((size_t)mesh->triangle_count * 3 * sizeof(edge_t));
+    if (edges == NULL)
+        return false;
+
+    for (int i = 0; i < mesh->triangle_count; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            const int a = mesh->triangles[i].v[j];
+            const int b = mesh->triangles[i].v[(j + 1) % 3];
+            edges[i * 3 + j] = (edge_t){ a < b ? a : b, a < b ? b : a, i };
+        }
+    }
+    const int edge_count = mesh->triangle_count * 3;
+    qsort(edges, edge_count, sizeof(edge_t), compare_edges);
+
+    bool ok = true;
+    for (int i = 0; i < edge_count && ok;) {
+        int end = i + 1;
+        while (end < edge_count && edges[end].a == edges[i].a && edges[end].b == edges[i].b) {
+            ++end;
+        }
+
+        const edge_t* e = &edges[i];
+        if (end - i == 1 && e->a != e->b) {
+            // The plane through the open edge at right angles to its face
+            const triangle_t* t = &mesh->triangles[e->tri];
+            const vec3_t normal = face_cross(mesh, t->v[0], t->v[1], t->v[2]);
+            const vec3_t pa = mesh->vertices[e->a];
+            const vec3_t side = vec3_cross(vec3_diff(mesh->vertices[e->b], pa), normal);
+            const double length = sqrt((double)vec3_dot(side, side));
+            if (length > 0.0) {
+                const double a = side.x / length, b = side.y / length, c = side.z / length;
+                const double d = -(a * pa.x + b * pa.y + c * pa.z);
+                quadric_add_plane(&s->quadrics[e->a], a, b, c, d, LOD_BOUNDARY_WEIGHT);
+                quadric_add_plane(&s->quadrics[e->b], a, b, c, d, LOD_BOUNDARY_WEIGHT);
+            }
+        }
+        if (e->a != e->b) {
+            ok = push_edge(s, e->a, e->b);
+        }
+        i = end;
+    }
+
+    free(edges);
+    return ok;
+}
+
+// The uv (or normal) index a corner of from carrying attribute takes on moving to to: the one to's corner has in an
+// edge triangle whose from corner carries the same, or -1 when no edge triangle does, as across a uv seam
+static int moved_attribute(const simplifier_t* s, const int from, const int to, const int attribute, const bool uv) {
+    const vertex_tris_t* from_tris = &s->vertex_tris[from];
+    for (int i = 0; i < from_tris->count; ++i) {
+        const int tri = from_tris->tris[i];
+        const triangle_t* t = &s->tris[tri];
+        if (!s->tri_alive[tri] || !tri_has(t, to))
+            continue;
+        const int* attributes = uv ? t->uv : t->n;
+        for (int j = 0; j < 3; ++j) {
+            if (t->v[j] == from && attributes[j] == attribute) {
+                for (int k = 0; k < 3; ++k) {
+                    if (t->v[k] == to) return attributes[k];
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+// Collapsing must neither pinch the surface, which takes more shared neighbors than the triangles on the edge
+// account for, turn any remaining triangle of from over once its corner moves to to, nor drag a uv seam across
+// the triangles between its sides
+static bool can_collapse(simplifier_t* s, const int from, const int to) {
+    const vertex_tris_t* from_tris = &s->vertex_tris[from];
+    const vertex_tris_t* to_tris = &s->vertex_tris[to];
+
+    s->stamp++;
+    int edge_tris = 0;
+    for (int i = 0; i < from_tris->count; ++i) {
+        const int tri = from_tris->tris[i];
+        if (!s->tri_alive[tri])
+            continue;
+        const triangle_t* t = &s->tris[tri];
+        if (tri_has(t, to)) {
+            edge_tris++;
+            continue;
+        }
+        for (int j = 0; j < 3; ++j) {
+            s->stamps[t->v[j]] = s->stamp;
+        }
+
+        for (int j = 0; j < 3; ++j) {
+            if (t->v[j] == from && moved_attribute(s, from, to, t->uv[j], true) < 0)
+                return false;
+        }
+
+        const vec3_t before = face_cross(s->mesh, t->v[0], t->v[1], t->v[2]);
+        const int v0 = t->v[0] == from ? to : t->v[0];
+        const int v1 = t->v[1] == from ? to : t->v[1];
+        const int v2 = t->v[2] == from ? to : t->v[2];
+        const vec3_t after = face_cross(s->mesh, v0, v1, v2);
+        if (vec3_dot(before, after) <= 0.0f)
+            return false;
+    }
+    // The edge's own triangles' third corners are shared neighbors too
+    for (int i = 0; i < from_tris->count; ++i) {
+        const int tri = from_tris->tris[i];
+        if (s->tri_alive[tri] && tri_has(&s->tris[tri], to)) {
+            for (int j = 0; j < 3; ++j) {
+                s->stamps[s->tris[tri].v[j]] = s->stamp;
+            }
+        }
+    }
+
+    s->stamp++;
+    int shared = 0;
+    for (int i = 0; i < to_tris->count; ++i) {
+        const int tri = to_tris->tris[i];
+        if (!s->tri_alive[tri])
+            continue;
+        for (int j = 0; j < 3; ++j) {
+            const int v = s->tris[tri].v[j];
+            if (v != from && v != to && s->stamps[v] == s->stamp - 1) {
+                shared++;
+                s->stamps[v] = s->stamp; // counted once
+            }
+        }
+    }
+    return shared <= edge_tris;
+}
+
+static bool collapse(simplifier_t* s, const int from, const int to) {
+    vertex_tris_t* from_tris = &s->vertex_tris[from];
+    vertex_tris_t* to_tris = &s->vertex_tris[to];
+
+    // Drop the dead triangles before taking over from's
+    int kept = 0;
+    for (int i = 0; i < to_tris->count; ++i) {
+        if (s->tri_alive[to_tris->tris[i]]) {
+            to_tris->tris[kept++] = to_tris->tris[i];
+        }
+    }
+    to_tris->count = kept;
+
+    // Moved corners take to's uv and normal on their side of the edge, which the edge's triangles tell while they
+    // are still alive. A split normal to has none for, like a face normal of a hard edge, stays as it was.
+    for (int i = 0; i < from_tris->count; ++i) {
+        const int tri = from_tris->tris[i];
+        triangle_t* t = &s->tris[tri];
+        if (!s->tri_alive[tri] || tri_has(t, to))
+            continue;
+        for (int j = 0; j < 3; ++j) {
+            if (t->v[j] != from)
+                continue;
+            const int uv = moved_attribute(s, from, to, t->uv[j], true);
+            const int n = moved_attribute(s, from, to, t->n[j], false);
+            t->uv[j] = uv >= 0 ? uv : t->uv[j];
+            t->n[j] = n >= 0 ? n : t->n[j];
+        }
+    }
+
+    for (int i = 0; i < from_tris->count; ++i) {
+        const int tri = from_tris->tris[i];
+        if (!s->tri_alive[tri])
+            continue;
+        triangle_t* t = &s->tris[tri];
+        if (tri_has(t, to)) {
+            s->tri_alive[tri] = false;
+            s->tris_alive--;
+            continue;
+        }
+        for (int j = 0; j < 3; ++j) {
+            if (t->v[j] == from) t->v[j] = to;
+        }
+        if (!push_vertex_tri(to_tris, tri))
+            return false;
+    }
+
+    for (int i = 0; i < 10; ++i) {
+        s->quadrics[to].q[i] += s->quadrics[from].q[i];
+    }
+    s->vertex_alive[from] = false;
+    s->versions[to]++;
+    free(from_tris->tris);
+    *from_tris = (vertex_tris_t){0};
+
+    // Every edge around to changed cost
+    s->stamp++;
+    for (int i = 0; i < to_tris->count; ++i) {
+        const triangle_t* t = &s->tris[to_tris->tris[i]];
+        for (int j = 0; j < 3; ++j) {
+            const int v = t->v[j];
+            if (v == to || s->stamps[v] == s->stamp)
+                continue;
+            s->stamps[v] = s->stamp;
+            if (!push_edge(s, to, v))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Collapses the cheapest edges until at most target triangles are left or nothing more can go
+static bool simplify(simplifier_t* s, const int target) {
+    while (s->tris_alive > target && s->heap_count > 0) {
+        const collapse_t c = heap_pop(s);
+        if (!s->vertex_alive[c.from] || !s->vertex_alive[c.to] ||
+            s->versions[c.from] != c.from_version || s->versions[c.to] != c.to_version)
+            continue;
+        if (!can_collapse(s, c.from, c.to))
+            continue;
+        if (!collapse(s, c.from, c.to))
+            return false;
+        if (c.cost > s->max_cost) {
+            s->max_cost = c.cost;
+        }
+    }
+    return true;
+}
+
+// Index of each used element in the level's compacted copy, -1 for the unused ones
+static int compact(int* remap, const int count) {
+    int used = 0;
+    for (int i = 0; i < count; ++i) {
+        if (remap[i] >= 0) {
+            remap[i] = used++;
+        }
+    }
+    return used;
+}
+
+// The surviving triangles as a mesh of their own, with only the vertices, normals and uvs they use
+static bool snapshot(const simplifier_t* s, mesh_t* lod) {
+    const mesh_t* mesh = s->mesh;
+    int* v_remap = malloc(mesh->vertex_count * sizeof(int));
+    int* n_remap = malloc(mesh->normals_count * sizeof(int));
+    int* uv_remap = malloc(mesh->uvs_count * sizeof(int));
+    if (v_remap == NULL || n_remap == NULL || uv_remap == NULL) {
+        free(v_remap);
+        free(n_remap);
+        free(uv_remap);
+        return false;
+    }
+    memset(v_remap, -1, mesh->vertex_count * sizeof(int));
+    memset(n_remap, -1, mesh->normals_count * sizeof(int));
+    memset(uv_remap, -1, mesh->uvs_count * sizeof(int));
+
+    for (int i = 0; i < mesh->triangle_count; ++i) {
+        if (!s->tri_alive[i])
+            continue;
+        for (int j = 0; j < 3; ++j) {
+            v_remap[s->tris[i].v[j]] = 0;
+            n_remap[s->tris[i].n[j]] = 0;
+            uv_remap[s->tris[i].uv[j]] = 0;
+        }
+    }
+
+    *lod = (mesh_t){0};
+    lod->vertex_count = compact(v_remap, mesh->vertex_count);
+    lod->normals_count = compact(n_remap, mesh->normals_count);
+    lod->uvs_count = compact(uv_remap, mesh->uvs_count);
+    lod->triangle_count = s->tris_alive;
+    lod->lod_error = (float)sqrt(s->max_cost);
+
+    lod->vertices = malloc(lod->vertex_count * sizeof(vec3_t));
+    lod->normals = malloc(lod->normals_count * sizeof(vec3_t));
+    lod->uvs = malloc(lod->uvs_count * sizeof(vec2_t));
+    lod->triangles = malloc(lod->triangle_count * sizeof(triangle_t));
+    lod->transformed_vertices = calloc(lod->vertex_count, sizeof(vec3_t));
+    lod->transformed_normals = calloc(lod->normals_count, sizeof(vec3_t));
+    const bool ok = lod->vertices != NULL && lod->normals != NULL && lod->uvs != NULL && lod->triangles != NULL &&
+                    lod->transformed_vertices != NULL && lod->transformed_normals != NULL;
+
+    if (ok) {
+        for (int i = 0; i < mesh->vertex_count; ++i) {
+            if (v_remap[i] >= 0) lod->vertices[v_remap[i]] = mesh->vertices[i];
+        }
+        for (int i = 0; i < mesh->normals_count; ++i) {
+            if (n_remap[i] >= 0) lod->normals[n_remap[i]] = mesh->normals[i];
+        }
+        for (int i = 0; i < mesh->uvs_count; ++i) {
+            if (uv_remap[i] >= 0) lod->uvs[uv_remap[i]] = mesh->uvs[i];
+        }
+
+        int count = 0;
+        for (int i = 0; i < mesh->triangle_count; ++i) {
+            if (!s->tri_alive[i])
+                continue;
+            triangle_t* t = &lod->triangles[count++];
+            for (int j = 0; j < 3; ++j) {
+                t->v[j] = v_remap[s->tris[i].v[j]];
+                t->n[j] = n_remap[s->tris[i].n[j]];
+                t->uv[j] = uv_remap[s->tris[i].uv[j]];
+            }
+        }
+
+        lod->vertices_soa = make_vec3_soa(lod->vertices, lod->vertex_count);
+        lod->normals_soa = make_vec3_soa(lod->normals, lod->normals_count);
+        build_mesh_bounds(lod);
+    }
+    else {
+        free(lod->vertices);
+        free(lod->normals);
+        free(lod->uvs);
+        free(lod->triangles);
+        free(lod->transformed_vertices);
+        free(lod->transformed_normals);
+        *lod = (mesh_t){0};
+    }
+
+    free(v_remap);
+    free(n_remap);
+    free(uv_remap);
+    return ok;
+}
+
+static void free_simplifier(simplifier_t* s) {
+    if (s->vertex_tris != NULL) {
+        for (int i = 0; i < s->mesh->vertex_count; ++i) {
+            free(s->vertex_tris[i].tris);
+        }
+    }
+    free(s->quadrics);
+    free(s->vertex_tris);
+    free(s->versions);
+    free(s->vertex_alive);
+    free(s->stamps);
+    free(s->tris);
+    free(s->tri_alive);
+    free(s->heap);
+}
+
+int build_mesh_lods(const mesh_t* mesh, mesh_t* lods, const int max_lods) {
+    if (max_lods <= 0 || mesh->triangle_count < 2 * MESH_LOD_MIN_TRIANGLES)
+        return 0;
+
+    simplifier_t s = {0};
+    s.mesh = mesh;
+    s.quadrics = calloc(mesh->vertex_count, sizeof(quadric_t));
+    s.vertex_tris = calloc(mesh->vertex_count, sizeof(vertex_tris_t));
+    s.versions = calloc(mesh->vertex_count, sizeof(int));
+    s.vertex_alive = malloc(mesh->vertex_count * sizeof(bool));
+    s.stamps = calloc(mesh->vertex_count, sizeof(int));
+    s.tris = malloc(mesh->triangle_count * sizeof(triangle_t));
+    s.tri_alive = malloc(mesh->triangle_count * sizeof(bool));
+    s.tris_alive = mesh->triangle_count;
+
+    bool ok = s.quadrics != NULL && s.vertex_tris != NULL && s.versions != NULL && s.vertex_alive != NULL &&
+              s.stamps != NULL && s.tris != NULL && s.tri_alive != NULL;
+    if (ok) {
+        memcpy(s.tris, mesh->triangles, mesh->triangle_count * sizeof(triangle_t));
+        for (int i = 0; i < mesh->vertex_count; ++i) {
+            s.vertex_alive[i] = true;
+        }
+        for (int i = 0; i < mesh->triangle_count && ok; ++i) {
+            const triangle_t* t = &mesh->triangles[i];
+            s.tri_alive[i] = t->v[0] != t->v[1] && t->v[1] != t->v[2] && t->v[2] != t->v[0];
+            if (!s.tri_alive[i]) {
+                s.tris_alive--;
+                continue;
+            }
+            for (int j = 0; j < 3 && ok; ++j) {
+                ok = push_vertex_tri(&s.vertex_tris[t->v[j]], i);
+            }
+        }
+    }
+    ok = ok && init_quadrics(&s);
+
+    // One run of collapses, every level is a snapshot along the way so their errors only grow
+    int count = 0;
+    int previous = mesh->triangle_count;
+    while (ok && count < max_lods && previous / 2 >= MESH_LOD_MIN_TRIANGLES) {
+        ok = simplify(&s, previous / 2);
+        if (!ok || (float)s.tris_alive > LOD_MIN_REDUCTION * (float)previous)
+            break;
+        ok = snapshot(&s, &lods[count]);
+        if (ok) {
+            previous = lods[count++].triangle_count;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate the mesh simplifier, kept %d levels of detail.\n", count);
+    }
+
+    free_simplifier(&s);
+    return count;
+}
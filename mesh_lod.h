@@ -0,0 +1,19 @@
+﻿#ifndef SOFTWARE_RENDERER_C_MESH_LOD_H
+#define SOFTWARE_RENDERER_C_MESH_LOD_H
+
+#include "mesh.h"
+
+// Levels of a LOD chain, the full mesh included
+#define MESH_MAX_LODS 6
+// Meshes and levels below this many triangles aren't simplified further
+#define MESH_LOD_MIN_TRIANGLES 64
+
+// Simplifies mesh with quadric error metrics into up to max_lods coarser meshes, each with about half the
+// triangles of the one before. Vertices only ever collapse onto one another, so every level keeps the mesh's own
+// positions, normals and uvs, a moved corner taking those of the vertex it lands on. Edges whose collapse would fold
+// a triangle over, pinch the surface or tear a uv seam are skipped.
+// Stops early when a level can't get below MESH_LOD_MIN_TRIANGLES or barely simplifies. Each level's lod_error
+// estimates how far its surface strayed from the mesh. Returns the number of levels written to lods.
+int build_mesh_lods(const mesh_t* mesh, mesh_t* lods, int max_lods);
+
+#endif //SOFTWARE_RENDERER_C_MESH_LOD_H
@@ -1,36 +1,219 @@
-﻿#include "model.h"
+﻿#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "model.h"
 
 #include "matrix.h"
+#include "profiler.h"
+
+_Static_assert(COUNTER_LOD5_TRIANGLES - COUNTER_LOD0_TRIANGLES + 1 == MESH_MAX_LODS, "one triangle counter per level of detail");
+
+void transform_vertices(vec3_t* transformed, const vec3_t* original, const vec3_soa_t* soa, const int count, const mat4x4_t* mat) {
+    if (soa->x != NULL) {
+        mat4_mul_vec3_batch(mat, soa->x, soa->y, soa->z, count, transformed);
+        return;
+    }
 
-void transform_vertices(vec3_t* transformed, const vec3_t* original, const int count, const mat4x4_t* mat) {
     for (int i = 0; i < count; ++i) {
         transformed[i] = mat4_mul_vec3(mat, original[i]);
     }
 }
 
-void apply_transformations(const model_t* model, const camera_t* camera) {
-    const mat4x4_t trans_mat = make_translation_matrix(model->translation.x, model->translation.y, model->translation.z);
-    const mat4x4_t rot_mat   = make_rotation_matrix(model->rotation.x, model->rotation.y, model->rotation.z);
-    const mat4x4_t scale_mat = make_scale_matrix(model->scale, model->scale, model->scale);
+static float sphere_distance(const vec3_t center, const float radius) {
+    return sqrtf(vec3_dot(center, center)) - radius;
+}
+
+static int compare_cluster_order(const void* a, const void* b) {
+    const mesh_cluster_order_t* x = a;
+    const mesh_cluster_order_t* y = b;
+    if (x->distance != y->distance)
+        return x->distance < y->distance ? -1 : 1;
+    return x->cluster - y->cluster;
+}
+
+static void transform_clusters(const mesh_t* mesh, const mat4x4_t* mv_mat, const float scale) {
+    const vec3_t origin = mat4_mul_vec3(mv_mat, (vec3_t){0.0f, 0.0f, 0.0f});
+    // Normals keep their direction under a negative uniform scale, the cross products flip twice
+    const float axis_sign = scale < 0.0f ? -1.0f : 1.0f;
+
+    for (int i = 0; i < mesh->cluster_count; ++i) {
+        const cluster_bounds_t* bounds = &mesh->clusters[i].bounds;
+        cluster_bounds_t* out = &mesh->transformed_clusters[i];
+        out->center = mat4_mul_vec3(mv_mat, bounds->center);
+        out->radius = bounds->radius * fabsf(scale);
+        out->cone_axis = vec3_mul(vec3_normalize(vec3_diff(mat4_mul_vec3(mv_mat, bounds->cone_axis), origin)), axis_sign);
+        out->cone_cos = bounds->cone_cos;
+    }
+}
+
+bool apply_transformations(model_t* model, const camera_t* camera) {
+    if (!vec3_equal(model->translation, model->applied_translation) || !vec3_equal(model->rotation, model->applied_rotation) ||
+        model->scale != model->applied_scale) {
+        model->dirty |= MODEL_DIRTY_TRANSFORM;
+    }
+    if (camera->view_version != model->applied_view_version) {
+        model->dirty |= MODEL_DIRTY_VIEW;
+    }
+    if (model->dirty == 0)
+        return false;
+
+    if (model->dirty & MODEL_DIRTY_TRANSFORM) {
+        const mat4x4_t trans_mat = make_translation_matrix(model->translation.x, model->translation.y, model->translation.z);
+        const mat4x4_t rot_mat   = make_rotation_matrix(model->rotation.x, model->rotation.y, model->rotation.z);
+        const mat4x4_t scale_mat = make_scale_matrix(model->scale, model->scale, model->scale);
+
+        const mat4x4_t rs_mat = mat4_mul(&rot_mat, &scale_mat);
+        model->model_mat = mat4_mul(&trans_mat, &rs_mat);
+        model->applied_translation = model->translation;
+        model->applied_rotation = model->rotation;
+        model->applied_scale = model->scale;
+    }
+    if (model->dirty & (MODEL_DIRTY_TRANSFORM | MODEL_DIRTY_VIEW)) {
+        model->mv_mat = mat4_mul(&camera->view_mat, &model->model_mat);
+        model->normal_mat = mat4_normal_matrix(&model->mv_mat);
+        model->applied_view_version = camera->view_version;
+    }
+
+    const mat4x4_t* mv_mat = &model->mv_mat;
+    mesh_t* mesh = &model->lods[model->lod];
+    transform_vertices(mesh->transformed_vertices, mesh->vertices, &mesh->vertices_soa, mesh->vertex_count, mv_mat);
+    transform_vertices(mesh->transformed_normals, mesh->normals, &mesh->normals_soa, mesh->normals_count, &model->normal_mat);
+
+    model->view_center = mat4_mul_vec3(mv_mat, mesh->bounds_center);
+    model->view_radius = mesh->bounds_radius * fabsf(model->scale);
+
+    transform_clusters(mesh, mv_mat, model->scale);
+
+    model->dirty = 0;
+    PROFILE_COUNT(COUNTER_MODELS_TRANSFORMED, 1);
+    return true;
+}
+
+bool set_model_lod(model_t* model, const camera_t* camera, int lod) {
+    lod = lod < 0 ? 0 : lod >= model->lod_count ? model->lod_count - 1 : lod;
+    if (lod == model->lod)
+        return false;
+
+    model->lod = lod;
+    model->dirty |= MODEL_DIRTY_VERTICES;
+    apply_transformations(model, camera);
+    return true;
+}
+
+// Size on screen of the simplification error of a level, as the fraction of the bounding sphere it makes up
+static float lod_pixel_error(const model_t* model, const int level, const float sphere_pixels) {
+    return model->lods[level].lod_error / model->lods[0].bounds_radius * sphere_pixels;
+}
+
+int model_lod_for_sphere(const model_t* model, int level, const vec3_t view_center, const float view_radius,
+                         const mat4x4_t* proj_mat, const projection_type proj_type, const int target_height) {
+    if (model->lod_count <= 1 || model->lods[0].bounds_radius <= 0.0f)
+        return 0;
+
+    // Radius of the bounding sphere in pixels, a camera inside the sphere sees it too close to simplify
+    float sphere_pixels = view_radius * proj_mat->m[1][1] * 0.5f * (float)target_height;
+    if (proj_type == PERSPECTIVE) {
+        const vec4_t clip = mat4x4_mul_vec4(proj_mat, (vec4_t){ view_center.x, view_center.y, view_center.z, 1.0f });
+        sphere_pixels = clip.w > view_radius ? sphere_pixels / clip.w : FLT_MAX;
+    }
+
+    while (level > 0 && lod_pixel_error(model, level, sphere_pixels) > MODEL_LOD_PIXEL_ERROR) {
+        level--;
+    }
+    while (level + 1 < model->lod_count &&
+           lod_pixel_error(model, level + 1, sphere_pixels) <= MODEL_LOD_PIXEL_ERROR * (1.0f - MODEL_LOD_HYSTERESIS)) {
+        level++;
+    }
+    return level;
+}
+
+bool select_model_lod(model_t* model, const camera_t* camera, const mat4x4_t* proj_mat, const projection_type proj_type, const int target_height) {
+    if (model->lod_count <= 1 || model->lods[0].bounds_radius <= 0.0f)
+        return false;
 
-    const mat4x4_t rs_mat    = mat4_mul(&rot_mat, &scale_mat);
-    const mat4x4_t model_mat = mat4_mul(&trans_mat, &rs_mat);
-    const mat4x4_t view_mat  = make_view_matrix(camera->position, camera->target);
-    const mat4x4_t mv_mat    = mat4_mul(&view_mat, &model_mat);
+    const int level = model_lod_for_sphere(model, model->lod, model->view_center, model->view_radius, proj_mat, proj_type, target_height);
+    return set_model_lod(model, camera, level);
+}
+
+void sort_models_front_to_back(model_t** models, const int count) {
+    for (int i = 1; i < count; ++i) {
+        model_t* model = models[i];
+        const float distance = sphere_distance(model->view_center, model->view_radius);
 
-    transform_vertices(model->mesh.transformed_vertices, model->mesh.vertices, model->mesh.vertex_count, &mv_mat);
-    transform_vertices(model->mesh.transformed_normals, model->mesh.normals, model->mesh.normals_count, &mv_mat);
+        int j = i;
+        for (; j > 0 && sphere_distance(models[j - 1]->view_center, models[j - 1]->view_radius) > distance; --j) {
+            models[j] = models[j - 1];
+        }
+        models[j] = model;
+    }
+}
+
+int model_visible_triangles(
+    model_t* model,
+    const mat4x4_t* proj_mat,
+    const projection_type proj_type,
+    const bool cull_back_faces,
+    const bool front_to_back,
+    const triangle_t** triangles)
+{
+    mesh_t* mesh = &model->lods[model->lod];
+    *triangles = mesh->triangles;
+    if (mesh->cluster_count == 0)
+        return mesh->triangle_count;
+
+    int visible_count = 0;
+    int culled_triangles = 0;
+    for (int i = 0; i < mesh->cluster_count; ++i) {
+        const cluster_bounds_t* bounds = &mesh->transformed_clusters[i];
+        if (is_cluster_culled(bounds, proj_mat, proj_type, cull_back_faces)) {
+            culled_triangles += mesh->clusters[i].triangle_count;
+            continue;
+        }
+        mesh->cluster_order[visible_count++] = (mesh_cluster_order_t){ sphere_distance(bounds->center, bounds->radius), i };
+    }
+    PROFILE_COUNT(COUNTER_CLUSTERS_CULLED, mesh->cluster_count - visible_count);
+    PROFILE_COUNT(COUNTER_CLUSTER_TRIANGLES_CULLED, culled_triangles);
+
+    // Everything survived in file order, draw straight from the mesh
+    if (visible_count == mesh->cluster_count && !front_to_back)
+        return mesh->triangle_count;
+
+    if (front_to_back) {
+        qsort(mesh->cluster_order, visible_count, sizeof(mesh_cluster_order_t), compare_cluster_order);
+    }
+
+    triangle_t* out = mesh->draw_triangles;
+    for (int i = 0; i < visible_count; ++i) {
+        const mesh_cluster_t* cluster = &mesh->clusters[mesh->cluster_order[i].cluster];
+        memcpy(out, mesh->triangles + cluster->first_triangle, cluster->triangle_count * sizeof(triangle_t));
+        out += cluster->triangle_count;
+    }
+    *triangles = mesh->draw_triangles;
+    return (int)(out - mesh->draw_triangles);
 }
 
 model_t load_model(const char *mesh_path, const char *texture_path, const uint32_t color, const uint32_t wire_color) {
-    const model_t model = {
-        .mesh = load_mesh_from_obj(mesh_path),
+    model_t model = {
         .texture = load_texture_from_file(texture_path),
         .color = color,
         .wire_color = wire_color,
         .translation = {0.0f, 0.0f, 0.0f},
         .rotation = {0.0f, 0.0f, 0.0f},
-        .scale = 1.0f
+        .scale = 1.0f,
+        .sort_clusters = false,
+        .dirty = MODEL_DIRTY_ALL
     };
+    model.lods[0] = load_mesh_from_obj(mesh_path);
+    model.lod_count = 1 + build_mesh_lods(&model.lods[0], &model.lods[1], MESH_MAX_LODS - 1);
     return model;
+}
+
+void free_model(model_t* model) {
+    for (int i = 0; i < model->lod_count; ++i) {
+        free_mesh(&model->lods[i]);
+    }
+    free_texture(&model->texture);
+    model->lod_count = 0;
+    model->lod = 0;
 }
\ No newline at end of file
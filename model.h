@@ -2,20 +2,93 @@
 #define SOFTWARE_RENDERER_C_MODEL_H
 
 #include "camera.h"
+#include "draw.h"
 #include "mesh.h"
+#include "mesh_lod.h"
 #include "texture.h"
 
+// A level of detail is picked once its simplification error covers at most this many pixels on screen, and the
+// model only drops to a coarser level when the error stays below (1 - MODEL_LOD_HYSTERESIS) of that, so a model
+// sitting at a threshold doesn't flip between two levels every frame
+#define MODEL_LOD_PIXEL_ERROR 1.0f
+#define MODEL_LOD_HYSTERESIS 0.3f
+
+// What apply_transformations has to redo. It notices moved models and a rebuilt camera view by itself, code
+// changing the mesh under a model sets MODEL_DIRTY_VERTICES.
+typedef enum {
+    MODEL_DIRTY_TRANSFORM = 1 << 0, // translation, rotation or scale
+    MODEL_DIRTY_VIEW      = 1 << 1,
+    MODEL_DIRTY_VERTICES  = 1 << 2,
+    MODEL_DIRTY_ALL       = MODEL_DIRTY_TRANSFORM | MODEL_DIRTY_VIEW | MODEL_DIRTY_VERTICES
+} model_dirty_flags;
+
 typedef struct {
-    mesh_t mesh;
+    mesh_t lods[MESH_MAX_LODS]; // lods[0] is the loaded mesh and the rest its simplifications, see build_mesh_lods
+    int lod_count;
+    int lod;                    // the level transformed and drawn, see select_model_lod
     texture_t texture;
     uint32_t color;
     uint32_t wire_color;
     vec3_t translation;
     vec3_t rotation;
     float scale;
+
+    // Draws the visible clusters of the mesh front to back, see model_visible_triangles
+    bool sort_clusters;
+
+    // View space bounding sphere, updated by apply_transformations
+    vec3_t view_center;
+    float view_radius;
+
+    // Cached by apply_transformations along with the pose and camera view they were built from
+    unsigned int dirty;
+    mat4x4_t model_mat;
+    mat4x4_t mv_mat;
+    mat4x4_t normal_mat; // of mv_mat, takes the mesh normals to view space
+    vec3_t applied_translation;
+    vec3_t applied_rotation;
+    float applied_scale;
+    unsigned int applied_view_version;
 } model_t;
 
+// mat4_mul_vec3 over count points, through the structure of arrays copy when soa has one
+void transform_vertices(vec3_t* transformed, const vec3_t* original, const vec3_soa_t* soa, int count, const mat4x4_t* mat);
+
+static inline const mesh_t* model_mesh(const model_t* model) {
+    return &model->lods[model->lod];
+}
+
 model_t load_model(const char* mesh_path, const char* texture_path, uint32_t color, uint32_t wire_color);
-void apply_transformations(const model_t* model, const camera_t* camera);
+// Frees the whole LOD chain and the texture, instance batches drawing the model must be freed first
+void    free_model(model_t* model);
+// Brings the view space vertices, normals and bounds up to date with the model's pose and the camera, doing
+// nothing for a model that didn't move under a camera that didn't either. Returns true when anything changed.
+bool apply_transformations(model_t* model, const camera_t* camera);
+
+// Switches to level lod, clamped to the chain, and transforms it right away. Returns true when it changed.
+bool set_model_lod(model_t* model, const camera_t* camera, int lod);
+
+// Picks the level of detail for the model's projected bounding sphere on a target target_height pixels tall, from
+// the sphere apply_transformations left, and transforms the new level right away. Returns true when it changed.
+bool select_model_lod(model_t* model, const camera_t* camera, const mat4x4_t* proj_mat, projection_type proj_type, int target_height);
+
+// The level of detail select_model_lod would move to from level for a copy of the model bounded by the view space
+// sphere at view_center of view_radius
+int model_lod_for_sphere(const model_t* model, int level, vec3_t view_center, float view_radius,
+                         const mat4x4_t* proj_mat, projection_type proj_type, int target_height);
+
+// Stable sort by the distance to the nearest point of each model's bounding sphere
+void sort_models_front_to_back(model_t** models, int count);
+
+// Culls whole clusters against the frustum, and the back-facing ones when cull_back_faces is set, and points
+// triangles at the rest, sorted front to back when front_to_back is set. Returns the number of triangles. The
+// triangles may live in the drawn level's per-mesh scratch, which the next call for the model overwrites.
+int model_visible_triangles(
+    model_t* model,
+    const mat4x4_t* proj_mat,
+    projection_type proj_type,
+    bool cull_back_faces,
+    bool front_to_back,
+    const triangle_t** triangles);
 
 #endif //SOFTWARE_RENDERER_C_MODEL_H
\ No newline at end of file
@@ -0,0 +1,225 @@
+﻿#include <stdio.h>
+#include "profiler.h"
+
+#ifdef RENDERER_PROFILE
+
+#define MAX_FRAME_EVENTS 256
+
+typedef struct {
+    profile_stage stage;
+    Uint64 start;
+    Uint64 end;
+} profile_event_t;
+
+static const char* stage_names[PROFILE_STAGE_COUNT] = {
+    "apply_transformations",
+    "clear_z_buffer",
+    "sdl_gfx_clear",
+    "bin_lights",
+    "draw_shadow_depth",
+    "draw_depth_only",
+    "draw_wireframe",
+    "draw_unlit",
+    "draw_flat_shaded",
+    "draw_phong_shaded",
+    "draw_textured_unlit",
+    "draw_textured_flat_shaded",
+    "draw_textured_phong_shaded",
+    "resolve_gbuffer",
+    "sdl_gfx_render"
+};
+
+static const char* counter_names[PROFILE_COUNTER_COUNT] = {
+    "models_transformed",
+    "instances_culled",
+    "clusters_culled",
+    "cluster_triangles_culled",
+    "triangles_submitted",
+    "lod0_triangles",
+    "lod1_triangles",
+    "lod2_triangles",
+    "lod3_triangles",
+    "lod4_triangles",
+    "lod5_triangles",
+    "backface_culled",
+    "frustum_rejected",
+    "triangles_clipped",
+    "hiz_rejected",
+    "pixels_depth_tested",
+    "pixels_written",
+    "light_tile_entries",
+    "shadow_maps_drawn"
+};
+
+static SDL_AtomicInt counters[PROFILE_COUNTER_COUNT];
+static profile_frame_t current;
+static profile_frame_t last;
+static profile_event_t events[MAX_FRAME_EVENTS];
+static int events_count;
+
+static Uint64 epoch;
+static Uint64 frame_start;
+static int frame_index;
+static float render_scale = 1.0f;
+
+static FILE* csv_file;
+static FILE* trace_file;
+static bool trace_has_events;
+
+static double ticks_to_ms(const Uint64 ticks) {
+    return (double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static double ticks_to_us(const Uint64 ticks) {
+    return (double)ticks * 1000000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+void profiler_begin_frame(void) {
+    frame_start = SDL_GetPerformanceCounter();
+    if (epoch == 0) {
+        epoch = frame_start;
+    }
+
+    current = (profile_frame_t){0};
+    current.frame_index = frame_index;
+    current.render_scale = render_scale;
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i) {
+        SDL_SetAtomicInt(&counters[i], 0);
+    }
+    events_count = 0;
+}
+
+void profiler_add_stage(const profile_stage stage, const Uint64 start, const Uint64 end) {
+    current.stage_ms[stage] += ticks_to_ms(end - start);
+    current.stage_calls[stage]++;
+
+    if (events_count < MAX_FRAME_EVENTS) {
+        events[events_count++] = (profile_event_t){ stage, start, end };
+    }
+}
+
+void profiler_add_counter(const profile_counter counter, const int amount) {
+    if (amount != 0) {
+        SDL_AddAtomicInt(&counters[counter], amount);
+    }
+}
+
+void profiler_set_render_scale(const float scale) {
+    render_scale = scale;
+    current.render_scale = scale;
+}
+
+static void write_csv_row(const profile_frame_t* frame) {
+    if (ftell(csv_file) == 0) {
+        fprintf(csv_file, "frame,frame_ms,render_scale");
+        for (int i = 0; i < PROFILE_STAGE_COUNT; ++i) {
+            fprintf(csv_file, ",%s_ms", stage_names[i]);
+        }
+        for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i) {
+            fprintf(csv_file, ",%s", counter_names[i]);
+        }
+        fprintf(csv_file, "\n");
+    }
+
+    fprintf(csv_file, "%d,%.4f,%.4f", frame->frame_index, frame->frame_ms, frame->render_scale);
+    for (int i = 0; i < PROFILE_STAGE_COUNT; ++i) {
+        fprintf(csv_file, ",%.4f", frame->stage_ms[i]);
+    }
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i) {
+        fprintf(csv_file, ",%d", frame->counters[i]);
+    }
+    fprintf(csv_file, "\n");
+}
+
+static void write_trace_event(const char* name, const char ph, const Uint64 start, const Uint64 end) {
+    fprintf(trace_file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+        trace_has_events ? "," : "", name, ph, ticks_to_us(start - epoch), ticks_to_us(end - start));
+    trace_has_events = true;
+}
+
+static void write_trace_frame(const profile_frame_t* frame, const Uint64 frame_end) {
+    char name[32];
+    SDL_snprintf(name, sizeof(name), "frame %d", frame->frame_index);
+    write_trace_event(name, 'X', frame_start, frame_end);
+
+    for (int i = 0; i < events_count; ++i) {
+        write_trace_event(stage_names[events[i].stage], 'X', events[i].start, events[i].end);
+    }
+
+    fprintf(trace_file, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{", ticks_to_us(frame_end - epoch));
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i) {
+        fprintf(trace_file, "%s\"%s\":%d", i > 0 ? "," : "", counter_names[i], frame->counters[i]);
+    }
+    fprintf(trace_file, ",\"render_scale\":%.4f}}", frame->render_scale);
+}
+
+void profiler_end_frame(void) {
+    const Uint64 frame_end = SDL_GetPerformanceCounter();
+
+    current.frame_ms = ticks_to_ms(frame_end - frame_start);
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; ++i) {
+        current.counters[i] = SDL_GetAtomicInt(&counters[i]);
+    }
+
+    if (csv_file != NULL) {
+        write_csv_row(&current);
+    }
+    if (trace_file != NULL) {
+        write_trace_frame(&current, frame_end);
+    }
+
+    last = current;
+    frame_index++;
+}
+
+const profile_frame_t* profiler_last_frame(void) {
+    return &last;
+}
+
+bool profiler_open_csv(const char* path) {
+    csv_file = fopen(path, "w");
+    if (csv_file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing.\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool profiler_open_trace(const char* path) {
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing.\n", path);
+        return false;
+    }
+    fprintf(trace_file, "[");
+    trace_has_events = false;
+    return true;
+}
+
+void profiler_close(void) {
+    if (csv_file != NULL) {
+        fclose(csv_file);
+        csv_file = NULL;
+    }
+    if (trace_file != NULL) {
+        fprintf(trace_file, "\n]\n");
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+void profiler_format_hud(char* text, const size_t size) {
+    const profile_frame_t* f = &last;
+
+    int len = SDL_snprintf(text, size, "frame %d  %.2f ms\n", f->frame_index, f->frame_ms);
+    for (int i = 0; i < PROFILE_STAGE_COUNT && len >= 0 && (size_t)len < size; ++i) {
+        if (f->stage_calls[i] == 0)
+            continue;
+        len += SDL_snprintf(text + len, size - len, "%-27s %7.3f ms\n", stage_names[i], f->stage_ms[i]);
+    }
+    for (int i = 0; i < PROFILE_COUNTER_COUNT && len >= 0 && (size_t)len < size; ++i) {
+        len += SDL_snprintf(text + len, size - len, "%-27s %10d\n", counter_names[i], f->counters[i]);
+    }
+}
+
+#endif
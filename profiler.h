@@ -0,0 +1,136 @@
+﻿#ifndef SOFTWARE_RENDERER_C_PROFILER_H
+#define SOFTWARE_RENDERER_C_PROFILER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <SDL3/SDL.h>
+
+// Per-stage frame timers and pipeline counters. Unless RENDERER_PROFILE is defined every macro below expands
+// to nothing and the functions are empty inlines, so the call sites cost nothing in regular builds.
+
+typedef enum {
+    PROFILE_TRANSFORM,
+    PROFILE_CLEAR_Z,
+    PROFILE_CLEAR_COLOR,
+    PROFILE_BIN_LIGHTS,
+    PROFILE_SHADOW_MAPS,
+    PROFILE_DEPTH_PREPASS,
+    PROFILE_DRAW_WIREFRAME,
+    PROFILE_DRAW_UNLIT,
+    PROFILE_DRAW_FLAT_SHADED,
+    PROFILE_DRAW_PHONG_SHADED,
+    PROFILE_DRAW_TEXTURED_UNLIT,
+    PROFILE_DRAW_TEXTURED_FLAT_SHADED,
+    PROFILE_DRAW_TEXTURED_PHONG_SHADED,
+    PROFILE_DEFERRED_RESOLVE, // nested in the Phong draw stages
+    PROFILE_PRESENT,
+    PROFILE_STAGE_COUNT
+} profile_stage;
+
+typedef enum {
+    COUNTER_MODELS_TRANSFORMED, // the rest kept last frame's view space vertices
+    COUNTER_INSTANCES_CULLED,
+    COUNTER_CLUSTERS_CULLED,
+    COUNTER_CLUSTER_TRIANGLES_CULLED,
+    COUNTER_TRIANGLES_SUBMITTED,
+    COUNTER_LOD0_TRIANGLES, // the submitted triangles by the level of detail they were drawn at
+    COUNTER_LOD1_TRIANGLES,
+    COUNTER_LOD2_TRIANGLES,
+    COUNTER_LOD3_TRIANGLES,
+    COUNTER_LOD4_TRIANGLES,
+    COUNTER_LOD5_TRIANGLES,
+    COUNTER_BACKFACE_CULLED,
+    COUNTER_FRUSTUM_REJECTED,
+    COUNTER_TRIANGLES_CLIPPED,
+    COUNTER_HIZ_REJECTED,
+    COUNTER_PIXELS_DEPTH_TESTED,
+    COUNTER_PIXELS_WRITTEN,
+    COUNTER_LIGHT_TILE_ENTRIES, // lights summed over the tiles they were binned to
+    COUNTER_SHADOW_MAPS_DRAWN,  // the rest were cached
+    PROFILE_COUNTER_COUNT
+} profile_counter;
+
+typedef struct {
+    int frame_index;
+    double frame_ms;
+    double stage_ms[PROFILE_STAGE_COUNT];
+    int stage_calls[PROFILE_STAGE_COUNT];
+    int counters[PROFILE_COUNTER_COUNT];
+    float render_scale; // internal resolution as a fraction of the window's, 1 unless it adapts to a frame budget
+} profile_frame_t;
+
+#ifdef RENDERER_PROFILE
+
+void profiler_begin_frame(void);
+void profiler_end_frame(void);
+void profiler_add_stage(profile_stage stage, Uint64 start, Uint64 end);
+void profiler_add_counter(profile_counter counter, int amount);
+void profiler_set_render_scale(float scale);
+
+// The last completed frame
+const profile_frame_t* profiler_last_frame(void);
+
+// Every completed frame is appended as a CSV row and/or as Chrome trace events (chrome://tracing, Perfetto)
+bool profiler_open_csv(const char* path);
+bool profiler_open_trace(const char* path);
+void profiler_close(void);
+
+void profiler_format_hud(char* text, size_t size);
+
+static inline int profile_popcount(unsigned int bits) {
+    int count = 0;
+    for (; bits != 0; bits &= bits - 1) {
+        ++count;
+    }
+    return count;
+}
+
+#define PROFILE_BEGIN(stage) const Uint64 profile_start_##stage = SDL_GetPerformanceCounter()
+#define PROFILE_END(stage) profiler_add_stage(stage, profile_start_##stage, SDL_GetPerformanceCounter())
+#define PROFILE_COUNT(counter, amount) profiler_add_counter(counter, amount)
+
+// Spans run on the raster workers, so pixels are tallied locally and published once per span
+#define PROFILE_SPAN_BEGIN() int profile_tested = 0, profile_written = 0
+#define PROFILE_SPAN_PIXEL(written) (profile_tested++, profile_written += (written) ? 1 : 0)
+#define PROFILE_SPAN_WRITE() (profile_written++)
+#define PROFILE_SPAN_LANES(tested_mask, written_mask) \
+    (profile_tested += profile_popcount(tested_mask), profile_written += profile_popcount(written_mask))
+#define PROFILE_SPAN_END() \
+    (profiler_add_counter(COUNTER_PIXELS_DEPTH_TESTED, profile_tested), profiler_add_counter(COUNTER_PIXELS_WRITTEN, profile_written))
+
+#else
+
+static inline void profiler_begin_frame(void) {}
+static inline void profiler_end_frame(void) {}
+static inline void profiler_set_render_scale(const float scale) { (void)scale; }
+static inline const profile_frame_t* profiler_last_frame(void) { return NULL; }
+static inline void profiler_close(void) {}
+
+static inline bool profiler_open_csv(const char* path) {
+    (void)path;
+    fprintf(stderr, "Profiling is not compiled in, configure with -DRENDERER_PROFILE=ON.\n");
+    return false;
+}
+
+static inline bool profiler_open_trace(const char* path) {
+    return profiler_open_csv(path);
+}
+
+static inline void profiler_format_hud(char* text, const size_t size) {
+    SDL_snprintf(text, size, "Profiling is not compiled in (RENDERER_PROFILE)");
+}
+
+#define PROFILE_BEGIN(stage) ((void)0)
+#define PROFILE_END(stage) ((void)(stage))
+#define PROFILE_COUNT(counter, amount) ((void)0)
+
+#define PROFILE_SPAN_BEGIN() ((void)0)
+#define PROFILE_SPAN_PIXEL(written) ((void)(written))
+#define PROFILE_SPAN_WRITE() ((void)0)
+#define PROFILE_SPAN_LANES(tested_mask, written_mask) ((void)0)
+#define PROFILE_SPAN_END() ((void)0)
+
+#endif
+
+#endif //SOFTWARE_RENDERER_C_PROFILER_H
\ No newline at end of file
@@ -0,0 +1,142 @@
+﻿#ifndef SOFTWARE_RENDERER_C_RASTER_H
+#define SOFTWARE_RENDERER_C_RASTER_H
+
+#include "draw.h"
+#include "tiles.h"
+#include "profiler.h"
+
+// Internal to the rasterizer: the binned triangle records shared by draw.c and the SIMD span kernels
+
+#if defined(_MSC_VER)
+#define RASTER_INLINE static __forceinline
+#else
+#define RASTER_INLINE static inline __attribute__((always_inline))
+#endif
+
+// Vertices are snapped to 1/16 of a pixel (28.4 fixed point) and pixels are sampled at their centers. Targets too
+// large for 28.4 edge functions to stay within 32 bits drop to 1/8 or 1/4 of a pixel, see set_viewport.
+#define RASTER_SUBPIXEL_BITS 4
+#define RASTER_MIN_SUBPIXEL_BITS 2
+
+// Edge functions as affine functions of the pixel position, e(x, y) = e_dx * x + e_dy * y + e_c, exact integers in
+// subpixel units squared. Each one is the unnormalized barycentric weight of the opposite vertex, oriented so
+// covered pixels are >= e_min: 0 on top and left edges and 1 on the others, so a pixel center on an edge shared
+// by two triangles belongs to exactly one of them.
+typedef struct {
+    int e1_dx, e1_dy, e1_c;
+    int e2_dx, e2_dy, e2_c;
+    int e3_dx, e3_dy, e3_c;
+    int e1_min, e2_min, e3_min;
+    float inv_area; // of the subpixel area, turns the edge functions into barycentrics
+    int min_x, min_y;
+    int max_x, max_y; // inclusive, clamped to the screen
+} edge_setup_t;
+
+typedef enum {
+    RASTER_LINES,
+    RASTER_DEPTH,            // depth prepass, no color or attributes
+    RASTER_FLAT,
+    RASTER_PHONG,
+    RASTER_TEXTURED,
+    RASTER_TEXTURED_PHONG,
+    RASTER_GBUFFER,          // deferred Phong, surfaces go to the G-buffer and are lit by the resolve pass
+    RASTER_GBUFFER_TEXTURED
+} raster_kind;
+
+// A triangle after setup: screen points plus edge equations, lines only use p1..p3
+typedef struct {
+    edge_setup_t edges;
+    vec3_t p1, p2, p3;
+    vec3_t v1, v2, v3;
+    vec3_t n1, n2, n3;
+    vec2_t uv1, uv2, uv3;
+    vec3_t light_accum;
+    uint32_t color;
+    float min_depth; // no covered pixel is nearer, checked against the hierarchical Z
+    int edge_mask;   // lines only, bit i draws the edge leaving corner i, clipped pieces keep the original edges
+    int mip_level;   // textured only, chosen once per triangle from its texel to pixel ratio
+    float mip_blend; // trilinear weight of mip_level + 1
+} raster_tri_t;
+
+// Surfaces of the visible pixels for deferred shading, one entry per target pixel. A pixel belongs to the draw
+// call being resolved when its stamp equals stamp, so nothing has to be cleared between draw calls.
+typedef struct {
+    float* pos_x;
+    float* pos_y;
+    float* pos_z;
+    float* normal_x; // normalized
+    float* normal_y;
+    float* normal_z;
+    uint32_t* albedo;
+    uint32_t* stamps;
+    uint32_t stamp;
+} g_buffer_t;
+
+typedef struct {
+    raster_kind kind;
+    const render_target_t* target;
+    z_buffer_t* z_buffer; // the target's
+    g_buffer_t* g_buffer; // only for the RASTER_GBUFFER kinds
+    const texture_t* texture;
+    texture_filter filter;
+    const light_grid_t* lights; // NULL when unlit
+    bool unbinned_lights;       // the grid was binned for a target of another size, every tile visits all its lights
+    vec3_t ambient;
+
+    raster_tri_t* tris;
+    int tris_count;
+    int tris_capacity;
+    rect_t bounds; // inclusive union of the set up triangles' pixel boxes
+    tile_grid_t grid;
+} raster_batch_t;
+
+// The lights that reach the raster tile of pixel (x, y), in their original order
+typedef struct {
+    const light_t* lights;
+    const int* indices;
+    int count;
+} light_list_t;
+
+static inline light_list_t tile_lights(const raster_batch_t* b, const int x, const int y) {
+    if (b->lights == NULL)
+        return (light_list_t){ NULL, NULL, 0 };
+
+    const tile_bin_t* bin = b->unbinned_lights ? &b->lights->all : &b->lights->tiles.bins[(y / TILE_SIZE) * b->lights->tiles.cols + x / TILE_SIZE];
+    return (light_list_t){ b->lights->lights, bin->indices, bin->count };
+}
+
+// Shades pixels x0..x1 (inclusive) of row y, e1..e3 are the edge functions at x0
+typedef void (*span_fn)(const raster_batch_t* b, const raster_tri_t* t, int y, int x0, int x1, int e1, int e2, int e3);
+
+// Lights pixels x0..x1 (inclusive, within one tile) of row y from the G-buffer, skipping the ones other draw calls
+// left there
+typedef void (*resolve_fn)(const raster_batch_t* b, int y, int x0, int x1);
+
+// The textured kernels are compiled once per filter and address mode, X(filter, address, suffix), so their pixel
+// loops never branch on either. Everything a kernel passes them to is RASTER_INLINE, which folds them into constants.
+#define RASTER_SAMPLERS(X)                                    \
+    X(TEXTURE_NEAREST,   TEXTURE_WRAP,  nearest_wrap)         \
+    X(TEXTURE_NEAREST,   TEXTURE_CLAMP, nearest_clamp)        \
+    X(TEXTURE_BILINEAR,  TEXTURE_WRAP,  bilinear_wrap)        \
+    X(TEXTURE_BILINEAR,  TEXTURE_CLAMP, bilinear_clamp)       \
+    X(TEXTURE_TRILINEAR, TEXTURE_WRAP,  trilinear_wrap)       \
+    X(TEXTURE_TRILINEAR, TEXTURE_CLAMP, trilinear_clamp)
+
+typedef struct {
+    span_fn depth;
+    span_fn flat;
+    span_fn phong;
+    span_fn textured[TEXTURE_FILTER_COUNT][TEXTURE_ADDRESS_COUNT];
+    span_fn textured_phong[TEXTURE_FILTER_COUNT][TEXTURE_ADDRESS_COUNT];
+    span_fn gbuffer;
+    span_fn gbuffer_textured[TEXTURE_FILTER_COUNT][TEXTURE_ADDRESS_COUNT];
+    resolve_fn resolve;
+} span_kernels_t;
+
+extern const span_kernels_t span_kernels_scalar;
+
+// NULL when the kernels were not compiled in for this target
+const span_kernels_t* span_kernels_sse2(void);
+const span_kernels_t* span_kernels_avx2(void);
+
+#endif //SOFTWARE_RENDERER_C_RASTER_H
\ No newline at end of file
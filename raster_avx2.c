@@ -0,0 +1,71 @@
+﻿#include "raster.h"
+
+// Built with AVX2 code generation enabled for this file only, the kernels are picked at runtime
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define LANES 8
+#define SIMD_SUFFIX _avx2
+
+typedef __m256  vf;
+typedef __m256i vi;
+
+#define VF_SET1(x)        _mm256_set1_ps(x)
+#define VF_ZERO()         _mm256_setzero_ps()
+#define VF_LOADU(p)       _mm256_loadu_ps(p)
+#define VF_STOREU(p, v)   _mm256_storeu_ps(p, v)
+#define VF_ADD(a, b)      _mm256_add_ps(a, b)
+#define VF_SUB(a, b)      _mm256_sub_ps(a, b)
+#define VF_MUL(a, b)      _mm256_mul_ps(a, b)
+#define VF_DIV(a, b)      _mm256_div_ps(a, b)
+#define VF_MIN(a, b)      _mm256_min_ps(a, b)
+#define VF_MAX(a, b)      _mm256_max_ps(a, b)
+#define VF_CMPGE(a, b)    _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define VF_CMPLE(a, b)    _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define VF_CMPLT(a, b)    _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VF_CMPNEQ(a, b)   _mm256_cmp_ps(a, b, _CMP_NEQ_UQ)
+#define VF_AND(a, b)      _mm256_and_ps(a, b)
+#define VF_ANDNOT(a, b)   _mm256_andnot_ps(a, b)
+#define VF_OR(a, b)       _mm256_or_ps(a, b)
+#define VF_MOVEMASK(a)    _mm256_movemask_ps(a)
+#define VF_AS_VI(a)       _mm256_castps_si256(a)
+
+#define VI_SET1(x)        _mm256_set1_epi32(x)
+#define VI_LOADU(p)       _mm256_loadu_si256((const __m256i*)(p))
+#define VI_STOREU(p, v)   _mm256_storeu_si256((__m256i*)(p), v)
+#define VI_AND(a, b)      _mm256_and_si256(a, b)
+#define VI_OR(a, b)       _mm256_or_si256(a, b)
+#define VI_ANDNOT(a, b)   _mm256_andnot_si256(a, b)
+#define VI_ADD(a, b)      _mm256_add_epi32(a, b)
+#define VI_SUB(a, b)      _mm256_sub_epi32(a, b)
+#define VI_CMPEQ(a, b)    _mm256_cmpeq_epi32(a, b)
+#define VI_CMPGT(a, b)    _mm256_cmpgt_epi32(a, b)
+#define VI_SRLI(a, n)     _mm256_srli_epi32(a, n)
+#define VI_SLLI(a, n)     _mm256_slli_epi32(a, n)
+#define VI_SRAI(a, n)     _mm256_srai_epi32(a, n)
+#define VI_CVTT(a)        _mm256_cvttps_epi32(a)
+#define VI_TO_F(a)        _mm256_cvtepi32_ps(a)
+#define VI_AS_VF(a)       _mm256_castsi256_ps(a)
+
+// texture_texel_index for eight texels at once
+static inline vi gather_avx2(const texture_level_t* level, const vi tex_x, const vi tex_y, const vf mask) {
+    const vi one = _mm256_set1_epi32(1);
+    const vi two = _mm256_set1_epi32(2);
+    const vi tile = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(tex_y, 2), _mm256_set1_epi32(level->tiles_x)), _mm256_srai_epi32(tex_x, 2));
+    const vi morton = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(tex_x, one), _mm256_slli_epi32(_mm256_and_si256(tex_y, one), 1)),
+        _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(tex_x, two), 1), _mm256_slli_epi32(_mm256_and_si256(tex_y, two), 2)));
+    const vi index = _mm256_add_epi32(_mm256_slli_epi32(tile, 4), morton);
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)level->texels, index, _mm256_castps_si256(mask), 4);
+}
+
+#include "raster_simd.h"
+
+#else
+
+const span_kernels_t* span_kernels_avx2(void) {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,424 @@
+﻿// Span kernel template, included by raster_sse2.c and raster_avx2.c after they define the vector macros below.
+// Every lane repeats the scalar kernels' arithmetic in the same order, so all ISA levels produce the same image.
+//
+// LANES, SIMD_SUFFIX, vf (float vector), vi (int vector)
+// VF_SET1 VF_ZERO VF_LOADU VF_STOREU VF_ADD VF_SUB VF_MUL VF_DIV VF_MIN VF_MAX
+// VF_CMPGE VF_CMPLE VF_CMPLT VF_CMPNEQ VF_AND VF_ANDNOT VF_OR VF_MOVEMASK VF_AS_VI
+// VI_SET1 VI_LOADU VI_STOREU VI_AND VI_OR VI_ANDNOT VI_ADD VI_SUB VI_CMPEQ VI_CMPGT VI_SRLI VI_SLLI VI_SRAI VI_CVTT
+// VI_TO_F VI_AS_VF and SIMD_FN(gather)(level, tex_x, tex_y, mask) returning the masked texels of a mip level.
+
+#define SIMD_CONCAT_(a, b) a##b
+#define SIMD_CONCAT(a, b) SIMD_CONCAT_(a, b)
+#define SIMD_FN(name) SIMD_CONCAT(name, SIMD_SUFFIX)
+
+// mask ? b : a
+static inline vf SIMD_FN(select_f)(const vf mask, const vf a, const vf b) {
+    return VF_OR(VF_AND(mask, b), VF_ANDNOT(mask, a));
+}
+
+static inline vi SIMD_FN(select_i)(const vf mask, const vi a, const vi b) {
+    const vi m = VF_AS_VI(mask);
+    return VI_OR(VI_AND(m, b), VI_ANDNOT(m, a));
+}
+
+static inline vf SIMD_FN(fast_inverse_sqrt)(const vf x) {
+    const vf y = VI_AS_VF(VI_SUB(VI_SET1(0x5f3759df), VI_SRAI(VF_AS_VI(x), 1)));
+    return VF_MUL(y, VF_SUB(VF_SET1(1.5f), VF_MUL(VF_MUL(VF_MUL(VF_SET1(0.5f), x), y), y)));
+}
+
+static inline void SIMD_FN(normalize)(vf* x, vf* y, vf* z) {
+    const vf length_sq = VF_ADD(VF_ADD(VF_MUL(*x, *x), VF_MUL(*y, *y)), VF_MUL(*z, *z));
+    const vf non_zero = VF_CMPNEQ(length_sq, VF_ZERO());
+    const vf inv_length = SIMD_FN(fast_inverse_sqrt)(length_sq);
+    *x = VF_AND(non_zero, VF_MUL(*x, inv_length));
+    *y = VF_AND(non_zero, VF_MUL(*y, inv_length));
+    *z = VF_AND(non_zero, VF_MUL(*z, inv_length));
+}
+
+static inline vi SIMD_FN(modulate)(const vi color, const vf r, const vf g, const vf b) {
+    const vi mask = VI_SET1(0xFF);
+    const vi cr = VI_CVTT(VF_MUL(VI_TO_F(VI_AND(VI_SRLI(color, 16), mask)), r));
+    const vi cg = VI_CVTT(VF_MUL(VI_TO_F(VI_AND(VI_SRLI(color, 8), mask)), g));
+    const vi cb = VI_CVTT(VF_MUL(VI_TO_F(VI_AND(color, mask)), b));
+    return VI_OR(VI_OR(VI_SLLI(cr, 16), VI_SLLI(cg, 8)), cb);
+}
+
+// Exact for |x| <= TEXTURE_COORD_LIMIT, like floorf
+static inline vf SIMD_FN(floor)(const vf x) {
+    const vf truncated = VI_TO_F(VI_CVTT(x));
+    return VF_SUB(truncated, VF_AND(VF_CMPLT(x, truncated), VF_SET1(1.0f)));
+}
+
+RASTER_INLINE vf SIMD_FN(address)(const vf c, const texture_address address) {
+    const vf x = VF_MIN(VF_MAX(c, VF_SET1(-TEXTURE_COORD_LIMIT)), VF_SET1(TEXTURE_COORD_LIMIT));
+    if (address == TEXTURE_CLAMP)
+        return VF_MIN(VF_MAX(x, VF_ZERO()), VF_SET1(1.0f));
+    return VF_SUB(x, SIMD_FN(floor)(x));
+}
+
+static inline vi SIMD_FN(min_i)(const vi a, const vi b) {
+    return SIMD_FN(select_i)(VI_AS_VF(VI_CMPGT(a, b)), a, b);
+}
+
+static inline vi SIMD_FN(sample_nearest)(const texture_level_t* level, const vf u, const vf v, const vf mask) {
+    const vi x = SIMD_FN(min_i)(VI_CVTT(VF_MUL(u, VF_SET1((float)level->width))), VI_SET1(level->width - 1));
+    const vi y = SIMD_FN(min_i)(VI_CVTT(VF_MUL(v, VF_SET1((float)level->height))), VI_SET1(level->height - 1));
+    return SIMD_FN(gather)(level, x, y, mask);
+}
+
+static inline vf SIMD_FN(lerp)(const vf a, const vf b, const vf t) {
+    return VF_ADD(a, VF_MUL(VF_SUB(b, a), t));
+}
+
+static inline vf SIMD_FN(channel)(const vi color, const int shift) {
+    return VI_TO_F(VI_AND(VI_SRLI(color, shift), VI_SET1(0xFF)));
+}
+
+// The texel pair around each coordinate, wrapped or clamped at the edges
+RASTER_INLINE void SIMD_FN(texel_pair)(const vf c, const int size, const texture_address address, vi* c0, vi* c1, vf* frac) {
+    const vf f = VF_SUB(VF_MUL(c, VF_SET1((float)size)), VF_SET1(0.5f));
+    const vf f0 = SIMD_FN(floor)(f);
+    *frac = VF_SUB(f, f0);
+    const vi i0 = VI_CVTT(f0);
+    const vi i1 = VI_ADD(i0, VI_SET1(1));
+    *c0 = SIMD_FN(select_i)(VI_AS_VF(VI_CMPGT(VI_SET1(0), i0)), i0, VI_SET1(address == TEXTURE_WRAP ? size - 1 : 0));
+    *c1 = SIMD_FN(select_i)(VI_AS_VF(VI_CMPGT(i1, VI_SET1(size - 1))), i1, VI_SET1(address == TEXTURE_WRAP ? 0 : size - 1));
+}
+
+RASTER_INLINE void SIMD_FN(sample_bilinear)(const texture_level_t* level, const texture_address address,
+                                            const vf u, const vf v, const vf mask, vf rgb[3]) {
+    vi x0, x1, y0, y1;
+    vf ax, ay;
+    SIMD_FN(texel_pair)(u, level->width, address, &x0, &x1, &ax);
+    SIMD_FN(texel_pair)(v, level->height, address, &y0, &y1, &ay);
+
+    const vi c00 = SIMD_FN(gather)(level, x0, y0, mask);
+    const vi c10 = SIMD_FN(gather)(level, x1, y0, mask);
+    const vi c01 = SIMD_FN(gather)(level, x0, y1, mask);
+    const vi c11 = SIMD_FN(gather)(level, x1, y1, mask);
+
+    for (int i = 0; i < 3; ++i) {
+        const int shift = 16 - 8 * i;
+        const vf top = SIMD_FN(lerp)(SIMD_FN(channel)(c00, shift), SIMD_FN(channel)(c10, shift), ax);
+        const vf bottom = SIMD_FN(lerp)(SIMD_FN(channel)(c01, shift), SIMD_FN(channel)(c11, shift), ax);
+        rgb[i] = SIMD_FN(lerp)(top, bottom, ay);
+    }
+}
+
+// filter and address are constants of the calling span kernel, see RASTER_SAMPLERS
+RASTER_INLINE vi SIMD_FN(sample)(const raster_batch_t* b, const raster_tri_t* t, const vf alpha, const vf beta, const vf gamma, const vf depth, const vf mask,
+                                 const texture_filter filter, const texture_address address) {
+    const vf u = VF_MUL(VF_ADD(VF_ADD(
+        VF_MUL(VF_SET1(t->uv1.x * t->p1.z), alpha),
+        VF_MUL(VF_SET1(t->uv2.x * t->p2.z), beta)),
+        VF_MUL(VF_SET1(t->uv3.x * t->p3.z), gamma)), depth);
+    const vf v = VF_MUL(VF_ADD(VF_ADD(
+        VF_MUL(VF_SET1(t->uv1.y * t->p1.z), alpha),
+        VF_MUL(VF_SET1(t->uv2.y * t->p2.z), beta)),
+        VF_MUL(VF_SET1(t->uv3.y * t->p3.z), gamma)), depth);
+
+    const vf su = SIMD_FN(address)(u, address);
+    const vf sv = SIMD_FN(address)(v, address);
+    const texture_level_t* level = &b->texture->levels[t->mip_level];
+    if (filter == TEXTURE_NEAREST)
+        return SIMD_FN(sample_nearest)(level, su, sv, mask);
+
+    vf rgb[3];
+    SIMD_FN(sample_bilinear)(level, address, su, sv, mask, rgb);
+    if (filter == TEXTURE_TRILINEAR && t->mip_blend > 0.0f) {
+        vf next[3];
+        SIMD_FN(sample_bilinear)(level + 1, address, su, sv, mask, next);
+        for (int i = 0; i < 3; ++i) {
+            rgb[i] = SIMD_FN(lerp)(rgb[i], next[i], VF_SET1(t->mip_blend));
+        }
+    }
+
+    const vf half = VF_SET1(0.5f);
+    return VI_OR(VI_OR(
+        VI_SLLI(VI_CVTT(VF_ADD(rgb[0], half)), 16),
+        VI_SLLI(VI_CVTT(VF_ADD(rgb[1], half)), 8)),
+        VI_CVTT(VF_ADD(rgb[2], half)));
+}
+
+// View-space position and normalized normal of LANES pixels
+static inline void SIMD_FN(surface)(const raster_tri_t* t, const vf alpha, const vf beta, const vf gamma, const vf depth, vf pos[3], vf normal[3]) {
+    pos[0] = VF_MUL(VF_ADD(VF_ADD(
+        VF_MUL(VF_SET1(t->v1.x * t->p1.z), alpha),
+        VF_MUL(VF_SET1(t->v2.x * t->p2.z), beta)),
+        VF_MUL(VF_SET1(t->v3.x * t->p3.z), gamma)), depth);
+    pos[1] = VF_MUL(VF_ADD(VF_ADD(
+        VF_MUL(VF_SET1(t->v1.y * t->p1.z), alpha),
+        VF_MUL(VF_SET1(t->v2.y * t->p2.z), beta)),
+        VF_MUL(VF_SET1(t->v3.y * t->p3.z), gamma)), depth);
+    pos[2] = VF_MUL(VF_ADD(VF_ADD(
+        VF_MUL(VF_SET1(t->v1.z * t->p1.z), alpha),
+        VF_MUL(VF_SET1(t->v2.z * t->p2.z), beta)),
+        VF_MUL(VF_SET1(t->v3.z * t->p3.z), gamma)), depth);
+
+    normal[0] = VF_ADD(VF_ADD(VF_MUL(VF_SET1(t->n1.x), alpha), VF_MUL(VF_SET1(t->n2.x), beta)), VF_MUL(VF_SET1(t->n3.x), gamma));
+    normal[1] = VF_ADD(VF_ADD(VF_MUL(VF_SET1(t->n1.y), alpha), VF_MUL(VF_SET1(t->n2.y), beta)), VF_MUL(VF_SET1(t->n3.y), gamma));
+    normal[2] = VF_ADD(VF_ADD(VF_MUL(VF_SET1(t->n1.z), alpha), VF_MUL(VF_SET1(t->n2.z), beta)), VF_MUL(VF_SET1(t->n3.z), gamma));
+    SIMD_FN(normalize)(&normal[0], &normal[1], &normal[2]);
+}
+
+// Shadow lookups are scattered texel reads, so each lane goes through the scalar path
+static inline vf SIMD_FN(shadow)(const shadow_map_t* shadow, const vf pos[3]) {
+    float x[LANES], y[LANES], z[LANES], visibility[LANES];
+    VF_STOREU(x, pos[0]);
+    VF_STOREU(y, pos[1]);
+    VF_STOREU(z, pos[2]);
+    for (int i = 0; i < LANES; ++i) {
+        visibility[i] = shadow_visibility(shadow, (vec3_t){x[i], y[i], z[i]});
+    }
+    return VF_LOADU(visibility);
+}
+
+// Phong light loop over LANES pixels of one tile at once, one of the tile's lights at a time
+static inline void SIMD_FN(light)(const raster_batch_t* b, const light_list_t lights, const vf pos[3], const vf normal[3], vf* out_r, vf* out_g, vf* out_b) {
+    vf acc_r = VF_SET1(b->ambient.x);
+    vf acc_g = VF_SET1(b->ambient.y);
+    vf acc_b = VF_SET1(b->ambient.z);
+    for (int i = 0; i < lights.count; ++i) {
+        const light_t* light = &lights.lights[lights.indices[i]];
+
+        vf l_x = VF_SUB(VF_SET1(light->position.x), pos[0]);
+        vf l_y = VF_SUB(VF_SET1(light->position.y), pos[1]);
+        vf l_z = VF_SUB(VF_SET1(light->position.z), pos[2]);
+        const vf distance_sq = VF_ADD(VF_ADD(VF_MUL(l_x, l_x), VF_MUL(l_y, l_y)), VF_MUL(l_z, l_z));
+        const vf falloff = VF_MAX(VF_SUB(VF_SET1(1.0f), VF_MUL(distance_sq, VF_SET1(light->inv_range_sq))), VF_ZERO());
+        SIMD_FN(normalize)(&l_x, &l_y, &l_z);
+
+        const vf dot = VF_ADD(VF_ADD(VF_MUL(normal[0], l_x), VF_MUL(normal[1], l_y)), VF_MUL(normal[2], l_z));
+        vf diffuse = VF_MUL(VF_MAX(dot, VF_ZERO()), VF_MUL(falloff, falloff));
+        if (light->shadow != NULL) {
+            diffuse = VF_MUL(diffuse, SIMD_FN(shadow)(light->shadow, pos));
+        }
+        const vf w = VF_SET1(light->color.w);
+        acc_r = VF_ADD(acc_r, VF_MUL(VF_MUL(diffuse, VF_SET1(light->color.x)), w));
+        acc_g = VF_ADD(acc_g, VF_MUL(VF_MUL(diffuse, VF_SET1(light->color.y)), w));
+        acc_b = VF_ADD(acc_b, VF_MUL(VF_MUL(diffuse, VF_SET1(light->color.z)), w));
+    }
+
+    *out_r = VF_MIN(acc_r, VF_SET1(1.0f));
+    *out_g = VF_MIN(acc_g, VF_SET1(1.0f));
+    *out_b = VF_MIN(acc_b, VF_SET1(1.0f));
+}
+
+static inline void SIMD_FN(phong)(const raster_batch_t* b, const raster_tri_t* t, const int x, const int y, const vf alpha, const vf beta, const vf gamma, const vf depth, vf* out_r, vf* out_g, vf* out_b) {
+    vf pos[3], normal[3];
+    SIMD_FN(surface)(t, alpha, beta, gamma, depth, pos, normal);
+    SIMD_FN(light)(b, tile_lights(b, x, y), pos, normal, out_r, out_g, out_b);
+}
+
+static inline void SIMD_FN(store_masked)(float* p, const vf mask, const vf v) {
+    VF_STOREU(p, SIMD_FN(select_f)(mask, VF_LOADU(p), v));
+}
+
+// Geometry pass, the albedo goes out through the span's color store
+static inline void SIMD_FN(store_surface)(const raster_batch_t* b, const raster_tri_t* t, const int index, const vf alpha, const vf beta, const vf gamma, const vf depth, const vf pass) {
+    g_buffer_t* g = b->g_buffer;
+    vf pos[3], normal[3];
+    SIMD_FN(surface)(t, alpha, beta, gamma, depth, pos, normal);
+
+    SIMD_FN(store_masked)(g->pos_x + index, pass, pos[0]);
+    SIMD_FN(store_masked)(g->pos_y + index, pass, pos[1]);
+    SIMD_FN(store_masked)(g->pos_z + index, pass, pos[2]);
+    SIMD_FN(store_masked)(g->normal_x + index, pass, normal[0]);
+    SIMD_FN(store_masked)(g->normal_y + index, pass, normal[1]);
+    SIMD_FN(store_masked)(g->normal_z + index, pass, normal[2]);
+    VI_STOREU(g->stamps + index, SIMD_FN(select_i)(pass, VI_LOADU(g->stamps + index), VI_SET1((int)g->stamp)));
+}
+
+// 0, step, 2 * step, ... across the lanes
+static inline vi SIMD_FN(lane_steps)(const int step) {
+    int steps[LANES];
+    for (int i = 0; i < LANES; ++i) {
+        steps[i] = i * step;
+    }
+    return VI_LOADU(steps);
+}
+
+// Lanes whose edge functions all reach their e_min, the biases are e_min - 1
+static inline vf SIMD_FN(cover)(const vi e1, const vi e2, const vi e3, const vi e1_bias, const vi e2_bias, const vi e3_bias) {
+    return VI_AS_VF(VI_AND(VI_AND(VI_CMPGT(e1, e1_bias), VI_CMPGT(e2, e2_bias)), VI_CMPGT(e3, e3_bias)));
+}
+
+// Coverage and depth test for LANES pixels per step. SHADE computes `color` for the lanes in `pass`,
+// pixels past the last full vector are left to the scalar kernel.
+#define SIMD_SPAN(name, scalar_span, ...)                                                                       \
+    static void SIMD_FN(name)(const raster_batch_t* b, const raster_tri_t* t, const int y, const int x0,       \
+                              const int x1, const int e1, const int e2, const int e3) {                         \
+        const edge_setup_t* e = &t->edges;                                                                      \
+        vi e1v = VI_ADD(VI_SET1(e1), SIMD_FN(lane_steps)(e->e1_dx));                                            \
+        vi e2v = VI_ADD(VI_SET1(e2), SIMD_FN(lane_steps)(e->e2_dx));                                            \
+        vi e3v = VI_ADD(VI_SET1(e3), SIMD_FN(lane_steps)(e->e3_dx));                                            \
+        const vi e1_step = VI_SET1(e->e1_dx * LANES);                                                           \
+        const vi e2_step = VI_SET1(e->e2_dx * LANES);                                                           \
+        const vi e3_step = VI_SET1(e->e3_dx * LANES);                                                           \
+        const vi e1_bias = VI_SET1(e->e1_min - 1);                                                              \
+        const vi e2_bias = VI_SET1(e->e2_min - 1);                                                              \
+        const vi e3_bias = VI_SET1(e->e3_min - 1);                                                              \
+        const vf inv_area = VF_SET1(e->inv_area);                                                               \
+        const vf z1 = VF_SET1(t->p1.z);                                                                         \
+        const vf z2 = VF_SET1(t->p2.z);                                                                         \
+        const vf z3 = VF_SET1(t->p3.z);                                                                         \
+        float* z_row = &b->z_buffer->depth[b->z_buffer->width * y];                                             \
+        uint32_t* color_row = b->g_buffer != NULL                                                               \
+            ? &b->g_buffer->albedo[b->z_buffer->width * y] : &b->target->color[y * b->target->stride];          \
+                                                                                                                \
+        PROFILE_SPAN_BEGIN();                                                                                   \
+        int x = x0;                                                                                             \
+        for (; x + LANES - 1 <= x1;                                                                             \
+               x += LANES, e1v = VI_ADD(e1v, e1_step), e2v = VI_ADD(e2v, e2_step), e3v = VI_ADD(e3v, e3_step)) { \
+            const vf cover = SIMD_FN(cover)(e1v, e2v, e3v, e1_bias, e2_bias, e3_bias);                          \
+            const int cover_mask = VF_MOVEMASK(cover);                                                          \
+            if (cover_mask == 0)                                                                                \
+                continue;                                                                                       \
+                                                                                                                \
+            const vf alpha = VF_MUL(VI_TO_F(e1v), inv_area);                                                    \
+            const vf beta  = VF_MUL(VI_TO_F(e2v), inv_area);                                                    \
+            const vf gamma = VF_MUL(VI_TO_F(e3v), inv_area);                                                    \
+            const vf depth = VF_DIV(VF_SET1(1.0f),                                                              \
+                VF_ADD(VF_ADD(VF_MUL(alpha, z1), VF_MUL(beta, z2)), VF_MUL(gamma, z3)));                        \
+                                                                                                                \
+            const vf old_z = VF_LOADU(z_row + x);                                                               \
+            const vf pass = VF_AND(cover, VF_CMPLE(depth, old_z));                                              \
+            const int pass_mask = VF_MOVEMASK(pass);                                                            \
+            PROFILE_SPAN_LANES((unsigned int)cover_mask, (unsigned int)pass_mask);                              \
+            if (pass_mask == 0)                                                                                 \
+                continue;                                                                                       \
+                                                                                                                \
+            vi color;                                                                                           \
+            __VA_ARGS__;                                                                                        \
+                                                                                                                \
+            VF_STOREU(z_row + x, SIMD_FN(select_f)(pass, old_z, depth));                                        \
+            VI_STOREU(color_row + x, SIMD_FN(select_i)(pass, VI_LOADU(color_row + x), color));                  \
+        }                                                                                                       \
+                                                                                                                \
+        PROFILE_SPAN_END();                                                                                     \
+                                                                                                                \
+        if (x <= x1) {                                                                                          \
+            const int done = x - x0;                                                                            \
+            scalar_span(b, t, y, x, x1, e1 + done * e->e1_dx, e2 + done * e->e2_dx, e3 + done * e->e3_dx);      \
+        }                                                                                                       \
+    }
+
+// The depth prepass only needs the coverage and depth test, so it skips the color store of SIMD_SPAN
+static void SIMD_FN(span_depth)(const raster_batch_t* b, const raster_tri_t* t, const int y, const int x0, const int x1,
+                                const int e1, const int e2, const int e3) {
+    const edge_setup_t* e = &t->edges;
+    vi e1v = VI_ADD(VI_SET1(e1), SIMD_FN(lane_steps)(e->e1_dx));
+    vi e2v = VI_ADD(VI_SET1(e2), SIMD_FN(lane_steps)(e->e2_dx));
+    vi e3v = VI_ADD(VI_SET1(e3), SIMD_FN(lane_steps)(e->e3_dx));
+    const vi e1_step = VI_SET1(e->e1_dx * LANES);
+    const vi e2_step = VI_SET1(e->e2_dx * LANES);
+    const vi e3_step = VI_SET1(e->e3_dx * LANES);
+    const vi e1_bias = VI_SET1(e->e1_min - 1);
+    const vi e2_bias = VI_SET1(e->e2_min - 1);
+    const vi e3_bias = VI_SET1(e->e3_min - 1);
+    const vf inv_area = VF_SET1(e->inv_area);
+    const vf z1 = VF_SET1(t->p1.z);
+    const vf z2 = VF_SET1(t->p2.z);
+    const vf z3 = VF_SET1(t->p3.z);
+    float* z_row = &b->z_buffer->depth[b->z_buffer->width * y];
+
+    PROFILE_SPAN_BEGIN();
+    int x = x0;
+    for (; x + LANES - 1 <= x1;
+           x += LANES, e1v = VI_ADD(e1v, e1_step), e2v = VI_ADD(e2v, e2_step), e3v = VI_ADD(e3v, e3_step)) {
+        const vf cover = SIMD_FN(cover)(e1v, e2v, e3v, e1_bias, e2_bias, e3_bias);
+        const int cover_mask = VF_MOVEMASK(cover);
+        if (cover_mask == 0)
+            continue;
+
+        const vf alpha = VF_MUL(VI_TO_F(e1v), inv_area);
+        const vf beta  = VF_MUL(VI_TO_F(e2v), inv_area);
+        const vf gamma = VF_MUL(VI_TO_F(e3v), inv_area);
+        const vf depth = VF_DIV(VF_SET1(1.0f),
+            VF_ADD(VF_ADD(VF_MUL(alpha, z1), VF_MUL(beta, z2)), VF_MUL(gamma, z3)));
+
+        const vf old_z = VF_LOADU(z_row + x);
+        const vf pass = VF_AND(cover, VF_CMPLE(depth, old_z));
+        PROFILE_SPAN_LANES((unsigned int)cover_mask, (unsigned int)VF_MOVEMASK(pass));
+        VF_STOREU(z_row + x, SIMD_FN(select_f)(pass, old_z, depth));
+    }
+    PROFILE_SPAN_END();
+
+    if (x <= x1) {
+        const int done = x - x0;
+        span_kernels_scalar.depth(b, t, y, x, x1, e1 + done * e->e1_dx, e2 + done * e->e2_dx, e3 + done * e->e3_dx);
+    }
+}
+
+SIMD_SPAN(span_flat, span_kernels_scalar.flat,
+    color = VI_SET1((int)t->color))
+
+SIMD_SPAN(span_phong, span_kernels_scalar.phong,
+    vf r, g, bl;
+    SIMD_FN(phong)(b, t, x, y, alpha, beta, gamma, depth, &r, &g, &bl);
+    color = SIMD_FN(modulate)(VI_SET1((int)t->color), r, g, bl))
+
+SIMD_SPAN(span_gbuffer, span_kernels_scalar.gbuffer,
+    SIMD_FN(store_surface)(b, t, b->z_buffer->width * y + x, alpha, beta, gamma, depth, pass);
+    color = VI_SET1((int)t->color))
+
+#define SIMD_TEXTURED_SPANS(filter, address, suffix)                                                            \
+    SIMD_SPAN(span_textured_##suffix, span_kernels_scalar.textured[filter][address],                           \
+        const vi texel = SIMD_FN(sample)(b, t, alpha, beta, gamma, depth, pass, filter, address);               \
+        color = SIMD_FN(modulate)(texel, VF_SET1(t->light_accum.x), VF_SET1(t->light_accum.y),                 \
+                                  VF_SET1(t->light_accum.z)))                                                   \
+    SIMD_SPAN(span_textured_phong_##suffix, span_kernels_scalar.textured_phong[filter][address],               \
+        const vi texel = SIMD_FN(sample)(b, t, alpha, beta, gamma, depth, pass, filter, address);               \
+        vf r, g, bl;                                                                                            \
+        SIMD_FN(phong)(b, t, x, y, alpha, beta, gamma, depth, &r, &g, &bl);                                     \
+        color = SIMD_FN(modulate)(texel, r, g, bl))                                                             \
+    SIMD_SPAN(span_gbuffer_textured_##suffix, span_kernels_scalar.gbuffer_textured[filter][address],           \
+        SIMD_FN(store_surface)(b, t, b->z_buffer->width * y + x, alpha, beta, gamma, depth, pass);              \
+        color = SIMD_FN(sample)(b, t, alpha, beta, gamma, depth, pass, filter, address))
+
+RASTER_SAMPLERS(SIMD_TEXTURED_SPANS)
+
+static void SIMD_FN(resolve_span)(const raster_batch_t* b, const int y, const int x0, const int x1) {
+    const g_buffer_t* g = b->g_buffer;
+    const vi stamp = VI_SET1((int)g->stamp);
+    const light_list_t lights = tile_lights(b, x0, y);
+    uint32_t* color_row = &b->target->color[y * b->target->stride];
+
+    int x = x0;
+    for (; x + LANES - 1 <= x1; x += LANES) {
+        const int index = b->z_buffer->width * y + x;
+        const vf live = VI_AS_VF(VI_CMPEQ(VI_LOADU(g->stamps + index), stamp));
+        if (VF_MOVEMASK(live) == 0)
+            continue;
+
+        const vf pos[3] = { VF_LOADU(g->pos_x + index), VF_LOADU(g->pos_y + index), VF_LOADU(g->pos_z + index) };
+        const vf normal[3] = { VF_LOADU(g->normal_x + index), VF_LOADU(g->normal_y + index), VF_LOADU(g->normal_z + index) };
+        vf r, gr, bl;
+        SIMD_FN(light)(b, lights, pos, normal, &r, &gr, &bl);
+
+        const vi color = SIMD_FN(modulate)(VI_LOADU(g->albedo + index), r, gr, bl);
+        VI_STOREU(color_row + x, SIMD_FN(select_i)(live, VI_LOADU(color_row + x), color));
+    }
+
+    if (x <= x1) {
+        span_kernels_scalar.resolve(b, y, x, x1);
+    }
+}
+
+#define SIMD_TEXTURED_ENTRIES(filter, address, suffix)                                                          \
+    .textured[filter][address] = SIMD_FN(span_textured_##suffix),                                              \
+    .textured_phong[filter][address] = SIMD_FN(span_textured_phong_##suffix),                                  \
+    .gbuffer_textured[filter][address] = SIMD_FN(span_gbuffer_textured_##suffix),
+
+static const span_kernels_t SIMD_FN(kernels) = {
+    .depth = SIMD_FN(span_depth),
+    .flat = SIMD_FN(span_flat),
+    .phong = SIMD_FN(span_phong),
+    .gbuffer = SIMD_FN(span_gbuffer),
+    .resolve = SIMD_FN(resolve_span),
+    RASTER_SAMPLERS(SIMD_TEXTURED_ENTRIES)
+};
+
+const span_kernels_t* SIMD_FN(span_kernels)(void) {
+    return &SIMD_FN(kernels);
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+﻿#include "raster.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define LANES 4
+#define SIMD_SUFFIX _sse2
+
+typedef __m128  vf;
+typedef __m128i vi;
+
+#define VF_SET1(x)        _mm_set1_ps(x)
+#define VF_ZERO()         _mm_setzero_ps()
+#define VF_LOADU(p)       _mm_loadu_ps(p)
+#define VF_STOREU(p, v)   _mm_storeu_ps(p, v)
+#define VF_ADD(a, b)      _mm_add_ps(a, b)
+#define VF_SUB(a, b)      _mm_sub_ps(a, b)
+#define VF_MUL(a, b)      _mm_mul_ps(a, b)
+#define VF_DIV(a, b)      _mm_div_ps(a, b)
+#define VF_MIN(a, b)      _mm_min_ps(a, b)
+#define VF_MAX(a, b)      _mm_max_ps(a, b)
+#define VF_CMPGE(a, b)    _mm_cmpge_ps(a, b)
+#define VF_CMPLE(a, b)    _mm_cmple_ps(a, b)
+#define VF_CMPLT(a, b)    _mm_cmplt_ps(a, b)
+#define VF_CMPNEQ(a, b)   _mm_cmpneq_ps(a, b)
+#define VF_AND(a, b)      _mm_and_ps(a, b)
+#define VF_ANDNOT(a, b)   _mm_andnot_ps(a, b)
+#define VF_OR(a, b)       _mm_or_ps(a, b)
+#define VF_MOVEMASK(a)    _mm_movemask_ps(a)
+#define VF_AS_VI(a)       _mm_castps_si128(a)
+
+#define VI_SET1(x)        _mm_set1_epi32(x)
+#define VI_LOADU(p)       _mm_loadu_si128((const __m128i*)(p))
+#define VI_STOREU(p, v)   _mm_storeu_si128((__m128i*)(p), v)
+#define VI_AND(a, b)      _mm_and_si128(a, b)
+#define VI_OR(a, b)       _mm_or_si128(a, b)
+#define VI_ANDNOT(a, b)   _mm_andnot_si128(a, b)
+#define VI_ADD(a, b)      _mm_add_epi32(a, b)
+#define VI_SUB(a, b)      _mm_sub_epi32(a, b)
+#define VI_CMPEQ(a, b)    _mm_cmpeq_epi32(a, b)
+#define VI_CMPGT(a, b)    _mm_cmpgt_epi32(a, b)
+#define VI_SRLI(a, n)     _mm_srli_epi32(a, n)
+#define VI_SLLI(a, n)     _mm_slli_epi32(a, n)
+#define VI_SRAI(a, n)     _mm_srai_epi32(a, n)
+#define VI_CVTT(a)        _mm_cvttps_epi32(a)
+#define VI_TO_F(a)        _mm_cvtepi32_ps(a)
+#define VI_AS_VF(a)       _mm_castsi128_ps(a)
+
+// SSE2 has neither a gather nor a 32-bit multiply, so the texels of the passing lanes are fetched one by one
+static inline vi gather_sse2(const texture_level_t* level, const vi tex_x, const vi tex_y, const vf mask) {
+    int32_t xs[LANES], ys[LANES];
+    uint32_t texels[LANES] = {0};
+    _mm_storeu_si128((__m128i*)xs, tex_x);
+    _mm_storeu_si128((__m128i*)ys, tex_y);
+
+    const int bits = _mm_movemask_ps(mask);
+    for (int i = 0; i < LANES; ++i) {
+        if (bits & (1 << i)) {
+            texels[i] = level->texels[texture_texel_index(level, xs[i], ys[i])];
+        }
+    }
+    return _mm_loadu_si128((const __m128i*)texels);
+}
+
+#include "raster_simd.h"
+
+#else
+
+const span_kernels_t* span_kernels_sse2(void) {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,153 @@
+﻿#include "render_modes.h"
+#include "profiler.h"
+
+typedef struct {
+    const char* name;
+    draw_pipeline pipeline;
+    draw_pipeline instanced; // the pipeline draw_instances uses, giving each instance its own color
+    bool depth_tested; // has a depth prepass and gains from front to back order, the wireframes draw in file order
+    bool phong;        // lit with phong_ambient
+} render_mode_t;
+
+static const render_mode_t render_modes[RENDER_MODES_COUNT] = {
+    { "wireframe_culled",      DRAW_WIREFRAME_CULLED,      DRAW_WIREFRAME_CULLED,           false, false },
+    { "wireframe",             DRAW_WIREFRAME,             DRAW_WIREFRAME,                  false, false },
+    { "unlit",                 DRAW_UNLIT,                 DRAW_UNLIT_PER_TRI_COLOR,        true,  false },
+    { "flat_shaded",           DRAW_FLAT_SHADED,           DRAW_FLAT_SHADED_PER_TRI_COLOR,  true,  false },
+    { "phong_shaded",          DRAW_PHONG_SHADED,          DRAW_PHONG_SHADED_PER_TRI_COLOR, true,  true  },
+    { "textured_unlit",        DRAW_TEXTURED_UNLIT,        DRAW_TEXTURED_UNLIT,             true,  false },
+    { "textured_flat_shaded",  DRAW_TEXTURED_FLAT_SHADED,  DRAW_TEXTURED_FLAT_SHADED,       true,  false },
+    { "textured_phong_shaded", DRAW_TEXTURED_PHONG_SHADED, DRAW_TEXTURED_PHONG_SHADED,      true,  true  }
+};
+
+static draw_call_t make_draw_call(const model_t* model, const triangle_t* triangles, const int triangle_count,
+                                  const mat4x4_t* proj_mat, const projection_type proj_type) {
+    const mesh_t* mesh = model_mesh(model);
+    draw_call_t call = {0};
+    call.vertices = mesh->transformed_vertices;
+    call.vertices_count = mesh->vertex_count;
+    call.normals = mesh->transformed_normals;
+    call.uvs = mesh->uvs;
+    call.tris = triangles;
+    call.tris_count = triangle_count;
+    call.texture = &model->texture;
+    call.proj_mat = proj_mat;
+    call.proj_type = proj_type;
+    return call;
+}
+
+void draw_model(
+    const render_target_t* target,
+    model_t* model,
+    const int render_mode,
+    const light_grid_t* lights,
+    const mat4x4_t* proj_mat,
+    const projection_type proj_type,
+    const vec3_t ambient,
+    const vec3_t phong_ambient)
+{
+    if (render_mode < 0 || render_mode >= RENDER_MODES_COUNT)
+        return;
+
+    const render_mode_t* mode = &render_modes[render_mode];
+    const triangle_t* triangles;
+    const int triangle_count = model_visible_triangles(
+        model, proj_mat, proj_type, mode->pipeline != DRAW_WIREFRAME, mode->depth_tested && model->sort_clusters, &triangles);
+
+    PROFILE_COUNT(COUNTER_LOD0_TRIANGLES + model->lod, triangle_count);
+
+    draw_call_t call = make_draw_call(model, triangles, triangle_count, proj_mat, proj_type);
+    call.color = mode->depth_tested ? model->color : model->wire_color;
+    call.lights = lights;
+    call.ambient = mode->phong ? phong_ambient : ambient;
+
+    draw_mesh(target, mode->pipeline, &call);
+}
+
+void draw_model_depth(
+    const render_target_t* target,
+    model_t* model,
+    const int render_mode,
+    const mat4x4_t* proj_mat,
+    const projection_type proj_type)
+{
+    if (render_mode < 0 || render_mode >= RENDER_MODES_COUNT || !render_modes[render_mode].depth_tested)
+        return;
+
+    const triangle_t* triangles;
+    const int triangle_count = model_visible_triangles(model, proj_mat, proj_type, true, model->sort_clusters, &triangles);
+
+    const draw_call_t call = make_draw_call(model, triangles, triangle_count, proj_mat, proj_type);
+    draw_mesh(target, DRAW_DEPTH_ONLY, &call);
+}
+
+void draw_instances(
+    const render_target_t* target,
+    instance_batch_t* batch,
+    const instance_t* instances,
+    const int count,
+    const int render_mode,
+    const light_grid_t* lights,
+    const mat4x4_t* view_mat,
+    const mat4x4_t* proj_mat,
+    const projection_type proj_type,
+    const vec3_t ambient,
+    const vec3_t phong_ambient,
+    const int lod_height)
+{
+    if (render_mode < 0 || render_mode >= RENDER_MODES_COUNT)
+        return;
+
+    const render_mode_t* mode = &render_modes[render_mode];
+    const model_t* model = batch->model;
+    for (int first = 0; first < count;) {
+        first = fill_instance_batch(batch, instances, first, count, view_mat, proj_mat, proj_type, lod_height);
+        if (batch->tris_count == 0)
+            continue;
+
+        PROFILE_COUNT(COUNTER_LOD0_TRIANGLES + batch->lod, batch->tris_count);
+
+        draw_call_t call = make_draw_call(model, batch->tris, batch->tris_count, proj_mat, proj_type);
+        call.vertices = batch->vertices;
+        call.vertices_count = batch->vertices_count;
+        call.normals = batch->normals;
+        call.uvs = model->lods[batch->lod].uvs;
+        call.color = model->wire_color;
+        call.tri_colors = batch->tri_colors;
+        call.lights = lights;
+        call.ambient = mode->phong ? phong_ambient : ambient;
+
+        draw_mesh(target, mode->instanced, &call);
+    }
+}
+
+bool update_shadow_map(
+    shadow_map_t* shadow,
+    const light_t* light,
+    const vec3_t light_target,
+    model_t* const* casters,
+    const int count)
+{
+    shadow_caster_t states[SHADOW_MAX_CASTERS] = {0};
+    for (int i = 0; i < count && i < SHADOW_MAX_CASTERS; ++i) {
+        const model_t* model = casters[i];
+        states[i] = (shadow_caster_t){ model->view_center, model->view_radius, model->translation, model->rotation, model->scale, model->lod };
+    }
+    if (!shadow_map_begin(shadow, light->position, light_target, states, count))
+        return false;
+
+    PROFILE_COUNT(COUNTER_SHADOW_MAPS_DRAWN, 1);
+    clear_z_buffer(shadow->target->z_buffer);
+    for (int i = 0; i < count; ++i) {
+        const triangle_t* triangles;
+        const int triangle_count = model_visible_triangles(casters[i], &shadow->light_mat, PERSPECTIVE, false, false, &triangles);
+
+        const draw_call_t call = make_draw_call(casters[i], triangles, triangle_count, &shadow->light_mat, PERSPECTIVE);
+        draw_mesh(shadow->target, DRAW_SHADOW_DEPTH, &call);
+    }
+    return true;
+}
+
+const char* render_mode_name(const int render_mode) {
+    return render_mode >= 0 && render_mode < RENDER_MODES_COUNT ? render_modes[render_mode].name : "unknown";
+}
@@ -0,0 +1,59 @@
+﻿#ifndef SOFTWARE_RENDERER_C_RENDER_MODES_H
+#define SOFTWARE_RENDERER_C_RENDER_MODES_H
+
+#include "draw.h"
+#include "instancing.h"
+#include "model.h"
+
+#define RENDER_MODES_COUNT 8
+
+// Draws the model the way render_mode 0..7 selects, flat modes use ambient and phong modes phong_ambient. lights
+// must have been binned with proj_mat, ideally for target's size. The visible triangles are gathered in the
+// model's scratch, so one model is drawn by one caller at a time.
+void draw_model(
+    const render_target_t* target,
+    model_t* model,
+    int render_mode,
+    const light_grid_t* lights,
+    const mat4x4_t* proj_mat,
+    projection_type proj_type,
+    vec3_t ambient,
+    vec3_t phong_ambient);
+
+// Depth prepass for a later draw_model with the same render_mode, the wireframe modes have nothing to prepass
+void draw_model_depth(
+    const render_target_t* target,
+    model_t* model,
+    int render_mode,
+    const mat4x4_t* proj_mat,
+    projection_type proj_type);
+
+// Draws count instances of the batch's model the way draw_model would draw the model, each in its own color unless
+// the mode is a wireframe. view_mat takes the instances' world space to view space. With lod_height above 0 each
+// instance is drawn at the level of detail its size on a target that many pixels tall calls for.
+void draw_instances(
+    const render_target_t* target,
+    instance_batch_t* batch,
+    const instance_t* instances,
+    int count,
+    int render_mode,
+    const light_grid_t* lights,
+    const mat4x4_t* view_mat,
+    const mat4x4_t* proj_mat,
+    projection_type proj_type,
+    vec3_t ambient,
+    vec3_t phong_ambient,
+    int lod_height);
+
+// Redraws the light's shadow map from the casters, aimed at light_target in view space, but only when the light or
+// a caster inside its frustum moved since the last time. Returns whether it was redrawn.
+bool update_shadow_map(
+    shadow_map_t* shadow,
+    const light_t* light,
+    vec3_t light_target,
+    model_t* const* casters,
+    int count);
+
+const char* render_mode_name(int render_mode);
+
+#endif //SOFTWARE_RENDERER_C_RENDER_MODES_H
\ No newline at end of file
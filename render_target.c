@@ -0,0 +1,76 @@
+﻿#include <stdlib.h>
+#include <stdio.h>
+#include "render_target.h"
+
+static bool is_valid_size(const int width, const int height) {
+    if (width < 1 || height < 1 || width > RENDER_TARGET_MAX_SIZE || height > RENDER_TARGET_MAX_SIZE) {
+        fprintf(stderr, "Render targets must be between 1x1 and %dx%d, got %dx%d.\n",
+            RENDER_TARGET_MAX_SIZE, RENDER_TARGET_MAX_SIZE, width, height);
+        return false;
+    }
+    return true;
+}
+
+render_target_t* make_render_target_for_buffer(uint32_t* color, const int width, const int height, const int stride) {
+    if (!is_valid_size(width, height) || stride < width)
+        return NULL;
+
+    render_target_t* target = calloc(1, sizeof(render_target_t));
+    if (target == NULL) {
+        fprintf(stderr, "Failed to allocate render target.\n");
+        return NULL;
+    }
+
+    target->width = width;
+    target->height = height;
+    target->stride = stride;
+    target->color = color;
+    target->z_buffer = make_z_buffer(width, height);
+    if (target->z_buffer == NULL) {
+        free(target);
+        return NULL;
+    }
+    return target;
+}
+
+render_target_t* make_render_target(const int width, const int height) {
+    if (!is_valid_size(width, height))
+        return NULL;
+
+    uint32_t* color = malloc((size_t)width * height * sizeof(uint32_t));
+    if (color == NULL) {
+        fprintf(stderr, "Failed to allocate render target color.\n");
+        return NULL;
+    }
+
+    render_target_t* target = make_render_target_for_buffer(color, width, height, width);
+    if (target == NULL) {
+        free(color);
+        return NULL;
+    }
+    target->owns_color = true;
+    return target;
+}
+
+void clear_render_target_color(const render_target_t* target, const uint32_t color) {
+    if (target->color == NULL)
+        return;
+
+    for (int y = 0; y < target->height; ++y) {
+        uint32_t* row = &target->color[y * target->stride];
+        for (int x = 0; x < target->width; ++x) {
+            row[x] = color;
+        }
+    }
+}
+
+void free_render_target(render_target_t* target) {
+    if (target == NULL)
+        return;
+
+    if (target->owns_color) {
+        free(target->color);
+    }
+    free_z_buffer(target->z_buffer);
+    free(target);
+}
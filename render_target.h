@@ -0,0 +1,32 @@
+﻿#ifndef SOFTWARE_RENDERER_C_RENDER_TARGET_H
+#define SOFTWARE_RENDERER_C_RENDER_TARGET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "z_buffer.h"
+
+// Targets may be up to this many pixels wide and tall. The rasterizer snaps vertices to 1/16 of a pixel on targets
+// up to 2013 pixels on their longer side, to 1/8 up to 4061 and to 1/4 beyond, which keeps its 32-bit edge
+// functions from overflowing. 1440p and 4K targets thus render with slightly coarser vertex positions.
+#define RENDER_TARGET_MAX_SIZE 7680
+
+// What the draw calls render into: XRGB8888 color and a depth buffer of the same size. The color rows are stride
+// pixels apart, which lets a target draw straight into a window's buffer or a part of a larger image.
+typedef struct {
+    int width;
+    int height;
+    int stride;
+    uint32_t* color;
+    z_buffer_t* z_buffer;
+    bool owns_color;
+} render_target_t;
+
+// NULL when a size is out of range or the allocation fails
+render_target_t* make_render_target(int width, int height);
+// Draws into color without taking it over, only the depth buffer is allocated. A NULL color makes a depth only
+// target for the depth pipelines.
+render_target_t* make_render_target_for_buffer(uint32_t* color, int width, int height, int stride);
+void             clear_render_target_color(const render_target_t* target, uint32_t color);
+void             free_render_target(render_target_t* target);
+
+#endif //SOFTWARE_RENDERER_C_RENDER_TARGET_H
\ No newline at end of file
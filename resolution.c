@@ -0,0 +1,51 @@
+﻿#include <math.h>
+#include "resolution.h"
+
+// Weight of the newest frame in the average
+#define RESOLUTION_SMOOTHING 0.25f
+// Frames at a new scale before it may change again
+#define RESOLUTION_SETTLE_FRAMES 4
+// A step up must be expected to leave this much of the budget spare, or the scale would flip back and forth
+#define RESOLUTION_HEADROOM 0.9f
+
+resolution_governor_t make_resolution_governor(const float budget_ms) {
+    return (resolution_governor_t){ budget_ms, 1.0f, 0.0f, 0 };
+}
+
+bool resolution_governor_update(resolution_governor_t* governor, const float frame_ms) {
+    governor->average_ms = governor->average_ms > 0.0f
+        ? governor->average_ms + RESOLUTION_SMOOTHING * (frame_ms - governor->average_ms)
+        : frame_ms;
+
+    if (governor->settle_frames > 0) {
+        governor->settle_frames--;
+        return false;
+    }
+
+    const float scale = governor->scale;
+    float next = scale;
+    if (governor->average_ms > governor->budget_ms) {
+        const float fit = scale * sqrtf(governor->budget_ms / governor->average_ms);
+        next = fmaxf(floorf(fit / RESOLUTION_SCALE_STEP) * RESOLUTION_SCALE_STEP, RESOLUTION_SCALE_MIN);
+    } else if (scale < 1.0f) {
+        const float up = scale + RESOLUTION_SCALE_STEP;
+        if (governor->average_ms * (up * up) / (scale * scale) < RESOLUTION_HEADROOM * governor->budget_ms) {
+            next = up;
+        }
+    }
+
+    if (next == scale)
+        return false;
+
+    governor->average_ms *= (next * next) / (scale * scale);
+    governor->scale = next;
+    governor->settle_frames = RESOLUTION_SETTLE_FRAMES;
+    return true;
+}
+
+void resolution_scaled_size(const float scale, const int width, const int height, int* scaled_width, int* scaled_height) {
+    const int w = (int)((float)width * scale + 0.5f);
+    const int h = (int)((float)height * scale + 0.5f);
+    *scaled_width = w > 1 ? w : 1;
+    *scaled_height = h > 1 ? h : 1;
+}
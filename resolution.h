@@ -0,0 +1,26 @@
+﻿#ifndef SOFTWARE_RENDERER_C_RESOLUTION_H
+#define SOFTWARE_RENDERER_C_RESOLUTION_H
+
+#include <stdbool.h>
+
+// Internal resolution, as a fraction of the window size on each side
+#define RESOLUTION_SCALE_MIN 0.5f
+#define RESOLUTION_SCALE_STEP 0.0625f
+
+// Picks the internal resolution that keeps the frame time within a budget. The rasterizer's cost follows the pixel
+// count, the square of the scale, so an over budget frame time drops the scale straight to the estimated fit while
+// spare time only raises it a step at a time, and only when the next step is expected to stay under budget too.
+typedef struct {
+    float budget_ms;
+    float scale;       // a multiple of RESOLUTION_SCALE_STEP
+    float average_ms;  // smoothed frame time, rescaled to the new scale on every change
+    int settle_frames; // the scale holds until the average has seen a few frames at it
+} resolution_governor_t;
+
+resolution_governor_t make_resolution_governor(float budget_ms);
+// Feeds the time of the last frame, true when the scale changed
+bool                  resolution_governor_update(resolution_governor_t* governor, float frame_ms);
+// Scaled size, at least 1x1
+void                  resolution_scaled_size(float scale, int width, int height, int* scaled_width, int* scaled_height);
+
+#endif //SOFTWARE_RENDERER_C_RESOLUTION_H
\ No newline at end of file
@@ -1,10 +1,12 @@
 ﻿#include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <SDL3_image/SDL_image.h>
 #include "sdl_gfx.h"
 
 sdl_gfx* sdl_gfx_init(char window_title[], const int width, const int height) {
-    sdl_gfx* gfx = malloc(sizeof(sdl_gfx));
+    sdl_gfx* gfx = calloc(1, sizeof(sdl_gfx));
 
     gfx->width = width;
     gfx->height = height;
@@ -31,6 +33,8 @@ sdl_gfx* sdl_gfx_init(char window_title[], const int width, const int height) {
         fprintf(stderr, "Failed to create texture: %s\n", SDL_GetError());
         return NULL;
     }
+    // Frames rendered below the window resolution are stretched by the renderer
+    SDL_SetTextureScaleMode(gfx->texture, SDL_SCALEMODE_LINEAR);
 
     gfx->buffer = malloc(width * height * 4);
     if (gfx->buffer == NULL) {
@@ -38,18 +42,239 @@ sdl_gfx* sdl_gfx_init(char window_title[], const int width, const int height) {
         return NULL;
     }
     gfx->bufferSize = width * height;
+    gfx->source_width = width;
+    gfx->source_height = height;
 
     return gfx;
 }
 
-void sdl_gfx_render(const sdl_gfx* gfx) {
-    if (SDL_UpdateTexture(gfx->texture, NULL, gfx->buffer, gfx->width * 4) == false) {
+sdl_gfx* sdl_gfx_init_headless(const int width, const int height) {
+    sdl_gfx* gfx = calloc(1, sizeof(sdl_gfx));
+    if (gfx == NULL) {
+        fprintf(stderr, "Failed to allocate gfx.\n");
+        return NULL;
+    }
+
+    gfx->width = width;
+    gfx->height = height;
+    gfx->headless = true;
+
+    gfx->buffer = malloc(width * height * 4);
+    if (gfx->buffer == NULL) {
+        fprintf(stderr, "Failed to allocate buffer.\n");
+        free(gfx);
+        return NULL;
+    }
+    gfx->bufferSize = width * height;
+    gfx->source_width = width;
+    gfx->source_height = height;
+
+    return gfx;
+}
+
+void sdl_gfx_set_frame_consumer(sdl_gfx* gfx, const sdl_gfx_frame_fn consumer, void* user_data) {
+    gfx->frame_consumer = consumer;
+    gfx->frame_consumer_data = user_data;
+}
+
+void sdl_gfx_set_dump_path(sdl_gfx* gfx, const char* path) {
+    gfx->dump_path = path;
+}
+
+void sdl_gfx_set_overlay_text(sdl_gfx* gfx, const char* text) {
+    gfx->overlay_text = text;
+}
+
+void sdl_gfx_set_source_size(sdl_gfx* gfx, const int width, const int height) {
+    gfx->source_width = width < gfx->width ? width : gfx->width;
+    gfx->source_height = height < gfx->height ? height : gfx->height;
+}
+
+static bool has_extension(const char* path, const char* ext) {
+    const size_t path_len = strlen(path);
+    const size_t ext_len = strlen(ext);
+    return path_len >= ext_len && SDL_strcasecmp(path + path_len - ext_len, ext) == 0;
+}
+
+static bool save_ppm(const sdl_gfx* gfx, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing.\n", path);
+        return false;
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", gfx->width, gfx->height);
+
+    uint8_t* row = malloc(gfx->width * 3);
+    bool ok = row != NULL;
+    for (int y = 0; ok && y < gfx->height; ++y) {
+        const uint32_t* src = &gfx->buffer[y * gfx->width];
+        for (int x = 0; x < gfx->width; ++x) {
+            row[x * 3 + 0] = RED(src[x]);
+            row[x * 3 + 1] = GREEN(src[x]);
+            row[x * 3 + 2] = BLUE(src[x]);
+        }
+        ok = fwrite(row, 3, gfx->width, file) == (size_t)gfx->width;
+    }
+
+    free(row);
+    if (fclose(file) != 0 || !ok) {
+        fprintf(stderr, "Failed to write %s.\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool save_png(const sdl_gfx* gfx, const char* path) {
+    SDL_Surface* surface = SDL_CreateSurfaceFrom(gfx->width, gfx->height, SDL_PIXELFORMAT_XRGB8888, gfx->buffer, gfx->width * 4);
+    if (surface == NULL) {
+        fprintf(stderr, "Failed to wrap frame buffer: %s\n", SDL_GetError());
+        return false;
+    }
+
+    const bool ok = IMG_SavePNG(surface, path);
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, SDL_GetError());
+    }
+    SDL_DestroySurface(surface);
+    return ok;
+}
+
+bool sdl_gfx_save(const sdl_gfx* gfx, const char* path) {
+    if (has_extension(path, ".png"))
+        return save_png(gfx, path);
+
+    return save_ppm(gfx, path);
+}
+
+// Only a single %d (optionally zero padded, e.g. %05d) is honored, anything else is used as a literal path
+static void format_dump_path(char* out, const size_t out_size, const char* pattern, const int frame_index) {
+    const char* spec = strchr(pattern, '%');
+    if (spec != NULL && strchr(spec + 1, '%') == NULL) {
+        const char* p = spec + 1;
+        while (*p >= '0' && *p <= '9') {
+            ++p;
+        }
+        if (*p == 'd') {
+            snprintf(out, out_size, pattern, frame_index);
+            return;
+        }
+    }
+    snprintf(out, out_size, "%s", pattern);
+}
+
+static bool is_upscaled(const sdl_gfx* gfx) {
+    return gfx->source_width != gfx->width || gfx->source_height != gfx->height;
+}
+
+// Position of the destination pixel centers in the source, 16.16 fixed point
+static int64_t source_position(const int i, const int source_size, const int size) {
+    const int64_t center = ((int64_t)(2 * i + 1) * source_size << 16) / (2 * size) - (1 << 15);
+    return center > 0 ? center : 0;
+}
+
+// Bilinear blend of two XRGB8888 pixels, weight of b in 0..256
+static uint32_t blend(const uint32_t a, const uint32_t b, const uint32_t weight) {
+    const uint32_t rb = ((a & 0xFF00FF) * (256 - weight) + (b & 0xFF00FF) * weight) >> 8;
+    const uint32_t g = ((a & 0x00FF00) * (256 - weight) + (b & 0x00FF00) * weight) >> 8;
+    return (rb & 0xFF00FF) | (g & 0x00FF00);
+}
+
+// Stretches the source over the whole buffer for whatever reads the buffer itself. The source is copied out first
+// since the output overwrites it.
+static bool upscale_source(sdl_gfx* gfx) {
+    const int sw = gfx->source_width;
+    const int sh = gfx->source_height;
+
+    if (gfx->upscale_buffer == NULL) {
+        gfx->upscale_buffer = malloc((size_t)gfx->bufferSize * sizeof(uint32_t));
+        if (gfx->upscale_buffer == NULL) {
+            fprintf(stderr, "Failed to allocate upscale buffer.\n");
+            return false;
+        }
+    }
+    for (int y = 0; y < sh; ++y) {
+        memcpy(&gfx->upscale_buffer[y * sw], &gfx->buffer[y * gfx->width], sw * sizeof(uint32_t));
+    }
+
+    for (int y = 0; y < gfx->height; ++y) {
+        const int64_t fy = source_position(y, sh, gfx->height);
+        const int y0 = (int)(fy >> 16) < sh - 1 ? (int)(fy >> 16) : sh - 1;
+        const int y1 = y0 + 1 < sh ? y0 + 1 : y0;
+        const uint32_t wy = (uint32_t)(fy >> 8) & 0xFF;
+        const uint32_t* row0 = &gfx->upscale_buffer[y0 * sw];
+        const uint32_t* row1 = &gfx->upscale_buffer[y1 * sw];
+        uint32_t* out = &gfx->buffer[y * gfx->width];
+
+        for (int x = 0; x < gfx->width; ++x) {
+            const int64_t fx = source_position(x, sw, gfx->width);
+            const int x0 = (int)(fx >> 16) < sw - 1 ? (int)(fx >> 16) : sw - 1;
+            const int x1 = x0 + 1 < sw ? x0 + 1 : x0;
+            const uint32_t wx = (uint32_t)(fx >> 8) & 0xFF;
+            out[x] = blend(blend(row0[x0], row0[x1], wx), blend(row1[x0], row1[x1], wx), wy);
+        }
+    }
+    return true;
+}
+
+static void hand_off_frame(sdl_gfx* gfx) {
+    if (gfx->frame_consumer != NULL) {
+        gfx->frame_consumer(gfx->buffer, gfx->width, gfx->height, gfx->frame_index, gfx->frame_consumer_data);
+    }
+
+    if (gfx->dump_path != NULL) {
+        char path[1024];
+        format_dump_path(path, sizeof(path), gfx->dump_path, gfx->frame_index);
+        sdl_gfx_save(gfx, path);
+    }
+
+    gfx->frame_index++;
+}
+
+static void render_overlay_text(const sdl_gfx* gfx) {
+    char line[256];
+    float y = 8.0f;
+
+    SDL_SetRenderDrawColor(gfx->renderer, 255, 255, 255, 255);
+    for (const char* p = gfx->overlay_text; *p != '\0'; y += SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2.0f) {
+        const size_t len = strcspn(p, "\n");
+        const size_t copy = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+        memcpy(line, p, copy);
+        line[copy] = '\0';
+        SDL_RenderDebugText(gfx->renderer, 8.0f, y, line);
+
+        p += len;
+        if (*p == '\n') {
+            ++p;
+        }
+    }
+    SDL_SetRenderDrawColor(gfx->renderer, 0, 0, 0, 255);
+}
+
+void sdl_gfx_render(sdl_gfx* gfx) {
+    // Dumps and frame consumers get window sized frames, the window alone lets the renderer stretch the source
+    bool upscaled = is_upscaled(gfx);
+    if (upscaled && (gfx->frame_consumer != NULL || gfx->dump_path != NULL) && upscale_source(gfx)) {
+        upscaled = false;
+    }
+
+    hand_off_frame(gfx);
+
+    if (gfx->headless)
+        return;
+
+    const SDL_Rect source = { 0, 0, upscaled ? gfx->source_width : gfx->width, upscaled ? gfx->source_height : gfx->height };
+    if (SDL_UpdateTexture(gfx->texture, &source, gfx->buffer, gfx->width * 4) == false) {
         printf("Error updating texture: %s", SDL_GetError());
         return;
     }
 
+    const SDL_FRect source_area = { 0.0f, 0.0f, (float)source.w, (float)source.h };
     SDL_RenderClear(gfx->renderer);
-    SDL_RenderTexture(gfx->renderer, gfx->texture, NULL, NULL);
+    SDL_RenderTexture(gfx->renderer, gfx->texture, &source_area, NULL);
+    if (gfx->overlay_text != NULL) {
+        render_overlay_text(gfx);
+    }
     SDL_RenderPresent(gfx->renderer);
 }
 
@@ -68,8 +293,12 @@ void sdl_gfx_clear(const sdl_gfx* gfx, const uint32_t color) {
 
 void sdl_gfx_dispose(const sdl_gfx* gfx) {
     free(gfx->buffer);
-    SDL_DestroyTexture(gfx->texture);
-    SDL_DestroyRenderer(gfx->renderer);
-    SDL_DestroyWindow(gfx->window);
-    SDL_Quit();
+    free(gfx->upscale_buffer);
+
+    if (!gfx->headless) {
+        SDL_DestroyTexture(gfx->texture);
+        SDL_DestroyRenderer(gfx->renderer);
+        SDL_DestroyWindow(gfx->window);
+        SDL_Quit();
+    }
 }
@@ -1,8 +1,12 @@
 ﻿#ifndef SOFTWARE_RENDERER_C_WINDOW_H
 #define SOFTWARE_RENDERER_C_WINDOW_H
 
+#include <stdbool.h>
 #include <SDL3/SDL.h>
 
+// Receives every presented frame, pixels are XRGB8888 rows of width pixels and stay valid only during the call
+typedef void (*sdl_gfx_frame_fn)(const uint32_t* pixels, int width, int height, int frame_index, void* user_data);
+
 typedef struct {
     int width;
     int height;
@@ -11,6 +15,21 @@ typedef struct {
     SDL_Texture* texture;
     uint32_t* buffer;
     int bufferSize;
+
+    // The frame fills only the top-left source_width x source_height pixels of the buffer when it was rendered
+    // at a lower resolution, rows still width pixels apart. Presenting scales it up to the whole window.
+    int source_width;
+    int source_height;
+    uint32_t* upscale_buffer; // copy of the source for the software upscale, allocated on first use
+
+    // Headless targets have no window, renderer or texture, presenting only hands the buffer on
+    bool headless;
+    sdl_gfx_frame_fn frame_consumer;
+    void* frame_consumer_data;
+    const char* dump_path; // .ppm or .png, may contain one %d for the frame index
+    int frame_index;
+
+    const char* overlay_text; // drawn over the window only, never into the buffer
 } sdl_gfx;
 
 #define RED(color) ((color >> 16) & 0xFF)
@@ -23,7 +42,13 @@ typedef struct {
 #define COLOR_RED RGB(255, 0, 0)
 
 sdl_gfx* sdl_gfx_init(char window_title[], int width, int height);
-void sdl_gfx_render(const sdl_gfx* gfx);
+sdl_gfx* sdl_gfx_init_headless(int width, int height);
+void sdl_gfx_set_frame_consumer(sdl_gfx* gfx, sdl_gfx_frame_fn consumer, void* user_data);
+void sdl_gfx_set_dump_path(sdl_gfx* gfx, const char* path);
+bool sdl_gfx_save(const sdl_gfx* gfx, const char* path);
+void sdl_gfx_set_overlay_text(sdl_gfx* gfx, const char* text);
+void sdl_gfx_set_source_size(sdl_gfx* gfx, int width, int height);
+void sdl_gfx_render(sdl_gfx* gfx);
 void sdl_gfx_draw_pixel(const sdl_gfx* gfx, int x, int y, uint32_t color);
 void sdl_gfx_clear(const sdl_gfx* gfx, uint32_t color);
 void sdl_gfx_dispose(const sdl_gfx *gfx);
@@ -0,0 +1,95 @@
+﻿#include <stdlib.h>
+#include <stdio.h>
+#include "shadow_map.h"
+#include "constants.h"
+#include "draw.h"
+
+shadow_map_t* make_shadow_map(const int size, const float fov, const int pcf_radius) {
+    shadow_map_t* shadow = calloc(1, sizeof(shadow_map_t));
+    if (shadow == NULL) {
+        fprintf(stderr, "Failed to allocate shadow map.\n");
+        return NULL;
+    }
+
+    // Only ever drawn with the depth pipelines, so there is no color to allocate
+    shadow->target = make_render_target_for_buffer(NULL, size, size, size);
+    if (shadow->target == NULL) {
+        free(shadow);
+        return NULL;
+    }
+    shadow->fov = fov;
+    shadow->pcf_radius = pcf_radius > 0 ? pcf_radius : 0;
+    return shadow;
+}
+
+void free_shadow_map(shadow_map_t* shadow) {
+    if (shadow == NULL)
+        return;
+
+    free_render_target(shadow->target);
+    free(shadow);
+}
+
+static bool same_caster(const shadow_caster_t* a, const shadow_caster_t* b) {
+    return vec3_equal(a->center, b->center) && a->radius == b->radius &&
+           vec3_equal(a->translation, b->translation) && vec3_equal(a->rotation, b->rotation) && a->scale == b->scale && a->lod == b->lod;
+}
+
+static bool is_in_frustum(const shadow_map_t* shadow, const shadow_caster_t* caster) {
+    const cluster_bounds_t bounds = { caster->center, caster->radius, {0.0f, 0.0f, 0.0f}, 0.0f };
+    return !is_cluster_culled(&bounds, &shadow->light_mat, PERSPECTIVE, false);
+}
+
+bool shadow_map_begin(shadow_map_t* shadow, const vec3_t light_position, const vec3_t light_target, const shadow_caster_t* casters, const int count) {
+    const bool light_moved = !shadow->valid || !vec3_equal(shadow->light_position, light_position) || !vec3_equal(shadow->light_target, light_target);
+    if (light_moved) {
+        const mat4x4_t view_mat = make_view_matrix(light_position, light_target);
+        const mat4x4_t proj_mat = make_perspective_matrix(shadow->fov, shadow->target->width, shadow->target->height, NEAR_PLANE, FAR_PLANE);
+        shadow->light_mat = mat4_mul(&proj_mat, &view_mat);
+        shadow->light_position = light_position;
+        shadow->light_target = light_target;
+    }
+
+    // A caster moving outside the frustum on both ends changes nothing the map holds
+    bool redraw = light_moved || count != shadow->casters_count || count > SHADOW_MAX_CASTERS;
+    for (int i = 0; i < count && i < SHADOW_MAX_CASTERS; ++i) {
+        const bool in_frustum = is_in_frustum(shadow, &casters[i]);
+        if (!same_caster(&shadow->casters[i], &casters[i]) && (in_frustum || shadow->casters_in_frustum[i])) {
+            redraw = true;
+        }
+        shadow->casters[i] = casters[i];
+        shadow->casters_in_frustum[i] = in_frustum;
+    }
+    shadow->casters_count = count;
+    shadow->valid = true;
+    return redraw;
+}
+
+float shadow_visibility(const shadow_map_t* shadow, const vec3_t pos) {
+    const vec4_t clip = mat4x4_mul_vec4(&shadow->light_mat, (vec4_t){pos.x, pos.y, pos.z, 1.0f});
+    if (!(clip.w >= 1.0f))
+        return 1.0f;
+
+    const int size = shadow->target->width;
+    const float inv_w = 1.0f / clip.w;
+    const float x = (clip.x * inv_w * 0.5f + 0.5f) * (float)size;
+    const float y = (-clip.y * inv_w * 0.5f + 0.5f) * (float)size;
+    if (!(x >= 0.0f && y >= 0.0f && x < (float)size && y < (float)size))
+        return 1.0f;
+
+    // The stored depth is the nearest w, the same measure as clip.w
+    const float depth = clip.w * (1.0f - SHADOW_DEPTH_BIAS);
+    const float* map = shadow->target->z_buffer->depth;
+    const int r = shadow->pcf_radius;
+    int lit = 0;
+    for (int dy = -r; dy <= r; ++dy) {
+        int ty = (int)y + dy;
+        ty = ty < 0 ? 0 : ty >= size ? size - 1 : ty;
+        for (int dx = -r; dx <= r; ++dx) {
+            int tx = (int)x + dx;
+            tx = tx < 0 ? 0 : tx >= size ? size - 1 : tx;
+            lit += depth <= map[ty * size + tx];
+        }
+    }
+    return (float)lit / (float)((2 * r + 1) * (2 * r + 1));
+}
@@ -0,0 +1,53 @@
+﻿#ifndef SOFTWARE_RENDERER_C_SHADOW_MAP_H
+#define SOFTWARE_RENDERER_C_SHADOW_MAP_H
+
+#include <stdbool.h>
+#include "matrix.h"
+#include "render_target.h"
+#include "vectors.h"
+
+// Casters a shadow map keeps track of, more are drawn but always count as moved
+#define SHADOW_MAX_CASTERS 16
+
+// Shadowed when farther from the light than the stored depth by more than this fraction of the distance, which
+// keeps surfaces from shadowing themselves where the map's texels are coarser than their slope
+#define SHADOW_DEPTH_BIAS 0.02f
+
+// What the cache compares between updates, where a caster is and how it was transformed
+typedef struct {
+    vec3_t center; // view space bounding sphere
+    float radius;
+    vec3_t translation;
+    vec3_t rotation;
+    float scale;
+    int lod; // a different level of detail is a different shape
+} shadow_caster_t;
+
+// Depth seen from a light through a perspective frustum aimed from its position at a target, both in view space.
+// The map is only redrawn when the light or a caster that is or was inside the frustum moved.
+typedef struct {
+    render_target_t* target; // depth only
+    float fov;
+    mat4x4_t light_mat;      // view space to the light's clip space
+    int pcf_radius;          // 0 takes one sample, r averages a (2r + 1)^2 texel square
+
+    bool valid;
+    vec3_t light_position;
+    vec3_t light_target;
+    shadow_caster_t casters[SHADOW_MAX_CASTERS];
+    bool casters_in_frustum[SHADOW_MAX_CASTERS];
+    int casters_count;
+} shadow_map_t;
+
+// A size x size map covering fov degrees, NULL when the size is out of range or the allocation fails
+shadow_map_t* make_shadow_map(int size, float fov, int pcf_radius);
+void          free_shadow_map(shadow_map_t* shadow);
+
+// Aims the map and compares the casters with the ones it was last drawn from. True when it has to be redrawn,
+// the caller then clears its depth and draws every caster with the light_mat it now holds.
+bool shadow_map_begin(shadow_map_t* shadow, vec3_t light_position, vec3_t light_target, const shadow_caster_t* casters, int count);
+
+// Fraction of the light reaching the view space position, 1 outside the map
+float shadow_visibility(const shadow_map_t* shadow, vec3_t pos);
+
+#endif //SOFTWARE_RENDERER_C_SHADOW_MAP_H
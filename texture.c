@@ -6,8 +6,51 @@
 #include <SDL3/SDL_surface.h>
 #include <SDL3_image/SDL_image.h>
 
+static int level_size(const int width, const int height) {
+    const int tiles_x = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    const int tiles_y = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    return tiles_x * tiles_y * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+}
+
+// Each texel averages the 2x2 block above it, odd sizes repeat their last row or column
+static void downsample(const uint32_t* src, const int src_width, const int src_height, uint32_t* dst, const int width, const int height) {
+    for (int y = 0; y < height; ++y) {
+        const int y0 = 2 * y < src_height ? 2 * y : src_height - 1;
+        const int y1 = 2 * y + 1 < src_height ? 2 * y + 1 : src_height - 1;
+        for (int x = 0; x < width; ++x) {
+            const int x0 = 2 * x < src_width ? 2 * x : src_width - 1;
+            const int x1 = 2 * x + 1 < src_width ? 2 * x + 1 : src_width - 1;
+            const uint32_t c[4] = {
+                src[y0 * src_width + x0], src[y0 * src_width + x1],
+                src[y1 * src_width + x0], src[y1 * src_width + x1]
+            };
+
+            uint32_t out = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                const uint32_t sum = (c[0] >> shift & 0xFF) + (c[1] >> shift & 0xFF) + (c[2] >> shift & 0xFF) + (c[3] >> shift & 0xFF);
+                out |= (sum + 2) / 4 << shift;
+            }
+            dst[y * width + x] = out;
+        }
+    }
+}
+
+// Padding texels of partial tiles repeat the edge, they are never sampled but stay defined
+static void store_tiled(const texture_level_t* level, const uint32_t* linear) {
+    const int padded_width = level->tiles_x * TEXTURE_TILE_SIZE;
+    const int padded_height = (level->height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+    for (int y = 0; y < padded_height; ++y) {
+        const int src_y = y < level->height ? y : level->height - 1;
+        for (int x = 0; x < padded_width; ++x) {
+            const int src_x = x < level->width ? x : level->width - 1;
+            level->texels[texture_texel_index(level, x, y)] = linear[src_y * level->width + src_x];
+        }
+    }
+}
+
 texture_t load_texture_from_file(const char* path) {
-    texture_t texture = {0, 0, NULL};
+    texture_t texture = {0};
+    texture.address = TEXTURE_WRAP;
 
     SDL_Surface* surface = IMG_Load(path);
     if (!surface) {
@@ -22,21 +65,110 @@ texture_t load_texture_from_file(const char* path) {
         return texture;
     }
 
-    texture.width = converted->w;
-    texture.height = converted->h;
+    const int width = converted->w;
+    const int height = converted->h;
 
-    const size_t size = (size_t)texture.width * (size_t)texture.height;
-    texture.pixels = malloc(size * sizeof(uint32_t));
-    if (!texture.pixels) {
+    int level_count = 1;
+    size_t total = level_size(width, height);
+    for (int w = width, h = height; (w > 1 || h > 1) && level_count < TEXTURE_MAX_LEVELS; ++level_count) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+        total += level_size(w, h);
+    }
+
+    // Two linear scratch levels, the one being read and the one being built
+    uint32_t* linear = malloc((size_t)width * height * sizeof(uint32_t));
+    uint32_t* next = malloc((size_t)width * height * sizeof(uint32_t));
+    texture.pixels = SDL_aligned_alloc(64, total * sizeof(uint32_t));
+    if (!linear || !next || !texture.pixels) {
         fprintf(stderr, "Failed to allocate memory for pixels\n");
+        free(linear);
+        free(next);
+        SDL_aligned_free(texture.pixels);
+        texture.pixels = NULL;
         SDL_DestroySurface(converted);
-        texture.width = texture.height = 0;
         return texture;
     }
 
-    memcpy(texture.pixels, converted->pixels, size * sizeof(uint32_t));
-
+    for (int y = 0; y < height; ++y) {
+        memcpy(linear + (size_t)y * width, (const uint8_t*)converted->pixels + (size_t)y * converted->pitch, width * sizeof(uint32_t));
+    }
     SDL_DestroySurface(converted);
 
+    texture.width = width;
+    texture.height = height;
+    texture.level_count = level_count;
+
+    uint32_t* texels = texture.pixels;
+    for (int i = 0; i < level_count; ++i) {
+        texture_level_t* level = &texture.levels[i];
+        if (i > 0) {
+            const texture_level_t* above = &texture.levels[i - 1];
+            level->width = above->width > 1 ? above->width / 2 : 1;
+            level->height = above->height > 1 ? above->height / 2 : 1;
+            downsample(linear, above->width, above->height, next, level->width, level->height);
+            uint32_t* swap = linear;
+            linear = next;
+            next = swap;
+        }
+        else {
+            level->width = width;
+            level->height = height;
+        }
+        level->tiles_x = (level->width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+        level->texels = texels;
+        store_tiled(level, linear);
+        texels += level_size(level->width, level->height);
+    }
+
+    free(linear);
+    free(next);
+
     return texture;
+}
+
+void free_texture(texture_t* texture) {
+    SDL_aligned_free(texture->pixels);
+    *texture = (texture_t){0};
+}
+
+void texture_set_address(texture_t* texture, const texture_address address) {
+    texture->address = address;
+}
+
+const char* texture_filter_name(const texture_filter filter) {
+    switch (filter) {
+        case TEXTURE_NEAREST: return "nearest";
+        case TEXTURE_BILINEAR: return "bilinear";
+        case TEXTURE_TRILINEAR: return "trilinear";
+    }
+    return "unknown";
+}
+
+bool texture_filter_from_name(const char* name, texture_filter* filter) {
+    for (texture_filter f = TEXTURE_NEAREST; f <= TEXTURE_TRILINEAR; ++f) {
+        if (strcmp(name, texture_filter_name(f)) == 0) {
+            *filter = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* texture_address_name(const texture_address address) {
+    switch (address) {
+        case TEXTURE_WRAP: return "wrap";
+        case TEXTURE_CLAMP: return "clamp";
+    }
+    return "unknown";
+}
+
+bool texture_address_from_name(const char* name, texture_address* address) {
+    for (texture_address a = TEXTURE_WRAP; a <= TEXTURE_CLAMP; ++a) {
+        if (strcmp(name, texture_address_name(a)) == 0) {
+            *address = a;
+            return true;
+        }
+    }
+    return false;
 }
\ No newline at end of file
@@ -3,12 +3,51 @@
 
 #include <SDL3/SDL.h>
 
+// Levels are stored in tiles of 4x4 texels, one 64-byte cache line each, with the texels of a tile in Morton
+// (Z) order and the tiles row by row. Neighbouring texels in both directions then mostly share a line.
+#define TEXTURE_TILE_SIZE 4
+#define TEXTURE_MAX_LEVELS 16
+
+// Coordinates are clamped to +-this before addressing, where floats still hold every integer exactly
+#define TEXTURE_COORD_LIMIT 4194304.0f
+
+typedef enum { TEXTURE_WRAP, TEXTURE_CLAMP } texture_address;
+typedef enum { TEXTURE_NEAREST, TEXTURE_BILINEAR, TEXTURE_TRILINEAR } texture_filter;
+#define TEXTURE_ADDRESS_COUNT 2
+#define TEXTURE_FILTER_COUNT 3
+
+typedef struct {
+    int width;
+    int height;
+    int tiles_x;
+    uint32_t* texels; // into texture_t.pixels
+} texture_level_t;
+
 typedef struct {
     int width;
     int height;
-    uint32_t* pixels;
+    uint32_t* pixels; // every level, tiled, 64-byte aligned
+    texture_level_t levels[TEXTURE_MAX_LEVELS];
+    int level_count;  // down to 1x1, 0 when loading failed
+    texture_address address;
 } texture_t;
 
+// Loaded textures wrap, see texture_set_address
 texture_t load_texture_from_file(const char* path);
+void      free_texture(texture_t* texture);
+
+// How coordinates outside [0, 1] address the texture: wrap repeats it, clamp stretches its edge texels
+void texture_set_address(texture_t* texture, texture_address address);
+
+const char* texture_filter_name(texture_filter filter);
+bool        texture_filter_from_name(const char* name, texture_filter* filter);
+const char* texture_address_name(texture_address address);
+bool        texture_address_from_name(const char* name, texture_address* address);
+
+static inline int texture_texel_index(const texture_level_t* level, const int x, const int y) {
+    const int tile = (y >> 2) * level->tiles_x + (x >> 2);
+    const int morton = (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2;
+    return tile * (TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE) + morton;
+}
 
 #endif //SOFTWARE_RENDERER_C_TEXTURE_H
\ No newline at end of file
@@ -0,0 +1,107 @@
+﻿#include <stdlib.h>
+#include <stdio.h>
+#include "thread_pool.h"
+
+static void run_jobs(thread_pool_t* pool) {
+    int i;
+    while ((i = SDL_AddAtomicInt(&pool->next_job, 1)) < pool->job_count) {
+        pool->job(pool->ctx, i);
+    }
+}
+
+static int worker_main(void* data) {
+    thread_pool_t* pool = data;
+
+    for (;;) {
+        SDL_WaitSemaphore(pool->start);
+        if (pool->quit)
+            break;
+
+        run_jobs(pool);
+        SDL_SignalSemaphore(pool->done);
+    }
+
+    return 0;
+}
+
+thread_pool_t* thread_pool_init(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = SDL_GetNumLogicalCPUCores();
+    }
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+
+    thread_pool_t* pool = calloc(1, sizeof(thread_pool_t));
+    if (pool == NULL) {
+        fprintf(stderr, "Failed to allocate thread pool.\n");
+        return NULL;
+    }
+
+    pool->start = SDL_CreateSemaphore(0);
+    pool->done = SDL_CreateSemaphore(0);
+    pool->threads = calloc(thread_count, sizeof(SDL_Thread*));
+    if (pool->start == NULL || pool->done == NULL || pool->threads == NULL) {
+        fprintf(stderr, "Failed to create thread pool: %s\n", SDL_GetError());
+        thread_pool_dispose(pool);
+        return NULL;
+    }
+
+    // The calling thread takes part in every run, so spawn one less worker
+    for (int i = 0; i < thread_count - 1; ++i) {
+        pool->threads[i] = SDL_CreateThread(worker_main, "raster_worker", pool);
+        if (pool->threads[i] == NULL) {
+            fprintf(stderr, "Failed to create worker thread: %s\n", SDL_GetError());
+            break;
+        }
+        pool->worker_count++;
+    }
+
+    return pool;
+}
+
+void thread_pool_run(thread_pool_t* pool, const thread_pool_job_fn job, void* ctx, const int job_count) {
+    if (pool == NULL || pool->worker_count == 0 || job_count <= 1) {
+        for (int i = 0; i < job_count; ++i) {
+            job(ctx, i);
+        }
+        return;
+    }
+
+    pool->job = job;
+    pool->ctx = ctx;
+    pool->job_count = job_count;
+    SDL_SetAtomicInt(&pool->next_job, 0);
+
+    for (int i = 0; i < pool->worker_count; ++i) {
+        SDL_SignalSemaphore(pool->start);
+    }
+
+    run_jobs(pool);
+
+    for (int i = 0; i < pool->worker_count; ++i) {
+        SDL_WaitSemaphore(pool->done);
+    }
+}
+
+int thread_pool_thread_count(const thread_pool_t* pool) {
+    return pool == NULL ? 1 : pool->worker_count + 1;
+}
+
+void thread_pool_dispose(thread_pool_t* pool) {
+    if (pool == NULL)
+        return;
+
+    pool->quit = true;
+    for (int i = 0; i < pool->worker_count; ++i) {
+        SDL_SignalSemaphore(pool->start);
+    }
+    for (int i = 0; i < pool->worker_count; ++i) {
+        SDL_WaitThread(pool->threads[i], NULL);
+    }
+
+    if (pool->start) SDL_DestroySemaphore(pool->start);
+    if (pool->done) SDL_DestroySemaphore(pool->done);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,27 @@
+﻿#ifndef SOFTWARE_RENDERER_C_THREAD_POOL_H
+#define SOFTWARE_RENDERER_C_THREAD_POOL_H
+
+#include <stdbool.h>
+#include <SDL3/SDL.h>
+
+typedef void (*thread_pool_job_fn)(void* ctx, int job_index);
+
+typedef struct {
+    SDL_Thread** threads;
+    int worker_count;
+    SDL_Semaphore* start;
+    SDL_Semaphore* done;
+    SDL_AtomicInt next_job;
+    thread_pool_job_fn job;
+    void* ctx;
+    int job_count;
+    bool quit;
+} thread_pool_t;
+
+// thread_count includes the calling thread, 0 picks one thread per logical core
+thread_pool_t* thread_pool_init(int thread_count);
+void thread_pool_run(thread_pool_t* pool, thread_pool_job_fn job, void* ctx, int job_count);
+int  thread_pool_thread_count(const thread_pool_t* pool);
+void thread_pool_dispose(thread_pool_t* pool);
+
+#endif //SOFTWARE_RENDERER_C_THREAD_POOL_H
\ No newline at end of file
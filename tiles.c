@@ -0,0 +1,70 @@
+﻿#include <stdlib.h>
+#include <math.h>
+#include "tiles.h"
+
+tile_grid_t make_tile_grid(const int width, const int height) {
+    tile_grid_t grid;
+    grid.width = width;
+    grid.height = height;
+    grid.cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+    grid.rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    grid.bins = calloc(grid.cols * grid.rows, sizeof(tile_bin_t));
+    return grid;
+}
+
+void clear_tile_grid(tile_grid_t* grid) {
+    for (int i = 0; i < grid->cols * grid->rows; ++i) {
+        grid->bins[i].count = 0;
+    }
+}
+
+static void bin_push(tile_bin_t* bin, const int index) {
+    if (bin->count == bin->capacity) {
+        bin->capacity = bin->capacity ? bin->capacity * 2 : 64;
+        bin->indices = realloc(bin->indices, bin->capacity * sizeof(int));
+    }
+    bin->indices[bin->count++] = index;
+}
+
+void tile_grid_bin(tile_grid_t* grid, const int index, const float min_x, const float min_y, const float max_x, const float max_y) {
+    // One pixel of slack on each side, the fillers truncate float positions that may land just outside the bounds
+    const float x0 = fmaxf(floorf(min_x) - 1.0f, 0.0f);
+    const float y0 = fmaxf(floorf(min_y) - 1.0f, 0.0f);
+    const float x1 = fminf(floorf(max_x) + 1.0f, (float)(grid->width - 1));
+    const float y1 = fminf(floorf(max_y) + 1.0f, (float)(grid->height - 1));
+
+    if (!(x0 <= x1 && y0 <= y1))
+        return;
+
+    const int col0 = (int)x0 / TILE_SIZE;
+    const int col1 = (int)x1 / TILE_SIZE;
+    const int row0 = (int)y0 / TILE_SIZE;
+    const int row1 = (int)y1 / TILE_SIZE;
+
+    for (int row = row0; row <= row1; ++row) {
+        for (int col = col0; col <= col1; ++col) {
+            bin_push(&grid->bins[row * grid->cols + col], index);
+        }
+    }
+}
+
+rect_t tile_grid_rect(const tile_grid_t* grid, const int tile) {
+    const int col = tile % grid->cols;
+    const int row = tile / grid->cols;
+
+    rect_t rect;
+    rect.x0 = col * TILE_SIZE;
+    rect.y0 = row * TILE_SIZE;
+    rect.x1 = rect.x0 + TILE_SIZE < grid->width ? rect.x0 + TILE_SIZE : grid->width;
+    rect.y1 = rect.y0 + TILE_SIZE < grid->height ? rect.y0 + TILE_SIZE : grid->height;
+    return rect;
+}
+
+void free_tile_grid(tile_grid_t* grid) {
+    for (int i = 0; i < grid->cols * grid->rows; ++i) {
+        free(grid->bins[i].indices);
+    }
+    free(grid->bins);
+    grid->bins = NULL;
+    grid->cols = grid->rows = 0;
+}
@@ -0,0 +1,31 @@
+﻿#ifndef SOFTWARE_RENDERER_C_TILES_H
+#define SOFTWARE_RENDERER_C_TILES_H
+
+#define TILE_SIZE 64
+
+typedef struct {
+    int x0, y0;
+    int x1, y1; // exclusive
+} rect_t;
+
+typedef struct {
+    int* indices;
+    int count;
+    int capacity;
+} tile_bin_t;
+
+typedef struct {
+    int width;
+    int height;
+    int cols;
+    int rows;
+    tile_bin_t* bins;
+} tile_grid_t;
+
+tile_grid_t make_tile_grid(int width, int height);
+void        clear_tile_grid(tile_grid_t* grid);
+void        tile_grid_bin(tile_grid_t* grid, int index, float min_x, float min_y, float max_x, float max_y);
+rect_t      tile_grid_rect(const tile_grid_t* grid, int tile);
+void        free_tile_grid(tile_grid_t* grid);
+
+#endif //SOFTWARE_RENDERER_C_TILES_H
\ No newline at end of file
@@ -44,11 +44,6 @@ float vec3_dot(const vec3_t v1, const vec3_t v2) {
     return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
 }
 
-void vec3_floor_xy(vec3_t *v) {
-    v->x = floorf(v->x);
-    v->y = floorf(v->y);
-}
-
 vec3_t vec3_diff(const vec3_t v1, const vec3_t v2) {
     return (vec3_t){v1.x - v2.x, v1.y - v2.y, v1.z - v2.z};
 }
@@ -61,6 +56,22 @@ vec3_t vec3_mul(const vec3_t v, const float s) {
     return (vec3_t){v.x * s, v.y * s, v.z * s};
 }
 
+bool vec3_equal(const vec3_t v1, const vec3_t v2) {
+    return v1.x == v2.x && v1.y == v2.y && v1.z == v2.z;
+}
+
+float fraction(const float x) {
+    return x - floorf(x);
+}
+
+vec3_t hue_rgb(const float h) {
+    return (vec3_t){
+        fminf(fmaxf(fabsf(h * 6.0f - 3.0f) - 1.0f, 0.0f), 1.0f),
+        fminf(fmaxf(2.0f - fabsf(h * 6.0f - 2.0f), 0.0f), 1.0f),
+        fminf(fmaxf(2.0f - fabsf(h * 6.0f - 4.0f), 0.0f), 1.0f)
+    };
+}
+
 vec2_t vec2_diff(const vec2_t v1, const vec2_t v2) {
     return (vec2_t){v1.x - v2.x, v1.y - v2.y};
 }
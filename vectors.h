@@ -1,6 +1,8 @@
 ﻿#ifndef SOFTWARE_RENDERER_C_VECTORS_H
 #define SOFTWARE_RENDERER_C_VECTORS_H
 
+#include <stdbool.h>
+
 typedef struct {
     float x, y;
 } vec2_t;
@@ -17,10 +19,16 @@ vec3_t vec3_normalize(vec3_t v);
 float  fast_inverse_sqrt(float x);
 vec3_t vec3_cross(vec3_t v1, vec3_t v2);
 float  vec3_dot(vec3_t v1, vec3_t v2);
-void   vec3_floor_xy(vec3_t* v);
 vec3_t vec3_diff(vec3_t v1, vec3_t v2);
 vec3_t vec3_add(vec3_t v1, vec3_t v2);
 vec3_t vec3_mul(vec3_t v, float s);
+// Exact comparison, for telling whether something moved since it was last seen
+bool   vec3_equal(vec3_t v1, vec3_t v2);
+
+// x - floor(x), in [0, 1)
+float  fraction(float x);
+// Fully saturated color of hue h in [0, 1), each channel in [0, 1]
+vec3_t hue_rgb(float h);
 
 vec2_t vec2_diff(vec2_t v1, vec2_t v2);
 vec2_t vec2_from_vec3(vec3_t v);
@@ -1,14 +1,43 @@
 ﻿#include <stdlib.h>
+#include <stdio.h>
 #include <float.h>
 #include "z_buffer.h"
 
 void clear_z_buffer(z_buffer_t *z_buffer) {
-    for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i) {
-        (*z_buffer)[i] = FLT_MAX;
+    for (int i = 0; i < z_buffer->width * z_buffer->height; ++i) {
+        z_buffer->depth[i] = FLT_MAX;
+    }
+    for (int i = 0; i < z_buffer->hiz_cols * z_buffer->hiz_rows; ++i) {
+        z_buffer->tile_max[i] = FLT_MAX;
     }
 }
 
-z_buffer_t* make_z_buffer() {
-    z_buffer_t* z_buffer = malloc(SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(float));
+z_buffer_t* make_z_buffer(const int width, const int height) {
+    z_buffer_t* z_buffer = calloc(1, sizeof(z_buffer_t));
+    if (z_buffer == NULL) {
+        fprintf(stderr, "Failed to allocate z buffer.\n");
+        return NULL;
+    }
+
+    z_buffer->width = width;
+    z_buffer->height = height;
+    z_buffer->hiz_cols = (width + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+    z_buffer->hiz_rows = (height + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+    z_buffer->depth = malloc((size_t)width * height * sizeof(float));
+    z_buffer->tile_max = malloc((size_t)z_buffer->hiz_cols * z_buffer->hiz_rows * sizeof(float));
+    if (z_buffer->depth == NULL || z_buffer->tile_max == NULL) {
+        fprintf(stderr, "Failed to allocate z buffer.\n");
+        free_z_buffer(z_buffer);
+        return NULL;
+    }
     return z_buffer;
 }
+
+void free_z_buffer(z_buffer_t* z_buffer) {
+    if (z_buffer == NULL)
+        return;
+
+    free(z_buffer->depth);
+    free(z_buffer->tile_max);
+    free(z_buffer);
+}
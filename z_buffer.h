@@ -1,11 +1,20 @@
 ﻿#ifndef SOFTWARE_RENDERER_C_Z_BUFFER_H
 #define SOFTWARE_RENDERER_C_Z_BUFFER_H
 
-#include "constants.h"
+#define HIZ_TILE_SIZE 8
 
-typedef float z_buffer_t[SCREEN_WIDTH * SCREEN_HEIGHT];
+typedef struct {
+    int width;
+    int height;
+    float* depth; // rows of width
+    // Hierarchical Z, per 8x8 block a depth no nearer than the farthest one stored in it
+    int hiz_cols;
+    int hiz_rows;
+    float* tile_max;
+} z_buffer_t;
 
 void        clear_z_buffer(z_buffer_t* z_buffer);
-z_buffer_t* make_z_buffer();
+z_buffer_t* make_z_buffer(int width, int height);
+void        free_z_buffer(z_buffer_t* z_buffer);
 
 #endif //SOFTWARE_RENDERER_C_Z_BUFFER_H
\ No newline at end of file